@@ -0,0 +1,34 @@
+#ifndef CLIENSERVERECN_ASSET_HPP
+#define CLIENSERVERECN_ASSET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Номер актива. Активы регистрируются в ядре по имени при добавлении инструментов
+// и нумеруются подряд, поэтому новая валюта не требует изменений в коде.
+// Номера хранятся в журнале и снимке.
+using AssetId = uint8_t;
+
+constexpr size_t kMaxAssets = 256;
+// Имя актива в снимке хранится в поле фиксированной длины
+constexpr size_t kMaxAssetName = 8;
+
+// Имя актива: от 1 до kMaxAssetName заглавных латинских букв и цифр
+inline bool IsAssetName(const std::string& aName)
+{
+  if (aName.empty() || aName.size() > kMaxAssetName)
+  {
+    return false;
+  }
+  for (char c : aName)
+  {
+    if ((c < 'A' || c > 'Z') && (c < '0' || c > '9'))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif //CLIENSERVERECN_ASSET_HPP
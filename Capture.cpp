@@ -0,0 +1,163 @@
+#include "Capture.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+  constexpr char kMagic[8] = {'E', 'C', 'N', 'C', 'A', 'P', '0', '1'};
+  // Заголовок записи: время, сессия, тип, длина данных
+  constexpr size_t kHeaderSize = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t) +
+      sizeof(uint32_t);
+  // Защита от мусора вместо длины в поврежденном файле
+  constexpr uint32_t kMaxDataSize = 1 << 24;
+  // Буфер сбрасывается на диск, когда накопилось столько байт...
+  constexpr size_t kFlushBytes = 1 << 20;
+  // ...или не реже этого
+  constexpr std::chrono::milliseconds kFlushDelay {100};
+
+  template <typename T>
+  void put(std::vector<char>& aOut, const T& aValue)
+  {
+    const char* bytes = reinterpret_cast<const char*>(&aValue);
+    aOut.insert(aOut.end(), bytes, bytes + sizeof(T));
+  }
+
+  template <typename T>
+  T get(const char*& aIt)
+  {
+    T value;
+    std::memcpy(&value, aIt, sizeof(T));
+    aIt += sizeof(T);
+    return value;
+  }
+
+  void writeAll(int aFd, const char* aData, size_t aSize)
+  {
+    size_t written = 0;
+    while (written < aSize)
+    {
+      const ssize_t n = ::write(aFd, aData + written, aSize - written);
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n < 0)
+      {
+        // Запись трафика вспомогательная: сервер продолжает работу без нее
+        std::cerr << "Capture write failed: " << std::strerror(errno) << std::endl;
+        return;
+      }
+      written += static_cast<size_t>(n);
+    }
+  }
+} // namespace
+
+Capture::Capture(const std::string& aPath)
+  : mStart{std::chrono::steady_clock::now()}
+{
+  mFd = ::open(aPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (mFd < 0)
+  {
+    throw std::runtime_error("Could not open capture " + aPath);
+  }
+  writeAll(mFd, kMagic, sizeof(kMagic));
+
+  mWriter = std::thread(&Capture::WriterLoop, this);
+}
+
+Capture::~Capture()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWriterCv.notify_one();
+  mWriter.join();
+  ::close(mFd);
+}
+
+void Capture::Record(uint32_t aSession, CaptureRecord::Type aType,
+    const char* aData, size_t aSize)
+{
+  const uint64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - mStart).count();
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  put(mPending, timeNs);
+  put(mPending, aSession);
+  put(mPending, static_cast<uint8_t>(aType));
+  put(mPending, static_cast<uint32_t>(aSize));
+  mPending.insert(mPending.end(), aData, aData + aSize);
+  if (mPending.size() >= kFlushBytes)
+  {
+    mWriterCv.notify_one();
+  }
+}
+
+uint64_t Capture::Read(const std::string& aPath, const Handler& aHandler)
+{
+  std::ifstream in(aPath, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!in)
+  {
+    throw std::runtime_error("Could not open capture " + aPath);
+  }
+  if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+  {
+    throw std::runtime_error("Not a capture file " + aPath);
+  }
+
+  uint64_t count = 0;
+  char header[kHeaderSize];
+  CaptureRecord record;
+  while (in.read(header, kHeaderSize))
+  {
+    const char* it = header;
+    record.timeNs = get<uint64_t>(it);
+    record.session = get<uint32_t>(it);
+    record.type = static_cast<CaptureRecord::Type>(get<uint8_t>(it));
+    const uint32_t size = get<uint32_t>(it);
+    if (size > kMaxDataSize)
+    {
+      break;
+    }
+    record.data.resize(size);
+    if (!in.read(&record.data[0], size))
+    {
+      break;
+    }
+
+    if (aHandler)
+    {
+      aHandler(record);
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+void Capture::WriterLoop()
+{
+  std::vector<char> batch;
+  std::unique_lock<std::mutex> lock(mMutex);
+
+  while (!mStop || !mPending.empty())
+  {
+    mWriterCv.wait_for(lock, kFlushDelay,
+        [&] { return mStop || mPending.size() >= kFlushBytes; });
+
+    batch.swap(mPending);
+    lock.unlock();
+    writeAll(mFd, batch.data(), batch.size());
+    batch.clear();
+    lock.lock();
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef CLIENSERVERECN_CAPTURE_HPP
+#define CLIENSERVERECN_CAPTURE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Событие клиентской сессии, записанное в файл трафика
+struct CaptureRecord
+{
+  enum class Type : uint8_t
+  {
+    Connect = 1,   // клиент подключился
+    Request = 2,   // прочитан запрос клиента
+    Reply = 3,     // клиенту отправлено сообщение (ответ или рыночные данные)
+    Disconnect = 4 // сессия закрыта
+  };
+
+  // Наносекунды от начала записи
+  uint64_t timeNs = 0;
+  uint32_t session = 0;
+  Type type = Type::Connect;
+  // Байты запроса или сообщения как они прошли через сокет
+  std::string data;
+};
+
+// Запись трафика сессий сервера для воспроизведения нагрузки.
+// Файл начинается с сигнатуры, за ней записи: uint64 время, uint32 номер сессии,
+// uint8 тип, uint32 длина данных, данные. Record только копирует событие в буфер,
+// на диск пачки пишет отдельный поток (без fsync: потерять хвост записи при падении
+// не страшно). Оборванный хвост при чтении отбрасывается.
+class Capture
+{
+public:
+  using Handler = std::function<void(const CaptureRecord&)>;
+
+  // Создает файл заново. Бросает std::runtime_error, если файл не открыть.
+  explicit Capture(const std::string& aPath);
+  ~Capture();
+
+  Capture(const Capture&) = delete;
+  Capture& operator=(const Capture&) = delete;
+
+  // Добавляет событие сессии aSession с текущим временем. Можно вызывать
+  // из нескольких потоков.
+  void Record(uint32_t aSession, CaptureRecord::Type aType,
+      const char* aData = nullptr, size_t aSize = 0);
+
+  // Читает файл и передает записи в aHandler по порядку. Возвращает число записей.
+  // Бросает std::runtime_error, если файл не открыть или это не запись трафика.
+  static uint64_t Read(const std::string& aPath, const Handler& aHandler);
+
+private:
+  void WriterLoop();
+
+private:
+  int mFd;
+  const std::chrono::steady_clock::time_point mStart;
+
+  std::mutex mMutex;
+  std::condition_variable mWriterCv;
+  std::vector<char> mPending;
+  bool mStop = false;
+
+  std::thread mWriter;
+};
+
+#endif //CLIENSERVERECN_CAPTURE_HPP
@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/bind/bind.hpp>
+#include <boost/asio.hpp>
+
+#include "Capture.hpp"
+#include "Common.hpp"
+#include "json.hpp"
+
+// Воспроизведение записанного трафика (Server --capture) на работающем сервере:
+// каждая записанная сессия открывает свое подключение и отправляет свои запросы.
+// Запросы отправляются в записанном темпе, ускоренном в N раз, или без пауз.
+// Сессии воспроизводятся независимо: следующий запрос сессии ждет только ответа
+// на ее предыдущий запрос (если он был в записи), а не других сессий. Ответ
+// отличается от рассылок (рыночных данных и отчетов об исполнении) по формату
+// сообщения, поэтому подписанная сессия не принимает рассылку за ответ.
+// Запросы отправляются байт в байт, с записанными номерами пользователей, поэтому
+// сервер стоит запускать из того же состояния (снимка, журнала), что и при записи.
+
+using boost::asio::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+struct CaptureReplayOptions
+{
+    std::string inputPath;
+    std::string host = "127.0.0.1";
+    unsigned short port = ::port;
+    // Во сколько раз быстрее записи; 0 - без пауз
+    double speed = 1;
+};
+
+// Разбор аргументов командной строки:
+//   CaptureReplay [параметры] <файл>
+//   --host <host>                адрес сервера (по умолчанию 127.0.0.1)
+//   --port <port>                порт сервера
+//   --speed <N>|max              темп относительно записи (по умолчанию 1)
+CaptureReplayOptions ParseOptions(int argc, char* argv[])
+{
+    CaptureReplayOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc)
+        {
+            options.host = argv[++i];
+        }
+        else if (arg == "--port" && i + 1 < argc)
+        {
+            options.port = static_cast<unsigned short>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--speed" && i + 1 < argc)
+        {
+            const std::string speed = argv[++i];
+            options.speed = (speed == "max") ? 0 : std::stod(speed);
+            if (options.speed < 0)
+            {
+                throw std::invalid_argument("Incorrect speed " + speed);
+            }
+        }
+        else if (options.inputPath.empty() && arg.compare(0, 2, "--") != 0)
+        {
+            options.inputPath = arg;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (options.inputPath.empty())
+    {
+        throw std::invalid_argument("Usage: CaptureReplay [options] <capture>");
+    }
+
+    return options;
+}
+
+// Шаг воспроизведения: подключение, запрос или отключение сессии
+struct replay_step
+{
+    CaptureRecord::Type type;
+    std::chrono::nanoseconds at;
+    std::string data;
+    // В записи на запрос пришел ответ до следующего запроса сессии
+    bool expects_reply = false;
+};
+
+// Шаги одного подключения записанной сессии по порядку
+typedef std::vector<replay_step> replay_script;
+
+struct replay_capture
+{
+    std::vector<replay_script> scripts;
+    // Время первого и последнего события записи
+    std::chrono::nanoseconds begin {0};
+    std::chrono::nanoseconds end {0};
+};
+
+// Рассылка, а не ответ на запрос: ответы - текст, а рыночные данные и отчеты
+// об исполнении - строка JSON с полем "Type"
+bool IsPushed(const char* data, size_t size)
+{
+    if (size == 0 || data[0] != '{')
+    {
+        return false;
+    }
+    const nlohmann::json message = nlohmann::json::parse(data, data + size, nullptr, false);
+    if (!message.is_object())
+    {
+        return false;
+    }
+    const auto type = message.find("Type");
+    return type != message.end() && type->is_string() &&
+        (*type == "Update" || *type == "Snapshot" || *type == "Execution");
+}
+
+// Шаги из записи, разложенные по подключениям. Сессия, начало которой не попало
+// в запись, подключается перед первым запросом.
+replay_capture LoadCapture(const std::string& path)
+{
+    replay_capture capture;
+    // Подключение каждой открытой сессии и номер ее последнего запроса (-1 - не было)
+    struct open_session
+    {
+        size_t script;
+        int64_t last_request;
+    };
+    std::unordered_map<uint32_t, open_session> sessions;
+    bool first = true;
+
+    Capture::Read(path, [&](const CaptureRecord& record)
+    {
+        const std::chrono::nanoseconds at(record.timeNs);
+        if (first)
+        {
+            capture.begin = at;
+            first = false;
+        }
+        capture.end = at;
+
+        auto session = sessions.find(record.session);
+        switch (record.type)
+        {
+            case CaptureRecord::Type::Connect:
+            case CaptureRecord::Type::Request:
+                if (record.type == CaptureRecord::Type::Connect || session == sessions.end())
+                {
+                    // Номер сессии мог достаться новому подключению
+                    capture.scripts.push_back(
+                        {replay_step{CaptureRecord::Type::Connect, at, {}}});
+                    session = sessions.insert_or_assign(record.session,
+                        open_session{capture.scripts.size() - 1, -1}).first;
+                }
+                if (record.type == CaptureRecord::Type::Request)
+                {
+                    replay_script& steps = capture.scripts[session->second.script];
+                    steps.push_back(replay_step{record.type, at, record.data});
+                    session->second.last_request = steps.size() - 1;
+                }
+                break;
+            case CaptureRecord::Type::Reply:
+                if (session != sessions.end() && session->second.last_request >= 0 &&
+                    !IsPushed(record.data.data(), record.data.size()))
+                {
+                    capture.scripts[session->second.script][session->second.last_request]
+                        .expects_reply = true;
+                }
+                break;
+            case CaptureRecord::Type::Disconnect:
+                if (session != sessions.end())
+                {
+                    capture.scripts[session->second.script].push_back(
+                        replay_step{record.type, at, {}});
+                    sessions.erase(session);
+                }
+                break;
+        }
+    });
+
+    return capture;
+}
+
+struct replay_stats
+{
+    uint64_t requests = 0;
+    uint64_t replies = 0;
+    // Рыночные данные и отчеты об исполнении
+    uint64_t pushed = 0;
+    uint64_t failed_sessions = 0;
+    // Время от отправки запроса до первых байт ответа
+    std::vector<uint64_t> latencies_ns;
+    // Насколько шаги опаздывали относительно расписания
+    clock_type::duration max_lag = clock_type::duration::zero();
+};
+
+// Расписание: момент шага по его времени в записи
+struct replay_schedule
+{
+    clock_type::time_point start;
+    std::chrono::nanoseconds begin;
+    // Во сколько раз быстрее записи; 0 - без пауз
+    double speed;
+
+    clock_type::time_point due(std::chrono::nanoseconds at) const
+    {
+        if (speed == 0)
+        {
+            return start;
+        }
+        // Отсчет от первого события записи, а не от запуска записавшего сервера
+        return start + std::chrono::duration_cast<clock_type::duration>((at - begin) / speed);
+    }
+};
+
+// Подключение одной воспроизводимой сессии. Шаг ждет своего времени по расписанию,
+// а запрос - еще и ответа на предыдущий запрос сессии (если он был в записи):
+// сервер разбирает запрос за одно чтение и не должен получить два запроса слитно.
+// Сессии не ждут друг друга.
+class replay_connection : public std::enable_shared_from_this<replay_connection>
+{
+public:
+    replay_connection(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+        replay_script script, const replay_schedule& schedule, replay_stats& stats)
+        : socket_(io_service), timer_(io_service), endpoint_(endpoint),
+        script_(std::move(script)), schedule_(schedule), stats_(stats)
+    {
+    }
+
+    void start()
+    {
+        next();
+    }
+
+private:
+    void next()
+    {
+        if (busy_ || awaiting_reply_ || failed_ || closed_)
+        {
+            return;
+        }
+        // Сессия, открытая до конца записи, закрывается после ответов
+        if (index_ == script_.size())
+        {
+            disconnect();
+            return;
+        }
+
+        const replay_step& step = script_[index_];
+        const clock_type::time_point due = schedule_.due(step.at);
+        const clock_type::time_point now = clock_type::now();
+        if (now < due)
+        {
+            timer_.expires_at(due);
+            timer_.async_wait(boost::bind(&replay_connection::handle_timeout,
+                shared_from_this(), boost::asio::placeholders::error));
+            return;
+        }
+        if (schedule_.speed > 0)
+        {
+            stats_.max_lag = std::max(stats_.max_lag, now - due);
+        }
+
+        ++index_;
+        switch (step.type)
+        {
+            case CaptureRecord::Type::Connect:
+                connect();
+                break;
+            case CaptureRecord::Type::Request:
+                send(step.data, step.expects_reply);
+                break;
+            default:
+                disconnect();
+                break;
+        }
+    }
+
+    void connect()
+    {
+        busy_ = true;
+        socket_.async_connect(endpoint_,
+            boost::bind(&replay_connection::handle_connect, shared_from_this(),
+                boost::asio::placeholders::error));
+    }
+
+    void send(const std::string& request, bool expects_reply)
+    {
+        busy_ = true;
+        awaiting_reply_ = expects_reply;
+        in_reply_ = false;
+        request_ = request;
+        sent_at_ = clock_type::now();
+        ++stats_.requests;
+        boost::asio::async_write(socket_, boost::asio::buffer(request_),
+            boost::bind(&replay_connection::handle_write, shared_from_this(),
+                boost::asio::placeholders::error));
+    }
+
+    void disconnect()
+    {
+        closed_ = true;
+        boost::system::error_code ignored;
+        timer_.cancel(ignored);
+        socket_.close(ignored);
+    }
+
+    void handle_timeout(const boost::system::error_code& error)
+    {
+        if (!error)
+        {
+            next();
+        }
+    }
+
+    void handle_connect(const boost::system::error_code& error)
+    {
+        busy_ = false;
+        if (error)
+        {
+            fail();
+            return;
+        }
+        read();
+        next();
+    }
+
+    void handle_write(const boost::system::error_code& error)
+    {
+        busy_ = false;
+        if (error)
+        {
+            fail();
+            return;
+        }
+        next();
+    }
+
+    void handle_read(const boost::system::error_code& error, size_t bytes_transferred)
+    {
+        if (error)
+        {
+            if (!closed_)
+            {
+                fail();
+            }
+            return;
+        }
+
+        consume(data_, bytes_transferred);
+        read();
+    }
+
+    // Разбирает прочитанное. Рассылка - строка JSON, ее приходится дочитать целиком;
+    // все остальное - текст ответа, и ответ виден по первому его байту. Ответ
+    // бывает многострочным и не всегда кончается переводом строки, зато не содержит
+    // '{', поэтому его текст кончается началом рассылки или отправкой следующего
+    // запроса (если тот ушел сразу, то вместе с прочитанным).
+    void consume(const char* data, size_t size)
+    {
+        const char* end = data + size;
+        while (data < end)
+        {
+            if (in_reply_)
+            {
+                data = std::find(data, end, '{');
+                if (data == end)
+                {
+                    break;
+                }
+                in_reply_ = false;
+            }
+            if (line_.empty() && *data != '{')
+            {
+                on_reply();
+                in_reply_ = true;
+                continue;
+            }
+
+            const char* newline = std::find(data, end, '\n');
+            line_.append(data, newline);
+            if (newline == end)
+            {
+                break;
+            }
+            if (IsPushed(line_.data(), line_.size()))
+            {
+                ++stats_.pushed;
+            }
+            else
+            {
+                on_reply();
+            }
+            line_.clear();
+            data = newline + 1;
+        }
+        if (awaiting_reply_)
+        {
+            in_reply_ = false;
+        }
+    }
+
+    // Пришел ответ на запрос; текст ответа после первого байта ничего не меняет
+    void on_reply()
+    {
+        if (!awaiting_reply_)
+        {
+            return;
+        }
+        awaiting_reply_ = false;
+        ++stats_.replies;
+        stats_.latencies_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now() - sent_at_).count());
+        next();
+    }
+
+    void read()
+    {
+        socket_.async_read_some(boost::asio::buffer(data_, max_length),
+            boost::bind(&replay_connection::handle_read, shared_from_this(),
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+    }
+
+    // Сервер закрыл подключение или не принял его: оставшиеся шаги сессии пропускаются
+    void fail()
+    {
+        if (failed_ || closed_)
+        {
+            return;
+        }
+        failed_ = true;
+        busy_ = false;
+        awaiting_reply_ = false;
+        ++stats_.failed_sessions;
+        disconnect();
+    }
+
+private:
+    tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    tcp::endpoint endpoint_;
+    replay_script script_;
+    size_t index_ = 0;
+    const replay_schedule& schedule_;
+    replay_stats& stats_;
+
+    enum { max_length = 65536 };
+    char data_[max_length];
+    std::string request_;
+    clock_type::time_point sent_at_;
+    // Начало строки JSON, которая еще не дочитана
+    std::string line_;
+    // Дочитывается текст ответа
+    bool in_reply_ = false;
+
+    bool busy_ = false;
+    bool awaiting_reply_ = false;
+    bool failed_ = false;
+    bool closed_ = false;
+};
+
+typedef std::shared_ptr<replay_connection> replay_connection_ptr;
+
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        const CaptureReplayOptions options = ParseOptions(argc, argv);
+        replay_capture capture = LoadCapture(options.inputPath);
+        const std::chrono::nanoseconds recorded = capture.end - capture.begin;
+
+        boost::asio::io_service io_service;
+        tcp::resolver resolver(io_service);
+        tcp::resolver::query query(tcp::v4(), options.host, std::to_string(options.port));
+        const tcp::endpoint endpoint = *resolver.resolve(query);
+
+        replay_stats stats;
+        const auto start = clock_type::now();
+        const replay_schedule schedule {start, capture.begin, options.speed};
+        for (replay_script& script : capture.scripts)
+        {
+            std::make_shared<replay_connection>(io_service, endpoint, std::move(script),
+                schedule, stats)->start();
+        }
+        io_service.run();
+        const double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+
+        std::cerr << "Requests: " << stats.requests << ", replies " << stats.replies
+                  << ", pushed messages " << stats.pushed
+                  << ", failed sessions " << stats.failed_sessions << '\n'
+                  << "Recorded: " << std::chrono::duration<double>(recorded).count()
+                  << " s, replayed: " << elapsed << " s, "
+                  << (elapsed > 0 ? stats.requests / elapsed : 0) << " requests/s\n";
+        if (options.speed > 0)
+        {
+            std::cerr << "Max lag behind schedule: "
+                      << std::chrono::duration<double, std::milli>(stats.max_lag).count()
+                      << " ms\n";
+        }
+        if (!stats.latencies_ns.empty())
+        {
+            std::vector<uint64_t>& latencies = stats.latencies_ns;
+            std::sort(latencies.begin(), latencies.end());
+            std::cerr << "Reply latency, ns: p50 " << Percentile(latencies, 0.5)
+                      << ", p90 " << Percentile(latencies, 0.9)
+                      << ", p99 " << Percentile(latencies, 0.99)
+                      << ", max " << latencies.back() << '\n';
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef CLIENSERVERECN_CHUNKEDVECTOR_HPP
+#define CLIENSERVERECN_CHUNKEDVECTOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+// Массив, который растет кусками фиксированного размера и никогда не перемещает
+// элементы. Таблица кусков создается сразу на пределе и не перевыделяется, а куски
+// подключаются атомарно, поэтому несколько потоков могут одновременно наращивать
+// массив и заполнять каждый свои элементы, а читатели без блокировки обращаются
+// к элементам, которые им опубликовали (например, атомарным флагом).
+template <typename T>
+class ChunkedVector
+{
+public:
+  static constexpr size_t kMaxChunks = 4096;
+
+  // Бросает std::invalid_argument, если aChunkSize равен нулю
+  explicit ChunkedVector(size_t aChunkSize)
+    : mChunkSize{aChunkSize},
+      mChunks{new std::atomic<T*>[kMaxChunks]()}
+  {
+    if (aChunkSize == 0)
+    {
+      throw std::invalid_argument("ChunkedVector chunk size must be positive");
+    }
+  }
+
+  ~ChunkedVector()
+  {
+    for (size_t i = 0; mChunks && i < kMaxChunks; ++i)
+    {
+      delete[] mChunks[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  ChunkedVector(ChunkedVector&&) = default;
+  ChunkedVector& operator=(ChunkedVector&& aOther)
+  {
+    std::swap(mChunkSize, aOther.mChunkSize);
+    mChunks.swap(aOther.mChunks);
+    return *this;
+  }
+
+  // Выделяет место под элементы с номерами меньше aSize; новые элементы
+  // инициализируются значением по умолчанию. Можно вызывать из нескольких потоков.
+  // Бросает std::length_error сверх kMaxChunks кусков.
+  void Reserve(size_t aSize)
+  {
+    if (aSize == 0)
+    {
+      return;
+    }
+    if ((aSize - 1) / mChunkSize >= kMaxChunks)
+    {
+      throw std::length_error("ChunkedVector is full");
+    }
+
+    // Куски подключаются от старших к младшим, пока не встретится готовый
+    for (size_t chunk = (aSize - 1) / mChunkSize + 1;
+         chunk-- > 0 && !mChunks[chunk].load(std::memory_order_acquire);)
+    {
+      T* fresh = new T[mChunkSize]();
+      T* expected = nullptr;
+      if (!mChunks[chunk].compare_exchange_strong(expected, fresh, std::memory_order_acq_rel))
+      {
+        // Другой поток успел раньше
+        delete[] fresh;
+      }
+    }
+  }
+
+  // Элемент aIndex; nullptr, если под него еще нет места
+  const T* Find(size_t aIndex) const
+  {
+    if (aIndex / mChunkSize >= kMaxChunks)
+    {
+      return nullptr;
+    }
+    const T* chunk = mChunks[aIndex / mChunkSize].load(std::memory_order_acquire);
+    return chunk ? &chunk[aIndex % mChunkSize] : nullptr;
+  }
+
+  T& operator[](size_t aIndex)
+  {
+    return mChunks[aIndex / mChunkSize].load(std::memory_order_acquire)[aIndex % mChunkSize];
+  }
+  const T& operator[](size_t aIndex) const
+  {
+    return mChunks[aIndex / mChunkSize].load(std::memory_order_acquire)[aIndex % mChunkSize];
+  }
+
+private:
+  size_t mChunkSize;
+  std::unique_ptr<std::atomic<T*>[]> mChunks;
+};
+
+#endif //CLIENSERVERECN_CHUNKEDVECTOR_HPP
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <boost/asio.hpp>
 
@@ -45,15 +46,54 @@ std::string ProcessRegistration(tcp::socket& aSocket)
 }
 
 std::string GetOrderData() {
+  std::string type;
+  std::cout << "Type (" << OrderTypes::Limit << ", " << OrderTypes::Market << ", "
+            << OrderTypes::ImmediateOrCancel << ", " << OrderTypes::FillOrKill << "): ";
+  std::cin >> type;
+
   std::string amount;
   std::cout << "Amount: ";
   std::cin >> amount;
 
-  std::string price;
-  std::cout << "Price: ";
-  std::cin >> price;
+  // У рыночной заявки цены нет
+  std::string price = "0";
+  if (type != OrderTypes::Market)
+  {
+    std::cout << "Price: ";
+    std::cin >> price;
+  }
+
+  std::string stopPrice;
+  std::cout << "Stop price (0 - not a stop order): ";
+  std::cin >> stopPrice;
 
   nlohmann::json order;
+  if (stopPrice != "0")
+  {
+    order["StopPrice"] = stopPrice;
+  }
+  if (type == OrderTypes::Limit)
+  {
+    std::string display;
+    std::cout << "Display amount (0 - show the whole order): ";
+    std::cin >> display;
+    if (display != "0")
+    {
+      order["Display"] = display;
+    }
+
+    long lifetime;
+    std::cout << "Lifetime, seconds (0 - until cancelled): ";
+    std::cin >> lifetime;
+    if (lifetime > 0)
+    {
+      const auto expireAt = std::chrono::system_clock::now() + std::chrono::seconds(lifetime);
+      order["ExpireAt"] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+          expireAt.time_since_epoch()).count());
+    }
+  }
+
+  order["Type"] = type;
   order["Amount"] = amount;
   order["Price"] = price;
 
@@ -88,7 +128,9 @@ int main()
                          "4) Market Depth\n"
                          "5) Trades\n"
                          "6) Cancel Quote\n"
-                         "7) Exit\n"
+                         "7) Market Stats\n"
+                         "8) Market Data Feed\n"
+                         "9) Exit\n"
                          << std::endl;
 
             short menu_option_num;
@@ -117,7 +159,7 @@ int main()
                 }
                 case 4:
                 {
-                    SendMessage(s, my_id, Requests::ActiveQuotes, "");
+                    SendMessage(s, my_id, Requests::MarketDepth, "");
                     std::cout << ReadMessage(s);
                     break;
                 }
@@ -142,6 +184,24 @@ int main()
                   break;
                 }
                 case 7:
+                {
+                  std::string resolution;
+                  std::cout << "Candles (1s, 1m, 1h or - for none): ";
+                  std::cin >> resolution;
+                  SendMessage(s, my_id, Requests::MarketStats, resolution);
+                  std::cout << ReadMessage(s);
+                  break;
+                }
+                case 8:
+                {
+                  // Печатаем поток рыночных данных до завершения клиента
+                  SendMessage(s, my_id, Requests::Subscribe, "1");
+                  while (true)
+                  {
+                    std::cout << ReadMessage(s) << std::flush;
+                  }
+                }
+                case 9:
                 {
                     exit(0);
                 }
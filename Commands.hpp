@@ -0,0 +1,167 @@
+#ifndef CLIENSERVERECN_COMMANDS_HPP
+#define CLIENSERVERECN_COMMANDS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Asset.hpp"
+#include "MarketStats.hpp"
+#include "OrderBook.hpp"
+
+// Типизированные команды и запросы ядра: числовые поля вместо строк и код итога
+// вместо текста ответа. Текст клиентского протокола собирает Protocol.cpp, а
+// встраивающий ядро код (стратегии, симуляторы, риск) обходится без него.
+// Исполнения и изменения стакана приходят получателям событий ядра (CoreListener).
+
+// Итог команды
+enum class Status : uint8_t
+{
+  Ok,
+  UnknownUser,
+  UnknownInstrument,
+  UnknownOrder,
+  UnknownAsset,
+  InvalidAmount,
+  InvalidPrice,
+  InvalidStopPrice,
+  InvalidDisplayAmount,
+  // Срок действия заявки истек раньше, чем она пришла
+  ExpiryPassed,
+  // Торговля пользователя остановлена (kill switch)
+  TradingDisabled,
+  InsufficientFunds,
+  // Рыночная покупка при проверке средств: ее стоимость заранее не оценить
+  MarketBuyNotAllowed,
+  // Номера пользователей исчерпаны
+  TooManyUsers
+};
+
+// Параметры заявки сверх объема, цены и стороны
+struct OrderOptions
+{
+  OrderType type = OrderType::Limit;
+  // Срок действия лимитной заявки (GTT/GTD), мс с начала эпохи; 0 - до отмены
+  uint64_t expireMs = 0;
+  // Стоп-цена: заявка ждет, пока цена сделки не дойдет до нее; 0 - не стоп-заявка
+  double stopPrice = 0;
+  // Видимая часть лимитной заявки-айсберга; 0 - заявка видна целиком
+  double displayAmount = 0;
+  // Номер инструмента (см. Core::AddInstrument)
+  size_t instrument = 0;
+};
+
+// Новая заявка. Цена рыночной заявки (OrderType::Market) не используется.
+struct NewOrderCommand
+{
+  uint64_t userId = 0;
+  double amount = 0;
+  double price = 0;
+  bool isBuy = false;
+  OrderOptions options;
+};
+
+// Изменение объема и цены заявки по ее номеру
+struct AmendCommand
+{
+  uint64_t userId = 0;
+  uint64_t orderId = 0;
+  double amount = 0;
+  double price = 0;
+};
+
+// Снятие заявки (в том числе стоп-заявки) по ее номеру
+struct CancelCommand
+{
+  uint64_t userId = 0;
+  uint64_t orderId = 0;
+};
+
+// Снятие заявки по ее номеру в списке активных заявок пользователя (с 1)
+struct CancelQuoteCommand
+{
+  uint64_t userId = 0;
+  int64_t quote = 0;
+};
+
+// Пакет котировок маркет-мейкера: снимает заявки пользователя на сторонах
+// replaceBuys/replaceSells и ставит лимитные заявки quotes по порядку
+struct MassQuoteCommand
+{
+  uint64_t userId = 0;
+  bool replaceBuys = true;
+  bool replaceSells = true;
+  std::vector<QuoteEntry> quotes;
+  size_t instrument = 0;
+};
+
+// Снятие всех заявок пользователя, подходящих под фильтр
+struct MassCancelCommand
+{
+  uint64_t userId = 0;
+  OrderFilter filter;
+};
+
+// Зачисление на счет пользователя
+struct DepositCommand
+{
+  uint64_t userId = 0;
+  AssetId asset = 0;
+  double amount = 0;
+};
+
+// Kill switch: остановка или возобновление торговли пользователя
+struct BlockCommand
+{
+  uint64_t userId = 0;
+  bool block = false;
+  // Заявки какого инструмента снимать; -1 - всех. Запрет новых заявок действует
+  // на все инструменты сразу.
+  int64_t instrument = -1;
+};
+
+struct OrderResult
+{
+  Status status = Status::Ok;
+  uint64_t orderId = 0;
+  // Сколько исполнено самой командой
+  double filled = 0;
+  // Остаток в стакане или в ожидании стоп-цены; неисполненный остаток рыночной,
+  // IOC и FOK заявки снимается и сюда не входит
+  double leaves = 0;
+};
+
+// Итог пакетной команды
+struct BatchResult
+{
+  Status status = Status::Ok;
+  // Сколько заявок поставлено (MassQuote) или снято (MassCancel)
+  size_t count = 0;
+};
+
+struct AssetBalance
+{
+  AssetId asset;
+  double amount;
+};
+
+// Активная заявка в том виде, в каком ее видят запросы
+struct ActiveOrder
+{
+  Order order;
+  // Стоп-цена; 0 - заявка в стакане
+  double stopPrice;
+  size_t instrument;
+};
+
+// Рыночная статистика инструмента
+struct MarketSummary
+{
+  double last = 0;
+  double volume24h = 0;
+  double vwap24h = 0;
+  // Последние свечи, если они запрошены
+  std::vector<Candle> candles;
+};
+
+#endif //CLIENSERVERECN_COMMANDS_HPP
@@ -3,7 +3,7 @@
 
 #include <string>
 
-static short port = 5555;
+static const short port = 5555;
 
 namespace Requests
 {
@@ -13,8 +13,31 @@ namespace Requests
     static std::string SellOrder    = "Sel";
     static std::string ActiveQuotes = "Quo";
     static std::string Trades       = "Tra";
+    static std::string MarketStats  = "Sta";
+    static std::string MarketDepth  = "Dep";
+    static std::string Subscribe    = "Sub";
+    static std::string Executions   = "Exe";
 
     static std::string Cancel       = "Can";
+    static std::string Amend        = "Amd";
+    static std::string MassQuote    = "MQt";
+    static std::string MassCancel   = "MCn";
+    static std::string CancelOnDisconnect = "CoD";
+
+    // Служебные
+    static std::string TraceDump    = "Trc";
+    static std::string KillSwitch   = "Kil";
+    static std::string Deposit      = "Fnd";
+}
+
+// Типы заявок в поле "Type" заявки; без поля заявка лимитная.
+// Сервер с --risk-checks не принимает рыночные покупки: их стоимость не зарезервировать.
+namespace OrderTypes
+{
+    static std::string Limit             = "LMT";
+    static std::string Market            = "MKT";
+    static std::string ImmediateOrCancel = "IOC";
+    static std::string FillOrKill        = "FOK";
 }
 
 #endif //CLIENSERVERECN_COMMON_HPP
@@ -1,294 +1,2060 @@
 #include "Core.hpp"
+#include "Snapshot.hpp"
+#include "Trace.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace
 {
-  void removeTrailingZeros(std::string& str)
+  // Переводит деньги между покупателем и продавцом и возвращает сделку
+  Trade makeTrade(const Instrument& aInstrument,
+                 Wallets& aWallets,
+                 uint64_t aBuyerId,
+                 uint64_t aSellerId,
+                 double aAmount,
+                 double aPrice)
+  {
+    double tradeTotalPrice = aAmount * aPrice;
+    aWallets.UpdateBalances(aBuyerId, [&](Wallets::Cell* aBuyer)
+    {
+      Wallets::Add(aBuyer[aInstrument.quote], -tradeTotalPrice);
+      Wallets::Add(aBuyer[aInstrument.base], aAmount);
+    });
+    aWallets.UpdateBalances(aSellerId, [&](Wallets::Cell* aSeller)
+    {
+      Wallets::Add(aSeller[aInstrument.quote], tradeTotalPrice);
+      Wallets::Add(aSeller[aInstrument.base], -aAmount);
+    });
+
+    return Trade::Make(aBuyerId, aSellerId, aAmount, aPrice, aInstrument.index);
+  }
+
+  // Сколько блокирует aAmount заявки: котируемый актив по цене заявки под покупку,
+  // базовый под продажу. Цена рыночной покупки неизвестна, под нее резерва нет.
+  double reservation(bool isBuy, double aAmount, double aPrice)
   {
-    str.erase(str.find_last_not_of('0') + 1, std::string::npos);
-    str.erase(str.find_last_not_of('.') + 1, std::string::npos);
+    if (!isBuy)
+    {
+      return aAmount;
+    }
+    return aPrice == std::numeric_limits<double>::infinity() ? 0 : aAmount * aPrice;
+  }
+
+  // Актив, который резервирует заявка
+  AssetId reservedAsset(const Instrument& aInstrument, bool isBuy)
+  {
+    return isBuy ? aInstrument.quote : aInstrument.base;
   }
 
-  bool doMatch(const Order& left, const Order& right)
+  // Увеличивает (aAmount > 0) или уменьшает резерв пользователя под aAmount заявки
+  void reserve(Wallets& aWallets, uint64_t aUserId, const Instrument& aInstrument, bool isBuy,
+      double aAmount, double aPrice)
   {
-    return (left.isBuy && left.price >= right.price) ||
-          (!left.isBuy && left.price <= right.price);
+    Wallets::Add(aWallets.GetReserved(aUserId)[reservedAsset(aInstrument, isBuy)],
+        reservation(isBuy, aAmount, aPrice));
   }
 
-  double getTradePrice(const Order& left, const Order& right)
+  // Хватит ли свободного остатка на aAmount заявки, если освободить резерв aFreed
+  bool canAfford(const Wallets& aWallets, uint64_t aUserId, const Instrument& aInstrument,
+      bool isBuy, double aAmount, double aPrice, double aFreed)
   {
-    double price;
-    if (left.timepoint == right.timepoint)
+    // Стоимость рыночной покупки заранее не оценить
+    if (isBuy && aPrice == std::numeric_limits<double>::infinity())
     {
-      price = std::max(left.price, right.price);
+      return false;
     }
-    else if (left.timepoint < right.timepoint)
+    const AssetId asset = reservedAsset(aInstrument, isBuy);
+    const double available =
+        aWallets.GetBalance(aUserId, asset) - aWallets.GetReserve(aUserId, asset);
+    return reservation(isBuy, aAmount, aPrice) <= available + aFreed;
+  }
+
+  // Текущее состояние заявки aOrderId инструмента; пусто, если ее больше нет
+  std::optional<ActiveOrder> findActiveOrder(const Instrument& aInstrument, uint64_t aOrderId)
+  {
+    if (const Order* order = aInstrument.book.Find(aOrderId))
     {
-      price = left.price;
+      return ActiveOrder{*order, 0, aInstrument.index};
     }
-    else
+    if (const StopOrder* stop = aInstrument.stops.Find(aOrderId))
     {
-      price = right.price;
+      return ActiveOrder{stop->order, stop->stopPrice, aInstrument.index};
     }
-
-    return price;
+    return std::nullopt;
   }
 
-  Trade makeTrade(std::map<size_t, UserData>::iterator aUser1,
-                 std::map<size_t, UserData>::iterator aUser2,
-                 Order& aOrder1,
-                 Order& aOrder2)
+  // Ставит в опубликованные блоки aBlocks заявку aOrderId в состоянии aOrder или
+  // снимает ее, если aOrder пуст. Копируется только блок этой заявки; переполненный
+  // блок делится пополам, а маленький сливается со следующим.
+  void publishOrder(PublishedOrders& aBlocks, uint64_t aOrderId,
+      const std::optional<ActiveOrder>& aOrder)
   {
-    double tradeAmount = std::min(aOrder1.amount, aOrder2.amount);
-    double tradePrice = getTradePrice(aOrder1, aOrder2);
-    double tradeTotalPrice = tradeAmount * tradePrice;
-
-    std::string buyerId, sellerId;
-
-    aOrder1.amount -= tradeAmount;
-    aOrder2.amount -= tradeAmount;
-    if (aOrder1.isBuy)
+    // Блок, с которого начинаются номера не больше aOrderId (или первый)
+    auto it = std::upper_bound(aBlocks.begin(), aBlocks.end(), aOrderId,
+        [](uint64_t aId, const std::shared_ptr<const ActiveOrders>& aBlock)
+        {
+          return aId < aBlock->front().order.id;
+        });
+    if (it != aBlocks.begin())
     {
-      buyerId = std::to_string(aUser1->first);
-      sellerId = std::to_string(aUser2->first);
+      --it;
+    }
+    if (it == aBlocks.end())
+    {
+      if (aOrder)
+      {
+        aBlocks.push_back(std::make_shared<const ActiveOrders>(1, *aOrder));
+      }
+      return;
+    }
 
-      aUser1->second.rub -= tradeTotalPrice;
-      aUser1->second.usd += tradeAmount;
+    const ActiveOrders& current = **it;
+    const auto pos = std::lower_bound(current.begin(), current.end(), aOrderId,
+        [](const ActiveOrder& aActive, uint64_t aId)
+        {
+          return aActive.order.id < aId;
+        });
+    const bool found = pos != current.end() && pos->order.id == aOrderId;
+    if (!found && !aOrder)
+    {
+      return;
+    }
 
-      aUser2->second.rub += tradeTotalPrice;
-      aUser2->second.usd -= tradeAmount;
+    auto block = std::make_shared<ActiveOrders>(current);
+    const auto at = block->begin() + (pos - current.begin());
+    if (!aOrder)
+    {
+      block->erase(at);
+    }
+    else if (found)
+    {
+      *at = *aOrder;
     }
     else
     {
-      buyerId = std::to_string(aUser2->first);
-      sellerId = std::to_string(aUser1->first);
-
-      aUser1->second.rub += tradeTotalPrice;
-      aUser1->second.usd -= tradeAmount;
-
-      aUser2->second.rub -= tradeTotalPrice;
-      aUser2->second.usd += tradeAmount;
+      block->insert(at, *aOrder);
     }
 
-    return Trade(buyerId, sellerId, tradeAmount, tradePrice);
+    if (block->empty())
+    {
+      aBlocks.erase(it);
+      return;
+    }
+    if (block->size() > 2 * Core::kOrderBlock)
+    {
+      const auto middle = block->begin() + block->size() / 2;
+      auto tail = std::make_shared<const ActiveOrders>(middle, block->end());
+      block->erase(middle, block->end());
+      *it = std::move(block);
+      aBlocks.insert(it + 1, std::move(tail));
+      return;
+    }
+    const auto next = it + 1;
+    if (block->size() < Core::kOrderBlock / 2 && next != aBlocks.end() &&
+        block->size() + (*next)->size() <= 2 * Core::kOrderBlock)
+    {
+      block->insert(block->end(), (*next)->begin(), (*next)->end());
+      aBlocks.erase(next);
+    }
+    *it = std::move(block);
   }
 } // namespace
 
-std::string Core::RegisterNewUser(const std::string& aUserName)
+Instrument::Instrument(size_t aIndex, AssetId aBase, AssetId aQuote, std::string aSymbol,
+    uint64_t aNowMs)
+  : index{aIndex},
+    base{aBase},
+    quote{aQuote},
+    symbol{std::move(aSymbol)},
+    expiries{aNowMs}
+{
+}
+
+Core::Core()
+{
+  // USD получает номер 0, RUB - 1, как в журналах до появления реестра активов
+  AddInstrument("USD", "RUB");
+}
+
+size_t Core::AddInstrument(const std::string& aBase, const std::string& aQuote)
 {
-  size_t newUserId = mUsers.size();
-  mUsers[newUserId].name = aUserName;
-  mUsers[newUserId].usd = 0;
-  mUsers[newUserId].rub = 0;
+  if (!IsAssetName(aBase) || !IsAssetName(aQuote) || aBase == aQuote)
+  {
+    throw std::invalid_argument("Incorrect instrument " + aBase + "/" + aQuote);
+  }
+
+  const bool newBase = FindAsset(aBase) < 0;
+  const bool newQuote = FindAsset(aQuote) < 0;
+  const AssetId base = AddAsset(aBase);
+  const AssetId quote = AddAsset(aQuote);
+  // Котируемый актив выводится в балансе раньше базового
+  if (newQuote)
+  {
+    mAssetOrder.insert(std::find(mAssetOrder.begin(), mAssetOrder.end(), base), quote);
+  }
+  if (newBase)
+  {
+    mAssetOrder.push_back(base);
+  }
+
+  const size_t index = mInstruments.size();
+  mInstruments.push_back(std::make_unique<Instrument>(index, base, quote,
+      aBase + "/" + aQuote, NowMs()));
+  for (size_t id = 0, count = mNextUserId; id < count; ++id)
+  {
+    if (IsUser(id))
+    {
+      mUsers[id].orders.resize(mInstruments.size());
+    }
+  }
+  return index;
+}
 
-  return std::to_string(newUserId);
+int64_t Core::FindAsset(const std::string& aName) const
+{
+  const auto it = std::find(mAssetNames.begin(), mAssetNames.end(), aName);
+  return it == mAssetNames.end() ? -1 : it - mAssetNames.begin();
 }
 
-std::string Core::GetUserName(const std::string& aUserId) const
+AssetId Core::AddAsset(const std::string& aName)
 {
-  const auto userIt = mUsers.find(std::stoi(aUserId));
-  if (userIt == mUsers.cend())
+  const int64_t existing = FindAsset(aName);
+  if (existing >= 0)
+  {
+    return existing;
+  }
+  if (mAssetNames.size() == kMaxAssets)
   {
-      return "Error! Unknown User\n";
+    throw std::invalid_argument("Too many assets");
   }
-  else
+
+  std::lock_guard<std::mutex> usersLock(mUsersMutex);
+  mAssetNames.push_back(aName);
+  mWallets.AddAsset();
+  return mAssetNames.size() - 1;
+}
+
+int64_t Core::GetInstrumentIndex(const std::string& aSymbol) const
+{
+  for (const auto& instrument : mInstruments)
   {
-      return userIt->second.name;
+    if (instrument->symbol == aSymbol)
+    {
+      return instrument->index;
+    }
   }
+  return -1;
+}
+
+const std::string& Core::GetInstrumentSymbol(size_t aInstrument) const
+{
+  return mInstruments[aInstrument]->symbol;
+}
+
+AssetId Core::GetInstrumentBase(size_t aInstrument) const
+{
+  return mInstruments[aInstrument]->base;
 }
 
-std::string Core::GetUserBalance(const std::string& aUserId) const
+AssetId Core::GetInstrumentQuote(size_t aInstrument) const
 {
-  const auto userIt = mUsers.find(std::stoi(aUserId));
-  if (userIt == mUsers.cend())
+  return mInstruments[aInstrument]->quote;
+}
+
+Status Core::RegisterUser(const std::string& aUserName, uint64_t& aUserId)
+{
+  // Регистрации из разных потоков не мешают друг другу и сопоставлению: каждая
+  // получает свой номер и заполняет свою запись. Номер берется, только если под
+  // него есть место, иначе следующие номера разошлись бы с журналом.
+  size_t newUserId = mNextUserId.load(std::memory_order_relaxed);
+  do
+  {
+    if (newUserId >= kMaxUsers)
+    {
+      return Status::TooManyUsers;
+    }
+  }
+  while (!mNextUserId.compare_exchange_weak(newUserId, newUserId + 1,
+      std::memory_order_relaxed));
+  FillUser(newUserId, aUserName);
+
+  JournalCommand command;
+  command.type = JournalCommand::Type::Register;
+  command.userId = newUserId;
+  command.name = aUserName;
+  uint64_t seq;
   {
-    return "Error! Unknown User\n";
+    // Номер команды берется раньше, чем пользователь станет виден, поэтому его
+    // заявки попадут в журнал после регистрации. Снимок берется под той же
+    // блокировкой и видит пользователя либо вместе с записью в журнале, либо без нее.
+    std::lock_guard<std::mutex> usersLock(mUsersMutex);
+    seq = Journalize(command);
+    mUsers[newUserId].registered.store(true, std::memory_order_release);
   }
+  WaitDurable(seq);
 
-  std::string rubles {std::to_string(userIt->second.rub)};
-  std::string dollas {std::to_string(userIt->second.usd)};
+  aUserId = newUserId;
+  return Status::Ok;
+}
+
+void Core::AddUser(size_t aUserId, const std::string& aName)
+{
+  FillUser(aUserId, aName);
+  // Запись заполнена до того, как пользователь станет виден
+  mUsers[aUserId].registered.store(true, std::memory_order_release);
+}
 
-  removeTrailingZeros(rubles);
-  removeTrailingZeros(dollas);
+void Core::FillUser(size_t aUserId, const std::string& aName)
+{
+  mUsers.Reserve(aUserId + 1);
+  UserData& user = mUsers[aUserId];
+  user.name = aName;
+  user.blocked = false;
+  user.orders.assign(mInstruments.size(), nullptr);
+  mWallets.AddUser(aUserId);
+
+  // При восстановлении номера задает журнал или снимок
+  size_t next = mNextUserId.load(std::memory_order_relaxed);
+  while (next <= aUserId &&
+         !mNextUserId.compare_exchange_weak(next, aUserId + 1, std::memory_order_relaxed))
+  {
+  }
+}
 
-  return "RUB " + rubles + "\n" +
-         "USD " + dollas + "\n";
+bool Core::IsUser(uint64_t aUserId) const
+{
+  const UserData* user = mUsers.Find(aUserId);
+  return user && user->registered.load(std::memory_order_acquire);
 }
 
-std::string Core::PlaceNewOrder(const std::string& aUserId,
-    const std::string& aAmount,
-    const std::string& aPrice,
-    bool isBuy)
+Status Core::GetUserName(uint64_t aUserId, std::string& aName) const
 {
-  if (mUsers.find(std::stoi(aUserId)) == mUsers.cend())
+  if (!IsUser(aUserId))
   {
-    return "Error! Unknown User\n";
+    return Status::UnknownUser;
   }
-  if (std::stod(aAmount) <= 0)
+  aName = mUsers[aUserId].name;
+  return Status::Ok;
+}
+
+Status Core::GetBalances(uint64_t aUserId, std::vector<AssetBalance>& aBalances) const
+{
+  if (!IsUser(aUserId))
   {
-    return "Error. Incorrect USD amount.\n";
+    return Status::UnknownUser;
   }
-  if (std::stod(aPrice) < 0)
+
+  std::vector<double> balances(mWallets.GetAssetCount());
+  mWallets.ReadBalances(aUserId, balances.data());
+  aBalances.clear();
+  for (AssetId asset : mAssetOrder)
   {
-    return "Error. Incorrect USD price.\n";
+    aBalances.push_back(AssetBalance{asset, balances[asset]});
   }
+  return Status::Ok;
+}
+
+OrderResult Core::Execute(const NewOrderCommand& aCommand)
+{
+  TRACE_SCOPE(PlaceNewOrder);
 
-  std::lock_guard<std::mutex> lock(mMutex);
-  Order newOrder(aUserId, std::stod(aAmount), std::stod(aPrice), isBuy);
+  const OrderOptions& options = aCommand.options;
+  if (!IsUser(aCommand.userId))
+  {
+    return OrderResult{Status::UnknownUser};
+  }
+  if (options.instrument >= mInstruments.size())
+  {
+    return OrderResult{Status::UnknownInstrument};
+  }
+  if (aCommand.amount <= 0)
+  {
+    return OrderResult{Status::InvalidAmount};
+  }
+  if (aCommand.price < 0 && options.type != OrderType::Market)
+  {
+    return OrderResult{Status::InvalidPrice};
+  }
+  if (options.stopPrice < 0)
+  {
+    return OrderResult{Status::InvalidStopPrice};
+  }
+  if (options.displayAmount < 0)
+  {
+    return OrderResult{Status::InvalidDisplayAmount};
+  }
+  if (options.expireMs != 0 && options.expireMs <= NowMs())
+  {
+    return OrderResult{Status::ExpiryPassed};
+  }
+  // Резервировать под рыночную покупку нечего, поэтому при проверке средств она не
+  // принимается; цену покупки ограничивают заявкой IOC
+  if (mRiskChecks && options.type == OrderType::Market && aCommand.isBuy)
+  {
+    return OrderResult{Status::MarketBuyNotAllowed};
+  }
 
-  if (isBuy)
+  uint64_t seq;
+  OrderResult result;
   {
-    MatchOrder(newOrder, mSellOrders);
-    if (newOrder.amount > 0)
+    Instrument& instrument = *mInstruments[options.instrument];
+    std::lock_guard<std::mutex> lock(instrument.mutex);
+    // blocked - std::atomic<bool>, который BlockUser меняет под блокировкой одного
+    // инструмента. Остановка этого инструмента не разойдется с проверкой, так как
+    // идет под той же блокировкой; остальные инструменты увидят флаг со следующей
+    // своей команды (см. UserData::blocked).
+    if (mUsers[aCommand.userId].blocked)
+    {
+      return OrderResult{Status::TradingDisabled};
+    }
+    Order order(0, aCommand.userId, aCommand.amount, aCommand.price, aCommand.isBuy);
+    if (!AddOrder(instrument, order, options, mRiskChecks))
     {
-      mBuyOrders.push_back(newOrder);
-      std::push_heap(mBuyOrders.begin(), mBuyOrders.end());
+      return OrderResult{Status::InsufficientFunds};
     }
+    // Стоп-заявка еще не исполнялась; остаток прочих типов, кроме лимитной, снят
+    const double left = order.amount + order.hidden;
+    result.orderId = order.id;
+    result.filled = aCommand.amount - left;
+    result.leaves = (options.type == OrderType::Limit || options.stopPrice > 0) ? left : 0;
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::PlaceOrder;
+    command.userId = aCommand.userId;
+    command.amount = aCommand.amount;
+    command.price = aCommand.price;
+    command.isBuy = aCommand.isBuy;
+    command.orderType = options.type;
+    command.expireMs = options.expireMs;
+    command.stopPrice = options.stopPrice;
+    command.displayAmount = options.displayAmount;
+    command.instrument = options.instrument;
+    seq = Journalize(command);
+    Publish(instrument, seq);
+  }
+  WaitDurable(seq, mInstruments[options.instrument].get());
+
+  return result;
+}
+
+bool Core::AddOrder(Instrument& aInstrument, Order& aOrder, const OrderOptions& aOptions,
+    bool aCheckFunds)
+{
+  // Рыночная заявка проходит по любой встречной цене
+  if (aOptions.type == OrderType::Market)
+  {
+    aOrder.price = aOrder.isBuy ? std::numeric_limits<double>::infinity() : 0;
+  }
+  if (!ReserveFunds(aInstrument, aOrder.userId, aOrder.isBuy, aOrder.amount, aOrder.price,
+      aCheckFunds))
+  {
+    return false;
   }
-  else
+
+  // Номер выдается только принятой заявке, иначе нумерация разойдется с повтором
+  aOrder.id = NextOrderId(aInstrument);
+  aOrder.expireMs = aOptions.expireMs;
+  aOrder.display = aOptions.displayAmount;
+  Report(ExecutionReport::Type::New, aOrder, 0, 0);
+
+  if (aOptions.stopPrice > 0)
   {
-    MatchOrder(newOrder, mBuyOrders);
-    if (newOrder.amount > 0)
+    aInstrument.stops.Add(StopOrder{aOrder, aOptions.type, aOptions.stopPrice});
+    if (aOrder.expireMs)
     {
-      mSellOrders.push_back(newOrder);
-      std::push_heap(mSellOrders.begin(), mSellOrders.end());
+      aInstrument.expiries.Schedule(aOrder.expireMs, aOrder.id);
     }
+    return true;
+  }
+
+  const uint64_t trades = aInstrument.tradeCount;
+  ExecuteOrder(aInstrument, aOrder, aOptions.type);
+  if (aInstrument.tradeCount != trades)
+  {
+    TriggerStops(aInstrument);
   }
 
-  return "Your order was succesfully placed.\n";
+  return true;
 }
 
-// это приватный метод
-void Core::MatchOrder(Order& order, std::vector<Order>& opp)
+uint64_t Core::NextOrderId(Instrument& aInstrument)
 {
-  std::vector<Order> tempOrders;
+  return static_cast<uint64_t>(aInstrument.index) << kInstrumentShift |
+         aInstrument.nextOrderId++;
+}
 
-  auto orderUser = mUsers.find(std::stoi(order.userId));
-  std::make_heap(opp.begin(), opp.end());
+void Core::ExecuteOrder(Instrument& aInstrument, Order& aOrder, OrderType aType)
+{
+  if (aType != OrderType::FillOrKill || aInstrument.book.CanFill(aOrder))
+  {
+    MatchOrder(aInstrument, aOrder);
+  }
 
-  while (order.amount > 0 && !opp.empty())
+  if (aOrder.amount > 0)
   {
-    Order& topOrder = opp.front();
+    if (aType == OrderType::Limit)
+    {
+      // Айсберг показывает только часть остатка
+      if (aOrder.display > 0 && aOrder.amount > aOrder.display)
+      {
+        aOrder.hidden = aOrder.amount - aOrder.display;
+        aOrder.amount = aOrder.display;
+      }
+      aInstrument.book.Add(aOrder);
+      if (aOrder.expireMs)
+      {
+        aInstrument.expiries.Schedule(aOrder.expireMs, aOrder.id);
+      }
+    }
+    else
+    {
+      RetireOrder(ExecutionReport::Type::Cancel, aOrder);
+    }
+  }
+}
 
-    if (topOrder.userId == order.userId)
+void Core::TriggerStops(Instrument& aInstrument)
+{
+  // Цена последней сделки берется из самой команды, а не из истории, поэтому
+  // при восстановлении из журнала срабатывают те же заявки
+  std::vector<StopOrder> triggered = aInstrument.stops.TakeTriggered(aInstrument.lastPrice);
+  while (!triggered.empty())
+  {
+    for (StopOrder& stop : triggered)
     {
-      tempOrders.push_back(topOrder);
-      std::pop_heap(opp.begin(), opp.end());
-      opp.pop_back();
-      continue;
+      // Заявка переходит из стоп-заявок в стакан
+      aInstrument.changedOrders.emplace_back(stop.order.userId, stop.order.id);
+      ExecuteOrder(aInstrument, stop.order, stop.type);
     }
 
-    if (!doMatch(order, topOrder)) break;
+    // Сработавшие заявки могли сдвинуть цену дальше
+    triggered = aInstrument.stops.TakeTriggered(aInstrument.lastPrice);
+  }
+}
+
+// это приватный метод
+void Core::MatchOrder(Instrument& aInstrument, Order& order)
+{
+  TRACE_SCOPE(MatchOrder);
+
+  aInstrument.book.Match(order, [&](const Order& aResting, double aAmount, double aPrice)
+  {
+    Trade trade;
+    {
+      // Балансы общие для всех инструментов. Сделка дописывается под той же
+      // блокировкой, поэтому история остается упорядоченной по времени.
+      std::lock_guard<std::mutex> usersLock(mUsersMutex);
+      trade = order.isBuy ?
+          makeTrade(aInstrument, mWallets, order.userId, aResting.userId, aAmount, aPrice) :
+          makeTrade(aInstrument, mWallets, aResting.userId, order.userId, aAmount, aPrice);
+      mTrades->Append(trade);
+      IndexTrade(mTrades->Size() - 1);
 
-    auto topOrderUser = mUsers.find(std::stoi(topOrder.userId));
-    mTrades.push_back(makeTrade(orderUser, topOrderUser, order, topOrder));
+      // Исполненная часть больше не резервируется
+      reserve(mWallets, aResting.userId, aInstrument, aResting.isBuy, -aAmount, aResting.price);
+      reserve(mWallets, order.userId, aInstrument, order.isBuy, -aAmount, order.price);
+    }
 
-    if (topOrder.amount == 0)
+    ++aInstrument.tradeCount;
+    aInstrument.lastPrice = trade.price;
+    aInstrument.stats.OnTrade(trade.price, trade.amount, trade.timeNs);
+    if (!mListeners.empty())
     {
-      std::pop_heap(opp.begin(), opp.end());
-      opp.pop_back();
+      aInstrument.pendingTrades.push_back(trade);
     }
+
+    Report(ExecutionReport::Type::Fill, aResting, aAmount, aPrice);
+    Report(ExecutionReport::Type::Fill, order, aAmount, aPrice);
+  });
+}
+
+OrderResult Core::Execute(const AmendCommand& aCommand)
+{
+  if (!IsUser(aCommand.userId))
+  {
+    return OrderResult{Status::UnknownUser};
+  }
+  if (aCommand.amount <= 0)
+  {
+    return OrderResult{Status::InvalidAmount};
+  }
+  if (aCommand.price < 0)
+  {
+    return OrderResult{Status::InvalidPrice};
+  }
+  Instrument* instrument = FindOrderInstrument(aCommand.orderId);
+  if (!instrument)
+  {
+    return OrderResult{Status::UnknownOrder};
   }
 
-  for (Order& ordr : tempOrders)
+  uint64_t seq;
+  OrderResult result;
   {
-    opp.push_back(ordr);
-    std::push_heap(opp.begin(), opp.end());
+    std::lock_guard<std::mutex> lock(instrument->mutex);
+    if (mUsers[aCommand.userId].blocked)
+    {
+      return OrderResult{Status::TradingDisabled};
+    }
+    const Order* order = instrument->book.Find(aCommand.orderId);
+    if (!order || order->userId != aCommand.userId)
+    {
+      return OrderResult{Status::UnknownOrder};
+    }
+    if (!ModifyOrder(aCommand.userId, aCommand.orderId, aCommand.amount, aCommand.price,
+        mRiskChecks))
+    {
+      return OrderResult{Status::InsufficientFunds};
+    }
+    // Заявка по новой цене могла сразу исполниться
+    order = instrument->book.Find(aCommand.orderId);
+    result.orderId = aCommand.orderId;
+    result.leaves = order ? order->amount + order->hidden : 0;
+    result.filled = aCommand.amount - result.leaves;
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::Amend;
+    command.userId = aCommand.userId;
+    command.orderId = aCommand.orderId;
+    command.amount = aCommand.amount;
+    command.price = aCommand.price;
+    seq = Journalize(command);
+    Publish(*instrument, seq);
   }
+  WaitDurable(seq, instrument);
+
+  return result;
 }
 
-std::string Core::GetUserActiveQuotes(const std::string& aUserId) const
+OrderResult Core::Execute(const CancelCommand& aCommand)
 {
-  const auto userIt = mUsers.find(std::stoi(aUserId));
-  if (userIt == mUsers.cend())
+  if (!IsUser(aCommand.userId))
   {
-    return "Error! Unknown User\n";
+    return OrderResult{Status::UnknownUser};
+  }
+  Instrument* instrument = FindOrderInstrument(aCommand.orderId);
+  if (!instrument)
+  {
+    return OrderResult{Status::UnknownOrder};
   }
 
-  std::stringstream ss;
-  int i = 0;
-  for (const auto& o : mBuyOrders)
+  uint64_t seq;
   {
-    if (aUserId.empty() || aUserId == o.userId)
+    std::lock_guard<std::mutex> lock(instrument->mutex);
+    const Order* order = instrument->book.Find(aCommand.orderId);
+    if (!order)
+    {
+      const StopOrder* stop = instrument->stops.Find(aCommand.orderId);
+      order = stop ? &stop->order : nullptr;
+    }
+    if (!order || order->userId != aCommand.userId)
     {
-      ss << ++i << ") " << o << '\n';
+      return OrderResult{Status::UnknownOrder};
     }
+    CancelOrder(aCommand.orderId);
+
+    // Повтор снимает заявку по номеру так же, как cancel-on-disconnect
+    JournalCommand command;
+    command.type = JournalCommand::Type::CancelOrders;
+    command.orderIds.push_back(aCommand.orderId);
+    seq = Journalize(command);
+    Publish(*instrument, seq);
+  }
+  WaitDurable(seq, instrument);
+
+  return OrderResult{Status::Ok, aCommand.orderId};
+}
+
+bool Core::ModifyOrder(uint64_t aUserId, uint64_t aOrderId, double aAmount, double aPrice,
+    bool aCheckFunds)
+{
+  Instrument* instrument = FindOrderInstrument(aOrderId);
+  const Order* order = instrument ? instrument->book.Find(aOrderId) : nullptr;
+  if (!order || order->userId != aUserId)
+  {
+    return false;
   }
 
-  for (const auto& o : mSellOrders)
+  // Уменьшение объема по той же цене - на месте
+  const double before = order->amount + order->hidden;
+  if (aPrice == order->price && instrument->book.Reduce(aOrderId, aAmount))
   {
-    if (aUserId.empty() || aUserId == o.userId)
-    {
-      ss << ++i << ") " << o << '\n';
-    }
+    ReleaseFunds(*order, before - aAmount);
+    Report(ExecutionReport::Type::Amend, *order, 0, 0);
+    return true;
+  }
+
+  // Резерв заявки освобождается при изменении, поэтому учитывается как свободный
+  if (!ReserveFunds(*instrument, aUserId, order->isBuy, aAmount, aPrice, aCheckFunds,
+      reservation(order->isBuy, before, order->price)))
+  {
+    return false;
   }
 
-  return i == 0 ? "You have no active quotes.\n" : ss.str();
+  // Иначе снимаем и ставим заново с тем же номером и сроком действия
+  Order replaced = *order;
+  instrument->book.Remove(aOrderId);
+  ReleaseFunds(replaced, before);
+  replaced.amount = aAmount;
+  replaced.hidden = 0;
+  replaced.price = aPrice;
+  Report(ExecutionReport::Type::Amend, replaced, 0, 0);
+
+  const uint64_t trades = instrument->tradeCount;
+  ExecuteOrder(*instrument, replaced, OrderType::Limit);
+  if (instrument->tradeCount != trades)
+  {
+    TriggerStops(*instrument);
+  }
+
+  return true;
 }
 
-std::string Core::GetUserTrades(const std::string& aUserId) const
+BatchResult Core::Execute(const MassQuoteCommand& aCommand, std::vector<uint64_t>* aOrderIds)
 {
-  const auto userIt = mUsers.find(std::stoi(aUserId));
-  if (userIt == mUsers.cend())
+  if (!IsUser(aCommand.userId))
+  {
+    return BatchResult{Status::UnknownUser};
+  }
+  if (aCommand.instrument >= mInstruments.size())
+  {
+    return BatchResult{Status::UnknownInstrument};
+  }
+  for (const QuoteEntry& quote : aCommand.quotes)
   {
-    return "Error! Unknown User\n";
+    if (quote.amount <= 0)
+    {
+      return BatchResult{Status::InvalidAmount};
+    }
+    if (quote.price < 0)
+    {
+      return BatchResult{Status::InvalidPrice};
+    }
   }
 
-  int trades {0};
-  std::stringstream ss;
-  for (const Trade& t : mTrades)
+  uint64_t seq;
+  size_t placed;
   {
-    if (t.buyerId == aUserId || t.sellerId == aUserId)
+    Instrument& instrument = *mInstruments[aCommand.instrument];
+    std::lock_guard<std::mutex> lock(instrument.mutex);
+    if (mUsers[aCommand.userId].blocked)
+    {
+      return BatchResult{Status::TradingDisabled};
+    }
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::MassQuote;
+    command.userId = aCommand.userId;
+    command.replaceBuys = aCommand.replaceBuys;
+    command.replaceSells = aCommand.replaceSells;
+    command.instrument = aCommand.instrument;
+    // В журнал попадают только принятые котировки, повтор их не проверяет
+    if (mRiskChecks)
+    {
+      ApplyMassQuote(instrument, command.userId, aCommand.replaceBuys, aCommand.replaceSells,
+          aCommand.quotes, aOrderIds, &command.quotes);
+    }
+    else
     {
-      ss << t << '\n';
-      ++trades;
+      ApplyMassQuote(instrument, command.userId, aCommand.replaceBuys, aCommand.replaceSells,
+          aCommand.quotes, aOrderIds);
+      command.quotes = aCommand.quotes;
     }
+    placed = command.quotes.size();
+    seq = Journalize(command);
+    Publish(instrument, seq);
   }
+  WaitDurable(seq, mInstruments[aCommand.instrument].get());
 
-  return 0 == trades ? "You have no completed trades.\n" : ss.str();
+  return BatchResult{Status::Ok, placed};
 }
 
-std::string Core::CancelUserQuote(const std::string& aUserId, const std::string& aQuote)
+void Core::ApplyMassQuote(Instrument& aInstrument, uint64_t aUserId,
+    bool aReplaceBuys, bool aReplaceSells,
+    const std::vector<QuoteEntry>& aQuotes, std::vector<uint64_t>* aOrderIds,
+    std::vector<QuoteEntry>* aAccepted)
 {
-  const auto userIt = mUsers.find(std::stoi(aUserId));
-  if (userIt == mUsers.cend())
+  OrderFilter replaced;
+  replaced.buys = aReplaceBuys;
+  replaced.sells = aReplaceSells;
+  replaced.stops = false;
+  replaced.instrument = aInstrument.index;
+  CancelUserOrders(aUserId, replaced);
+
+  const uint64_t trades = aInstrument.tradeCount;
+  for (const QuoteEntry& quote : aQuotes)
   {
-    return "Error! Unknown User\n";
+    if (!ReserveFunds(aInstrument, aUserId, quote.isBuy, quote.amount, quote.price,
+        aAccepted != nullptr))
+    {
+      continue;
+    }
+    if (aAccepted)
+    {
+      aAccepted->push_back(quote);
+    }
+
+    Order order(NextOrderId(aInstrument), aUserId, quote.amount, quote.price, quote.isBuy);
+    Report(ExecutionReport::Type::New, order, 0, 0);
+    if (aOrderIds)
+    {
+      aOrderIds->push_back(order.id);
+    }
+    ExecuteOrder(aInstrument, order, OrderType::Limit);
   }
-  
-  int quote = std::stoi(aQuote);
-  if (quote < 1)
+  // Стопы проверяются один раз по итогам всего пакета
+  if (aInstrument.tradeCount != trades)
   {
-    return "Incorrect Quote number.\n";
+    TriggerStops(aInstrument);
   }
+}
 
-  std::lock_guard<std::mutex> lock(mMutex);
+size_t Core::CancelUserOrders(uint64_t aUserId, const OrderFilter& aFilter)
+{
+  const auto matches = [&](const Order& aOrder)
+  {
+    return (aOrder.isBuy ? aFilter.buys : aFilter.sells) &&
+           aOrder.price >= aFilter.minPrice && aOrder.price <= aFilter.maxPrice;
+  };
 
-  for (auto it = mBuyOrders.begin(); it != mBuyOrders.end(); ++it)
+  size_t cancelled = 0;
+  for (const auto& instrument : mInstruments)
   {
-    if (it->userId == aUserId)
+    if (aFilter.instrument >= 0 && static_cast<size_t>(aFilter.instrument) != instrument->index)
+    {
+      continue;
+    }
+
+    for (const Order* order : instrument->book.GetUserOrders(aUserId))
+    {
+      if (matches(*order))
+      {
+        RetireOrder(ExecutionReport::Type::Cancel, *order);
+        instrument->book.Remove(order->id);
+        ++cancelled;
+      }
+    }
+
+    if (aFilter.stops)
     {
-      if(0 == --quote)
+      for (const StopOrder* stop : instrument->stops.GetUserOrders(aUserId))
       {
-        mBuyOrders.erase(it);
-        std::make_heap(mBuyOrders.begin(), mBuyOrders.end());
-        return "Success!\n";
+        if (matches(stop->order))
+        {
+          RetireOrder(ExecutionReport::Type::Cancel, stop->order);
+          instrument->stops.Remove(stop->order.id);
+          ++cancelled;
+        }
       }
     }
   }
 
-  for (auto it = mSellOrders.begin(); it != mSellOrders.end(); ++it)
+  return cancelled;
+}
+
+bool Core::CancelOrder(uint64_t aOrderId)
+{
+  Instrument* instrument = FindOrderInstrument(aOrderId);
+  if (!instrument)
+  {
+    return false;
+  }
+  if (const Order* order = instrument->book.Find(aOrderId))
+  {
+    RetireOrder(ExecutionReport::Type::Cancel, *order);
+    return instrument->book.Remove(aOrderId);
+  }
+  if (const StopOrder* stop = instrument->stops.Find(aOrderId))
+  {
+    RetireOrder(ExecutionReport::Type::Cancel, stop->order);
+    return instrument->stops.Remove(aOrderId);
+  }
+
+  return false;
+}
+
+size_t Core::CancelOrders(const std::vector<uint64_t>& aOrderIds)
+{
+  uint64_t seq;
+  JournalCommand command;
+  command.type = JournalCommand::Type::CancelOrders;
+  std::vector<Instrument*> instruments;
   {
-    if (it->userId == aUserId)
+    const auto locks = LockOrderInstruments(aOrderIds, instruments);
+    // В журнал попадают только действительно снятые заявки
+    for (uint64_t id : aOrderIds)
     {
-      if(--quote == 0)
+      if (CancelOrder(id))
       {
-        mSellOrders.erase(it);
-        std::make_heap(mSellOrders.begin(), mSellOrders.end());
-        return "Success!\n";
+        command.orderIds.push_back(id);
       }
     }
+    if (command.orderIds.empty())
+    {
+      return 0;
+    }
+    seq = Journalize(command);
+    for (Instrument* instrument : instruments)
+    {
+      Publish(*instrument, seq);
+    }
   }
+  WaitDurable(seq, instruments.size() == 1 ? instruments.front() : nullptr);
 
-  return "Could not find quote " + aQuote + '\n';
+  return command.orderIds.size();
 }
 
+void Core::KeepActiveOrders(std::vector<uint64_t>& aOrderIds)
+{
+  std::vector<Instrument*> instruments;
+  const auto locks = LockOrderInstruments(aOrderIds, instruments);
+  aOrderIds.erase(std::remove_if(aOrderIds.begin(), aOrderIds.end(), [&](uint64_t aId)
+  {
+    const Instrument* instrument = FindOrderInstrument(aId);
+    return !instrument || (!instrument->book.Find(aId) && !instrument->stops.Find(aId));
+  }), aOrderIds.end());
+}
+
+void Core::BlockUser(uint64_t aUserId, bool aBlock, int64_t aInstrument)
+{
+  if (!IsUser(aUserId))
+  {
+    return;
+  }
+  mUsers[aUserId].blocked = aBlock;
+  if (aBlock)
+  {
+    OrderFilter filter;
+    filter.instrument = aInstrument;
+    CancelUserOrders(aUserId, filter);
+  }
+}
+
+BatchResult Core::Execute(const MassCancelCommand& aCommand)
+{
+  const OrderFilter& filter = aCommand.filter;
+  if (!IsUser(aCommand.userId))
+  {
+    return BatchResult{Status::UnknownUser};
+  }
+  if (filter.instrument >= static_cast<int64_t>(mInstruments.size()))
+  {
+    return BatchResult{Status::UnknownInstrument};
+  }
+
+  uint64_t seq;
+  size_t cancelled;
+  {
+    // Снятие по одному инструменту не останавливает остальные
+    std::vector<std::unique_lock<std::mutex>> locks;
+    if (filter.instrument >= 0)
+    {
+      locks.emplace_back(mInstruments[filter.instrument]->mutex);
+    }
+    else
+    {
+      locks = LockInstruments();
+    }
+    cancelled = CancelUserOrders(aCommand.userId, filter);
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::MassCancel;
+    command.userId = aCommand.userId;
+    command.filter = filter;
+    seq = Journalize(command);
+    for (const auto& instrument : mInstruments)
+    {
+      if (filter.instrument < 0 || static_cast<size_t>(filter.instrument) == instrument->index)
+      {
+        Publish(*instrument, seq);
+      }
+    }
+  }
+  WaitDurable(seq);
+
+  return BatchResult{Status::Ok, cancelled};
+}
+
+Status Core::Execute(const DepositCommand& aCommand)
+{
+  if (!IsUser(aCommand.userId))
+  {
+    return Status::UnknownUser;
+  }
+  if (aCommand.asset >= mAssetNames.size())
+  {
+    return Status::UnknownAsset;
+  }
+  if (aCommand.amount <= 0)
+  {
+    return Status::InvalidAmount;
+  }
+
+  uint64_t seq;
+  {
+    // Зачисление не касается стаканов: достаточно блокировки пользователей,
+    // под которой снимок видит его либо вместе с записью в журнале, либо без нее
+    std::lock_guard<std::mutex> usersLock(mUsersMutex);
+    mWallets.UpdateBalances(aCommand.userId, [&](Wallets::Cell* aBalances)
+    {
+      Wallets::Add(aBalances[aCommand.asset], aCommand.amount);
+    });
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::Deposit;
+    command.userId = aCommand.userId;
+    command.asset = aCommand.asset;
+    command.amount = aCommand.amount;
+    seq = Journalize(command);
+  }
+  WaitDurable(seq);
+
+  return Status::Ok;
+}
+
+Status Core::Execute(const BlockCommand& aCommand)
+{
+  if (!IsUser(aCommand.userId))
+  {
+    return Status::UnknownUser;
+  }
+  if (aCommand.instrument >= static_cast<int64_t>(mInstruments.size()))
+  {
+    return Status::UnknownInstrument;
+  }
+
+  uint64_t seq;
+  {
+    // Блокировка по одному инструменту не останавливает остальные
+    std::vector<std::unique_lock<std::mutex>> locks;
+    if (aCommand.instrument >= 0)
+    {
+      locks.emplace_back(mInstruments[aCommand.instrument]->mutex);
+    }
+    else
+    {
+      locks = LockInstruments();
+    }
+    BlockUser(aCommand.userId, aCommand.block, aCommand.instrument);
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::Block;
+    command.userId = aCommand.userId;
+    command.block = aCommand.block;
+    command.filter.instrument = aCommand.instrument;
+    seq = Journalize(command);
+    for (const auto& instrument : mInstruments)
+    {
+      if (aCommand.instrument < 0 || static_cast<size_t>(aCommand.instrument) == instrument->index)
+      {
+        Publish(*instrument, seq);
+      }
+    }
+  }
+  WaitDurable(seq, aCommand.instrument >= 0 ? mInstruments[aCommand.instrument].get() : nullptr);
+
+  return Status::Ok;
+}
+
+Status Core::GetActiveOrders(uint64_t aUserId, std::vector<ActiveOrder>& aOrders) const
+{
+  if (!IsUser(aUserId))
+  {
+    return Status::UnknownUser;
+  }
+
+  const UserData& user = mUsers[aUserId];
+  aOrders.clear();
+  for (const auto& instrument : mInstruments)
+  {
+    // Блоки не меняются, даже если инструмент тем временем опубликует новые
+    const std::shared_ptr<const PublishedOrders> blocks =
+        std::atomic_load(&user.orders[instrument->index]);
+    if (!blocks)
+    {
+      continue;
+    }
+    const size_t first = aOrders.size();
+    for (const auto& block : *blocks)
+    {
+      aOrders.insert(aOrders.end(), block->begin(), block->end());
+    }
+
+    // Блоки идут по номерам заявок, а нумерация та же, что и в RemoveQuote:
+    // сначала стакан в порядке GetUserOrders, затем стоп-заявки по номерам
+    const auto stops = std::stable_partition(aOrders.begin() + first, aOrders.end(),
+        [](const ActiveOrder& aOrder) { return aOrder.stopPrice == 0; });
+    std::sort(aOrders.begin() + first, stops,
+        [](const ActiveOrder& aLeft, const ActiveOrder& aRight)
+        {
+          return OrderBook::UserOrderLess(aLeft.order, aRight.order);
+        });
+  }
+
+  return Status::Ok;
+}
+
+Status Core::GetUserTrades(uint64_t aUserId, std::vector<Trade>& aTrades) const
+{
+  if (!IsUser(aUserId))
+  {
+    return Status::UnknownUser;
+  }
+
+  aTrades.clear();
+  const std::shared_ptr<const UserTrades> trades = std::atomic_load(&mUsers[aUserId].trades);
+  if (!trades)
+  {
+    return Status::Ok;
+  }
+  // Массив номеров не меняется ниже опубликованного размера, даже если его
+  // тем временем заменят большим
+  const size_t size = trades->size.load(std::memory_order_acquire);
+  aTrades.reserve(size);
+  for (size_t i = 0; i < size; ++i)
+  {
+    const Trade& t = (*mTrades)[trades->ids[i]];
+    if (t.instrument < mInstruments.size())
+    {
+      aTrades.push_back(t);
+    }
+  }
+
+  return Status::Ok;
+}
+
+OrderResult Core::Execute(const CancelQuoteCommand& aCommand)
+{
+  if (!IsUser(aCommand.userId))
+  {
+    return OrderResult{Status::UnknownUser};
+  }
+  if (aCommand.quote < 1)
+  {
+    return OrderResult{Status::UnknownOrder};
+  }
+
+  uint64_t seq;
+  uint64_t orderId;
+  {
+    const auto locks = LockInstruments();
+    orderId = RemoveQuote(aCommand.userId, aCommand.quote);
+    if (orderId == 0)
+    {
+      return OrderResult{Status::UnknownOrder};
+    }
+
+    JournalCommand command;
+    command.type = JournalCommand::Type::Cancel;
+    command.userId = aCommand.userId;
+    command.quote = aCommand.quote;
+    seq = Journalize(command);
+    for (const auto& instrument : mInstruments)
+    {
+      Publish(*instrument, seq);
+    }
+  }
+  WaitDurable(seq);
+
+  return OrderResult{Status::Ok, orderId};
+}
+
+uint64_t Core::RemoveQuote(uint64_t aUserId, int64_t aQuote)
+{
+  if (aQuote < 1)
+  {
+    return 0;
+  }
+
+  // Та же нумерация, что и в GetActiveOrders
+  for (const auto& instrument : mInstruments)
+  {
+    const auto orders = instrument->book.GetUserOrders(aUserId);
+    if (aQuote <= static_cast<int64_t>(orders.size()))
+    {
+      const Order* order = orders[aQuote - 1];
+      const uint64_t orderId = order->id;
+      RetireOrder(ExecutionReport::Type::Cancel, *order);
+      return instrument->book.Remove(orderId) ? orderId : 0;
+    }
+    aQuote -= orders.size();
+
+    const auto stops = instrument->stops.GetUserOrders(aUserId);
+    if (aQuote <= static_cast<int64_t>(stops.size()))
+    {
+      const Order& order = stops[aQuote - 1]->order;
+      const uint64_t orderId = order.id;
+      RetireOrder(ExecutionReport::Type::Cancel, order);
+      return instrument->stops.Remove(orderId) ? orderId : 0;
+    }
+    aQuote -= stops.size();
+  }
+
+  return 0;
+}
+
+size_t Core::ExpireOrders(uint64_t aNowMs)
+{
+  size_t expired = 0;
+  for (size_t i = 0; i < mInstruments.size(); ++i)
+  {
+    expired += ExpireOrders(i, aNowMs);
+  }
+  return expired;
+}
+
+size_t Core::ExpireOrders(size_t aInstrument, uint64_t aNowMs)
+{
+  if (aInstrument >= mInstruments.size())
+  {
+    return 0;
+  }
+  Instrument& instrument = *mInstruments[aInstrument];
+
+  size_t expired = 0;
+  uint64_t seq = 0;
+  {
+    std::lock_guard<std::mutex> lock(instrument.mutex);
+    instrument.expiries.Advance(aNowMs, [&](uint64_t aOrderId)
+    {
+      if (!ExpireOrder(aOrderId))
+      {
+        return;
+      }
+      ++expired;
+
+      // Время в журнал не пишется, поэтому при восстановлении снимаются
+      // ровно те заявки, что были сняты здесь
+      JournalCommand command;
+      command.type = JournalCommand::Type::Expire;
+      command.orderId = aOrderId;
+      seq = Journalize(command);
+    });
+    Publish(instrument, seq);
+  }
+  // Снятия по сроку подтверждаются владельцам так же, как команды
+  if (seq != 0)
+  {
+    WaitDurable(seq, &instrument);
+  }
+
+  return expired;
+}
+
+bool Core::ExpireOrder(uint64_t aOrderId)
+{
+  Instrument* instrument = FindOrderInstrument(aOrderId);
+  if (!instrument)
+  {
+    return false;
+  }
+  if (const Order* order = instrument->book.Find(aOrderId))
+  {
+    RetireOrder(ExecutionReport::Type::Expire, *order);
+    return instrument->book.Remove(aOrderId);
+  }
+  if (const StopOrder* stop = instrument->stops.Find(aOrderId))
+  {
+    RetireOrder(ExecutionReport::Type::Expire, stop->order);
+    return instrument->stops.Remove(aOrderId);
+  }
+
+  return false;
+}
+
+Instrument* Core::FindOrderInstrument(uint64_t aOrderId) const
+{
+  const size_t index = GetOrderInstrument(aOrderId);
+  return index < mInstruments.size() ? mInstruments[index].get() : nullptr;
+}
+
+std::vector<std::unique_lock<std::mutex>> Core::LockInstruments()
+{
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(mInstruments.size());
+  for (const auto& instrument : mInstruments)
+  {
+    locks.emplace_back(instrument->mutex);
+  }
+  return locks;
+}
+
+std::vector<std::unique_lock<std::mutex>> Core::LockOrderInstruments(
+    const std::vector<uint64_t>& aOrderIds, std::vector<Instrument*>& aInstruments) const
+{
+  aInstruments.clear();
+  for (uint64_t id : aOrderIds)
+  {
+    if (Instrument* instrument = FindOrderInstrument(id))
+    {
+      aInstruments.push_back(instrument);
+    }
+  }
+  std::sort(aInstruments.begin(), aInstruments.end(), [](const Instrument* aLeft,
+      const Instrument* aRight)
+  {
+    return aLeft->index < aRight->index;
+  });
+  aInstruments.erase(std::unique(aInstruments.begin(), aInstruments.end()), aInstruments.end());
+
+  std::vector<std::unique_lock<std::mutex>> locks;
+  locks.reserve(aInstruments.size());
+  for (Instrument* instrument : aInstruments)
+  {
+    locks.emplace_back(instrument->mutex);
+  }
+  return locks;
+}
+
+bool Core::ReserveFunds(const Instrument& aInstrument, uint64_t aUserId, bool isBuy,
+    double aAmount, double aPrice, bool aCheckFunds, double aFreed)
+{
+  std::lock_guard<std::mutex> usersLock(mUsersMutex);
+  if (aCheckFunds && !canAfford(mWallets, aUserId, aInstrument, isBuy, aAmount, aPrice, aFreed))
+  {
+    return false;
+  }
+  reserve(mWallets, aUserId, aInstrument, isBuy, aAmount, aPrice);
+  return true;
+}
+
+void Core::ReleaseFunds(const Order& aOrder, double aAmount)
+{
+  const Instrument& instrument = *FindOrderInstrument(aOrder.id);
+  std::lock_guard<std::mutex> usersLock(mUsersMutex);
+  reserve(mWallets, aOrder.userId, instrument, aOrder.isBuy, -aAmount, aOrder.price);
+}
+
+void Core::RetireOrder(ExecutionReport::Type aType, const Order& aOrder)
+{
+  Report(aType, aOrder, aOrder.amount + aOrder.hidden, 0);
+  ReleaseFunds(aOrder, aOrder.amount + aOrder.hidden);
+}
+
+uint64_t Core::NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void Core::OpenJournal(const std::string& aPath, const Journal::Options& aOptions)
+{
+  const auto locks = LockInstruments();
+  mJournal.reset();
+  // Сделки после снимка будут заново получены при повторе журнала
+  mTrades->Truncate(mSnapshotTrades);
+  RebuildStats();
+  RebuildUserTrades();
+  mJournal = std::make_unique<Journal>(aPath, aOptions,
+      [this](const JournalCommand& aCommand)
+      {
+        if (aCommand.seq > mSnapshotSeq)
+        {
+          ApplyCommand(aCommand);
+          for (const auto& instrument : mInstruments)
+          {
+            Publish(*instrument);
+          }
+        }
+      });
+}
+
+void Core::ReplayCommand(const JournalCommand& aCommand)
+{
+  const auto locks = LockInstruments();
+  ApplyCommand(aCommand);
+  for (const auto& instrument : mInstruments)
+  {
+    Publish(*instrument);
+  }
+}
+
+Status Core::GetMarketStats(size_t aInstrument, MarketSummary& aSummary,
+    std::optional<MarketStats::Resolution> aCandles)
+{
+  if (aInstrument >= mInstruments.size())
+  {
+    return Status::UnknownInstrument;
+  }
+
+  const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  Instrument& instrument = *mInstruments[aInstrument];
+  std::lock_guard<std::mutex> lock(instrument.mutex);
+  MarketStats& stats = instrument.stats;
+  aSummary.last = stats.GetLastPrice();
+  aSummary.volume24h = stats.GetVolume24h(now);
+  aSummary.vwap24h = stats.GetVwap24h(now);
+  aSummary.candles.clear();
+  if (aCandles)
+  {
+    aSummary.candles = stats.GetCandles(*aCandles);
+  }
+
+  return Status::Ok;
+}
+
+void Core::RebuildStats()
+{
+  const int64_t dayAgo = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      (std::chrono::system_clock::now() - std::chrono::hours(24)).time_since_epoch()).count();
+
+  // Сделки в хранилище упорядочены по времени
+  size_t first = 0, last = mTrades->Size();
+  while (first < last)
+  {
+    const size_t middle = first + (last - first) / 2;
+    if ((*mTrades)[middle].timeNs < dayAgo)
+    {
+      first = middle + 1;
+    }
+    else
+    {
+      last = middle;
+    }
+  }
+
+  for (const auto& instrument : mInstruments)
+  {
+    instrument->stats = MarketStats();
+  }
+  for (size_t i = first; i < mTrades->Size(); ++i)
+  {
+    const Trade& t = (*mTrades)[i];
+    if (t.instrument < mInstruments.size())
+    {
+      mInstruments[t.instrument]->stats.OnTrade(t.price, t.amount, t.timeNs);
+    }
+  }
+}
+
+Status Core::GetMarketDepth(size_t aInstrument, size_t aCount,
+    std::vector<LevelUpdate>& aLevels)
+{
+  if (aInstrument >= mInstruments.size())
+  {
+    return Status::UnknownInstrument;
+  }
+
+  Instrument& instrument = *mInstruments[aInstrument];
+  std::lock_guard<std::mutex> lock(instrument.mutex);
+  // Под блокировкой только копия уровней, текст собирается уже без нее
+  aLevels = instrument.book.GetDepth(std::min(aCount, kMaxDepthLevels));
+  return Status::Ok;
+}
+
+void Core::AddListener(CoreListener* aListener)
+{
+  const auto locks = LockInstruments();
+  mListeners.push_back(aListener);
+}
+
+void Core::RemoveListener(CoreListener* aListener)
+{
+  const auto locks = LockInstruments();
+  mListeners.erase(std::remove(mListeners.begin(), mListeners.end(), aListener),
+      mListeners.end());
+}
+
+void Core::GetMarketDataSnapshot(
+    const std::function<void(const std::vector<LevelUpdate>&)>& aCallback)
+{
+  const auto locks = LockInstruments();
+  std::vector<LevelUpdate> levels;
+  for (const auto& instrument : mInstruments)
+  {
+    for (LevelUpdate level : instrument->book.GetLevels())
+    {
+      level.instrument = instrument->index;
+      levels.push_back(level);
+    }
+  }
+  aCallback(levels);
+}
+
+void Core::Report(ExecutionReport::Type aType, const Order& aOrder,
+    double aLastAmount, double aLastPrice)
+{
+  Instrument& instrument = *FindOrderInstrument(aOrder.id);
+  instrument.changedOrders.emplace_back(aOrder.userId, aOrder.id);
+  if (!mListeners.empty())
+  {
+    // Снятая заявка больше ничего не ждет
+    const bool removed = aType == ExecutionReport::Type::Cancel ||
+        aType == ExecutionReport::Type::Expire;
+    instrument.pendingReports.push_back(ExecutionReport{aType, aOrder.userId, aOrder.id,
+        aOrder.isBuy, aOrder.price, aLastAmount, aLastPrice,
+        removed ? 0 : aOrder.amount + aOrder.hidden, instrument.index});
+  }
+}
+
+void Core::Publish(Instrument& aInstrument, uint64_t aSeq)
+{
+  PublishUserOrders(aInstrument);
+
+  std::vector<LevelUpdate>& levels = aInstrument.pendingLevels;
+  aInstrument.book.TakeChangedLevels(levels);
+  if (levels.empty() && aInstrument.pendingTrades.empty() && aInstrument.pendingReports.empty())
+  {
+    return;
+  }
+  for (LevelUpdate& level : levels)
+  {
+    level.instrument = aInstrument.index;
+  }
+
+  // Пока команда не на диске, ее сделки и исполнения не должен увидеть никто:
+  // после падения их бы не оказалось. События ждут в очереди инструмента.
+  // Если очередь не пуста, за ней встают и события без номера, чтобы не обогнать ее.
+  const bool deferred = aSeq != 0 && mJournal &&
+      mJournal->GetDurability() == Durability::AckAfterFsync;
+  if (deferred || !aInstrument.deferredEvents.empty())
+  {
+    DeferredEvents events;
+    events.seq = deferred ? aSeq : aInstrument.deferredEvents.back().seq;
+    events.levels.swap(levels);
+    events.trades.swap(aInstrument.pendingTrades);
+    events.reports.swap(aInstrument.pendingReports);
+    aInstrument.deferredEvents.push_back(std::move(events));
+    aInstrument.deferredCount.store(aInstrument.deferredEvents.size(),
+        std::memory_order_relaxed);
+    return;
+  }
+
+  Deliver(levels, aInstrument.pendingTrades, aInstrument.pendingReports);
+  levels.clear();
+  aInstrument.pendingTrades.clear();
+  aInstrument.pendingReports.clear();
+}
+
+void Core::Deliver(const std::vector<LevelUpdate>& aLevels, const std::vector<Trade>& aTrades,
+    const std::vector<ExecutionReport>& aReports)
+{
+  for (CoreListener* listener : mListeners)
+  {
+    if (!aLevels.empty() || !aTrades.empty())
+    {
+      listener->OnMarketData(aLevels, aTrades);
+    }
+    if (!aReports.empty())
+    {
+      listener->OnExecutions(aReports);
+    }
+  }
+}
+
+void Core::DeliverDurable(Instrument& aInstrument)
+{
+  // Свои события команда поставила в очередь сама, поэтому пропуск по счетчику
+  // без блокировки не теряет их; чужие разошлет их команда
+  if (aInstrument.deferredCount.load(std::memory_order_relaxed) == 0)
+  {
+    return;
+  }
+
+  const uint64_t durableSeq = mJournal->GetDurableSeq();
+  std::lock_guard<std::mutex> lock(aInstrument.mutex);
+  std::deque<DeferredEvents>& queue = aInstrument.deferredEvents;
+  while (!queue.empty() && queue.front().seq <= durableSeq)
+  {
+    const DeferredEvents& events = queue.front();
+    Deliver(events.levels, events.trades, events.reports);
+    queue.pop_front();
+  }
+  aInstrument.deferredCount.store(queue.size(), std::memory_order_relaxed);
+}
+
+void Core::PublishUserOrders(Instrument& aInstrument)
+{
+  std::vector<std::pair<uint64_t, uint64_t>>& changed = aInstrument.changedOrders;
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+  for (size_t i = 0; i < changed.size();)
+  {
+    const uint64_t userId = changed[i].first;
+    size_t end = i;
+    while (end < changed.size() && changed[end].first == userId)
+    {
+      ++end;
+    }
+    if (!IsUser(userId))
+    {
+      i = end;
+      continue;
+    }
+
+    // Команда копирует список указателей на блоки и блоки своих заявок, поэтому
+    // публикация не зависит от того, сколько всего заявок у пользователя
+    std::shared_ptr<const PublishedOrders>& published = mUsers[userId].orders[aInstrument.index];
+    const std::shared_ptr<const PublishedOrders> current = std::atomic_load(&published);
+    PublishedOrders blocks;
+    if (current)
+    {
+      blocks = *current;
+    }
+    for (; i < end; ++i)
+    {
+      publishOrder(blocks, changed[i].second, findActiveOrder(aInstrument, changed[i].second));
+    }
+
+    std::shared_ptr<const PublishedOrders> orders;
+    if (!blocks.empty())
+    {
+      orders = std::make_shared<const PublishedOrders>(std::move(blocks));
+    }
+    std::atomic_store(&published, std::move(orders));
+  }
+  changed.clear();
+}
+
+void Core::RebuildUserTrades()
+{
+  for (size_t id = 0, count = mNextUserId; id < count; ++id)
+  {
+    if (IsUser(id))
+    {
+      std::atomic_store(&mUsers[id].trades, std::shared_ptr<UserTrades>());
+    }
+  }
+  for (size_t i = 0, size = mTrades->Size(); i < size; ++i)
+  {
+    IndexTrade(i);
+  }
+}
+
+void Core::IndexTrade(size_t aIndex)
+{
+  // Своих заявок сведение не касается, поэтому покупатель и продавец различны
+  const Trade& trade = (*mTrades)[aIndex];
+  for (uint64_t userId : {trade.buyerId, trade.sellerId})
+  {
+    if (!IsUser(userId))
+    {
+      continue;
+    }
+    UserData& user = mUsers[userId];
+    std::shared_ptr<UserTrades> trades = std::atomic_load(&user.trades);
+    const size_t size = trades ? trades->size.load(std::memory_order_relaxed) : 0;
+    if (!trades || size == trades->capacity)
+    {
+      // Читатели старого массива дочитывают его, пока держат указатель
+      auto grown = std::make_shared<UserTrades>(trades ? 2 * trades->capacity : 16);
+      if (trades)
+      {
+        std::copy(trades->ids.get(), trades->ids.get() + size, grown->ids.get());
+      }
+      grown->size.store(size, std::memory_order_relaxed);
+      trades = std::move(grown);
+      std::atomic_store(&user.trades, trades);
+    }
+    trades->ids[size] = aIndex;
+    trades->size.store(size + 1, std::memory_order_release);
+  }
+}
+
+void Core::OpenTradeStore(const std::string& aPath)
+{
+  const auto locks = LockInstruments();
+  std::lock_guard<std::mutex> usersLock(mUsersMutex);
+  mTrades = std::make_unique<TradeStore>(aPath);
+  RebuildStats();
+  RebuildUserTrades();
+}
+
+bool Core::LoadSnapshot(const std::string& aPath)
+{
+  Snapshot::MappedFile file(aPath);
+  const Snapshot::Header* header = file.GetHeader();
+  if (!header || header->assetCount != mAssetNames.size() ||
+      header->instrumentCount != mInstruments.size())
+  {
+    return false;
+  }
+
+  // Снимок подходит только к тому же набору активов и инструментов
+  const Snapshot::Asset* assets = file.GetAssets();
+  for (size_t i = 0; i < mAssetNames.size(); ++i)
+  {
+    if (mAssetNames[i] != std::string(assets[i].name, strnlen(assets[i].name, kMaxAssetName)))
+    {
+      return false;
+    }
+  }
+  const Snapshot::Instrument* instruments = file.GetInstruments();
+  for (const auto& instrument : mInstruments)
+  {
+    const Snapshot::Instrument& record = instruments[instrument->index];
+    if (record.base != static_cast<uint64_t>(instrument->base) ||
+        record.quote != static_cast<uint64_t>(instrument->quote))
+    {
+      return false;
+    }
+  }
+
+  const auto locks = LockInstruments();
+  {
+    std::lock_guard<std::mutex> usersLock(mUsersMutex);
+
+    for (size_t id = 0, count = mNextUserId; id < count; ++id)
+    {
+      if (IsUser(id))
+      {
+        mUsers[id].registered = false;
+      }
+    }
+    mNextUserId = 0;
+    const Snapshot::User* users = file.GetUsers();
+    const double* balances = file.GetBalances();
+    for (uint64_t i = 0; i < header->userCount; ++i)
+    {
+      AddUser(users[i].id,
+          std::string(file.GetNames() + users[i].nameOffset, users[i].nameSize));
+      mUsers[users[i].id].blocked = users[i].blocked != 0;
+      mWallets.UpdateBalances(users[i].id, [&](Wallets::Cell* aBalances)
+      {
+        for (size_t asset = 0; asset < header->assetCount; ++asset)
+        {
+          aBalances[asset].store(balances[i * header->assetCount + asset],
+              std::memory_order_relaxed);
+        }
+      });
+    }
+
+    for (const auto& instrument : mInstruments)
+    {
+      instrument->book = OrderBook();
+      instrument->stops = StopBook();
+      instrument->expiries = TimerWheel(NowMs());
+      instrument->nextOrderId = instruments[instrument->index].nextOrderId;
+    }
+
+    // Заявки каждого инструмента сохранены в порядке приоритета
+    const Snapshot::Order* orders = file.GetOrders();
+    for (uint64_t i = 0; i < header->orderCount; ++i)
+    {
+      Instrument* instrument = FindOrderInstrument(orders[i].id);
+      if (!instrument)
+      {
+        continue;
+      }
+      Order order(orders[i].id, orders[i].userId, orders[i].amount, orders[i].price,
+          orders[i].isBuy != 0);
+      order.expireMs = orders[i].expireMs;
+      order.display = orders[i].display;
+      order.hidden = orders[i].hidden;
+      if (orders[i].stopPrice > 0)
+      {
+        instrument->stops.Add(
+            StopOrder{order, static_cast<OrderType>(orders[i].type), orders[i].stopPrice});
+      }
+      else
+      {
+        instrument->book.Add(order);
+      }
+      instrument->changedOrders.emplace_back(order.userId, order.id);
+      // Резервы в снимок не пишутся: они однозначно следуют из заявок
+      reserve(mWallets, order.userId, *instrument, order.isBuy, order.amount + order.hidden,
+          order.price);
+      if (order.expireMs)
+      {
+        instrument->expiries.Schedule(order.expireMs, order.id);
+      }
+    }
+
+    mSnapshotTrades = header->tradeCount;
+    mTrades->Truncate(mSnapshotTrades);
+    RebuildStats();
+    RebuildUserTrades();
+  }
+  for (const auto& instrument : mInstruments)
+  {
+    Publish(*instrument);
+  }
+
+  mSnapshotSeq = header->journalSeq;
+
+  return true;
+}
+
+bool Core::TakeSnapshot(const std::string& aPath)
+{
+  if (mSnapshotPid > 0)
+  {
+    int status;
+    if (::waitpid(mSnapshotPid, &status, WNOHANG) == 0)
+    {
+      return false;
+    }
+    mSnapshotPid = 0;
+  }
+
+  // Потомку достается состояние между командами всех инструментов
+  const auto locks = LockInstruments();
+  std::lock_guard<std::mutex> usersLock(mUsersMutex);
+  const uint64_t journalSeq = mJournal ? mJournal->GetLastSeq() : mSnapshotSeq;
+
+  const pid_t pid = ::fork();
+  if (pid == 0)
+  {
+    ::_exit(WriteSnapshot(aPath.c_str(), journalSeq) ? 0 : 1);
+  }
+  if (pid < 0)
+  {
+    return false;
+  }
+
+  mSnapshotPid = pid;
+  return true;
+}
+
+bool Core::WaitSnapshot()
+{
+  if (mSnapshotPid <= 0)
+  {
+    return false;
+  }
+
+  int status;
+  const pid_t pid = ::waitpid(mSnapshotPid, &status, 0);
+  mSnapshotPid = 0;
+
+  return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool Core::WriteSnapshot(const char* aPath, uint64_t aJournalSeq) const
+{
+  Snapshot::Writer writer(aPath);
+
+  Snapshot::Header header {};
+  std::memcpy(header.magic, Snapshot::kMagic, sizeof(header.magic));
+  header.journalSeq = aJournalSeq;
+  header.assetCount = mAssetNames.size();
+  header.instrumentCount = mInstruments.size();
+  // Пользователи, которые еще регистрируются, в снимок не попадают: их регистрация
+  // будет повторена из журнала
+  const size_t nextUserId = mNextUserId;
+  for (const auto& instrument : mInstruments)
+  {
+    const OrderBook& book = instrument->book;
+    for (bool isBuy : {true, false})
+    {
+      for (const auto& [price, level] : book.GetSide(isBuy))
+      {
+        header.orderCount += level.count;
+      }
+    }
+    header.orderCount += instrument->stops.Size();
+  }
+  header.tradeCount = mTrades->Size();
+  // Сделки до снимка больше не восстанавливаются из журнала, поэтому они должны
+  // быть на диске раньше снимка
+  if (!mTrades->Sync(header.tradeCount))
+  {
+    return false;
+  }
+  for (size_t id = 0; id < nextUserId; ++id)
+  {
+    if (IsUser(id))
+    {
+      ++header.userCount;
+      header.namesSize += mUsers[id].name.size();
+    }
+  }
+  writer.Write(&header, sizeof(header));
+
+  for (const std::string& name : mAssetNames)
+  {
+    Snapshot::Asset record {};
+    std::memcpy(record.name, name.data(), name.size());
+    writer.Write(&record, sizeof(record));
+  }
+
+  uint64_t nameOffset = 0;
+  for (size_t id = 0; id < nextUserId; ++id)
+  {
+    if (!IsUser(id))
+    {
+      continue;
+    }
+    const UserData& user = mUsers[id];
+    const Snapshot::User record {id, nameOffset, user.name.size(), user.blocked};
+    writer.Write(&record, sizeof(record));
+    nameOffset += user.name.size();
+  }
+
+  // Активов не больше kMaxAssets (см. AddAsset), поэтому хватает буфера на стеке
+  double balances[kMaxAssets];
+  const size_t assetCount = mWallets.GetAssetCount();
+  assert(assetCount <= kMaxAssets);
+  for (size_t id = 0; id < nextUserId; ++id)
+  {
+    if (!IsUser(id))
+    {
+      continue;
+    }
+    mWallets.ReadBalances(id, balances);
+    writer.Write(balances, assetCount * sizeof(double));
+  }
+
+  for (const auto& instrument : mInstruments)
+  {
+    const Snapshot::Instrument record {static_cast<uint64_t>(instrument->base),
+        static_cast<uint64_t>(instrument->quote), instrument->nextOrderId};
+    writer.Write(&record, sizeof(record));
+  }
+
+  for (const auto& instrument : mInstruments)
+  {
+    const OrderBook& book = instrument->book;
+    const StopBook& stops = instrument->stops;
+    for (bool isBuy : {true, false})
+    {
+      for (const auto& [price, level] : book.GetSide(isBuy))
+      {
+        for (const Order& o : level.orders)
+        {
+          const Snapshot::Order record {o.id, o.userId, o.amount, o.price, o.isBuy, o.expireMs,
+              static_cast<uint64_t>(OrderType::Limit), 0, o.display, o.hidden};
+          writer.Write(&record, sizeof(record));
+        }
+      }
+    }
+
+    for (bool isBuy : {true, false})
+    {
+      for (const auto& [stopPrice, stop] : stops.GetSide(isBuy))
+      {
+        const Order& o = stop.order;
+        const Snapshot::Order record {o.id, o.userId, o.amount, o.price, o.isBuy, o.expireMs,
+            static_cast<uint64_t>(stop.type), stopPrice, o.display, o.hidden};
+        writer.Write(&record, sizeof(record));
+      }
+    }
+  }
+
+  for (size_t id = 0; id < nextUserId; ++id)
+  {
+    if (!IsUser(id))
+    {
+      continue;
+    }
+    writer.Write(mUsers[id].name.data(), mUsers[id].name.size());
+  }
+
+  return writer.Commit();
+}
+
+void Core::ApplyCommand(const JournalCommand& aCommand)
+{
+  // Команды незарегистрированного пользователя пропускаются: под его запись
+  // и строку кошелька не выделено место (так бывает в журналах, где регистрация
+  // получала номер позже первых команд пользователя)
+  const bool userCommand = aCommand.type != JournalCommand::Type::Register &&
+      aCommand.type != JournalCommand::Type::Expire &&
+      aCommand.type != JournalCommand::Type::CancelOrders;
+  if (userCommand && !IsUser(aCommand.userId))
+  {
+    return;
+  }
+
+  switch (aCommand.type)
+  {
+    case JournalCommand::Type::Register:
+    {
+      std::lock_guard<std::mutex> usersLock(mUsersMutex);
+      // Пользователь мог попасть в снимок раньше, чем его регистрация в журнал
+      if (!IsUser(aCommand.userId))
+      {
+        AddUser(aCommand.userId, aCommand.name);
+      }
+      break;
+    }
+    case JournalCommand::Type::PlaceOrder:
+    {
+      if (aCommand.instrument >= mInstruments.size())
+      {
+        break;
+      }
+      OrderOptions options;
+      options.type = aCommand.orderType;
+      options.expireMs = aCommand.expireMs;
+      options.stopPrice = aCommand.stopPrice;
+      options.displayAmount = aCommand.displayAmount;
+      options.instrument = aCommand.instrument;
+      Order order(0, aCommand.userId, aCommand.amount, aCommand.price, aCommand.isBuy);
+      AddOrder(*mInstruments[aCommand.instrument], order, options, false);
+      break;
+    }
+    case JournalCommand::Type::Cancel:
+      RemoveQuote(aCommand.userId, aCommand.quote);
+      break;
+    case JournalCommand::Type::Expire:
+      ExpireOrder(aCommand.orderId);
+      break;
+    case JournalCommand::Type::Amend:
+      ModifyOrder(aCommand.userId, aCommand.orderId, aCommand.amount, aCommand.price);
+      break;
+    case JournalCommand::Type::MassQuote:
+      if (aCommand.instrument < mInstruments.size())
+      {
+        ApplyMassQuote(*mInstruments[aCommand.instrument], aCommand.userId,
+            aCommand.replaceBuys, aCommand.replaceSells, aCommand.quotes);
+      }
+      break;
+    case JournalCommand::Type::MassCancel:
+      CancelUserOrders(aCommand.userId, aCommand.filter);
+      break;
+    case JournalCommand::Type::Block:
+      BlockUser(aCommand.userId, aCommand.block, aCommand.filter.instrument);
+      break;
+    case JournalCommand::Type::CancelOrders:
+      for (uint64_t id : aCommand.orderIds)
+      {
+        CancelOrder(id);
+      }
+      break;
+    case JournalCommand::Type::Deposit:
+    {
+      std::lock_guard<std::mutex> usersLock(mUsersMutex);
+      if (aCommand.asset < mWallets.GetAssetCount())
+      {
+        mWallets.UpdateBalances(aCommand.userId, [&](Wallets::Cell* aBalances)
+        {
+          Wallets::Add(aBalances[aCommand.asset], aCommand.amount);
+        });
+      }
+      break;
+    }
+  }
+}
+
+uint64_t Core::Journalize(const JournalCommand& aCommand)
+{
+  return mJournal ? mJournal->Append(aCommand) : 0;
+}
+
+void Core::WaitDurable(uint64_t aSeq, Instrument* aInstrument)
+{
+  if (!mJournal || mJournal->GetDurability() != Durability::AckAfterFsync)
+  {
+    return;
+  }
+
+  mJournal->WaitDurable(aSeq);
+  if (aInstrument)
+  {
+    DeliverDurable(*aInstrument);
+    return;
+  }
+  for (const auto& instrument : mInstruments)
+  {
+    DeliverDurable(*instrument);
+  }
+}
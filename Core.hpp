@@ -1,120 +1,415 @@
+#ifndef CLIENSERVERECN_CORE_HPP
+#define CLIENSERVERECN_CORE_HPP
+
+#include <atomic>
 #include <vector>
 #include <string>
 #include <mutex>
 #include <chrono>
+#include <deque>
 #include <iostream>
 #include <iomanip>
 #include <map>
 #include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include <sys/types.h>
+
+#include "Asset.hpp"
+#include "ChunkedVector.hpp"
+#include "Commands.hpp"
+#include "CoreListener.hpp"
+#include "Journal.hpp"
+#include "MarketStats.hpp"
+#include "OrderBook.hpp"
+#include "StopBook.hpp"
+#include "TimerWheel.hpp"
+#include "TradeStore.hpp"
+#include "Wallets.hpp"
 
 struct UserData;
-struct Order;
-struct Trade;
+struct Instrument;
 
-// Серверная логика
+// Серверная логика.
+//
+// Каждый инструмент - отдельный шард со своим стаканом и своей блокировкой, поэтому
+// команды разных инструментов можно выполнять параллельно из разных потоков.
+// Балансы общие для всех инструментов и меняются под отдельной короткой блокировкой
+// пользователей; она всегда берется последней. Команды, затрагивающие несколько
+// инструментов, блокируют их все по порядку номеров.
+//
+// Запросы баланса, активных заявок и истории сделок не берут ни одной из этих
+// блокировок: они читают опубликованное состояние. Балансы читаются по версиям
+// строк кошелька, сделки - по опубликованным номерам сделок пользователя, а заявки
+// пользователя в каждом инструменте публикуются неизменяемыми блоками, из которых
+// команда заменяет только блоки измененных заявок.
+//
+// Ядро не разбирает и не собирает текст: команды и ответы типизированы
+// (Commands.hpp), текст клиентского протокола собирает Protocol.cpp вне блокировок.
 class Core
 {
 public:
-    // "Регистрирует" нового пользователя и возвращает его ID.
-    std::string RegisterNewUser(const std::string& aUserName);
+    // Сколько заявок пользователя лежит в одном блоке опубликованного списка:
+    // команда копирует блок каждой измененной заявки, а не весь список
+    static constexpr size_t kOrderBlock = 64;
+    // Сколько уровней стакана отдается максимум
+    static constexpr size_t kMaxDepthLevels = 100;
+
+    // Создает ядро с единственным инструментом USD/RUB под номером 0
+    Core();
+
+    // Добавляет инструмент aBase/aQuote (имена активов вида "EUR") и возвращает
+    // его номер. Незнакомые активы регистрируются. Вызывается до LoadSnapshot,
+    // OpenJournal и первых команд. Бросает std::invalid_argument, если имя актива
+    // некорректно, активы совпадают или активов слишком много.
+    size_t AddInstrument(const std::string& aBase, const std::string& aQuote);
+
+    // Номер инструмента по имени вида "EUR/RUB"; -1, если такого нет
+    int64_t GetInstrumentIndex(const std::string& aSymbol) const;
+    const std::string& GetInstrumentSymbol(size_t aInstrument) const;
+    size_t GetInstrumentCount() const { return mInstruments.size(); }
+
+    // Номер инструмента, к которому относится заявка
+    static size_t GetOrderInstrument(uint64_t aOrderId) { return aOrderId >> kInstrumentShift; }
+
+    // Имя актива по номеру; номер актива по имени (-1, если такого нет)
+    const std::string& GetAssetName(AssetId aAsset) const { return mAssetNames[aAsset]; }
+    int64_t FindAsset(const std::string& aName) const;
+    // Базовый и котируемый активы инструмента
+    AssetId GetInstrumentBase(size_t aInstrument) const;
+    AssetId GetInstrumentQuote(size_t aInstrument) const;
+
+    // Регистрирует нового пользователя и записывает его номер в aUserId.
+    // Регистрации из разных потоков идут параллельно и не берут блокировок ядра.
+    // Сверх kMaxUsers возвращает Status::TooManyUsers, не расходуя номер.
+    Status RegisterUser(const std::string& aUserName, uint64_t& aUserId);
+
+    // Зарегистрирован ли пользователь; регистрация может идти в другом потоке
+    bool IsUser(uint64_t aUserId) const;
+
+    // Команды (см. Commands.hpp). Команды одного инструмента из разных потоков
+    // выполняются по очереди; исполнения приходят получателям событий.
+    //
+    // Новая заявка. Стоп-заявка ставится в стакан с типом options.type, когда
+    // цена сделки дойдет до стоп-цены.
+    OrderResult Execute(const NewOrderCommand& aCommand);
+    // Уменьшение объема сохраняет место в очереди, изменение цены или увеличение
+    // объема ставит заявку в конец очереди новой цены как одна команда
+    OrderResult Execute(const AmendCommand& aCommand);
+    OrderResult Execute(const CancelCommand& aCommand);
+    OrderResult Execute(const CancelQuoteCommand& aCommand);
+    // Пакет с некорректной котировкой отклоняется целиком. При проверке средств
+    // котировки, на которые их не хватает, пропускаются. Номера поставленных
+    // заявок дописываются в aOrderIds.
+    BatchResult Execute(const MassQuoteCommand& aCommand,
+        std::vector<uint64_t>* aOrderIds = nullptr);
+    BatchResult Execute(const MassCancelCommand& aCommand);
+    Status Execute(const DepositCommand& aCommand);
+    // Kill switch службы рисков: при block снимает заявки пользователя (только
+    // инструмента aCommand.instrument, если он задан) и отклоняет новые, пока
+    // торговля не будет снова разрешена. Сервер рассылает команду по инструменту
+    // в поток каждого из них, не останавливая все стаканы разом.
+    Status Execute(const BlockCommand& aCommand);
+
+    // Снимает еще активные заявки из списка одной командой (cancel-on-disconnect).
+    // Блокирует только инструменты этих заявок. Возвращает число снятых заявок.
+    size_t CancelOrders(const std::vector<uint64_t>& aOrderIds);
 
-    // Запрос имени клиента по ID
-    std::string GetUserName(const std::string& aUserId) const;
+    // Оставляет в aOrderIds только заявки, которые еще в стакане или ждут срабатывания.
+    // Блокирует только инструменты этих заявок.
+    void KeepActiveOrders(std::vector<uint64_t>& aOrderIds);
 
-    // Запрос баланса клиента по ID
-    std::string GetUserBalance(const std::string& aUserId) const;
+    // Включает предторговую проверку средств: заявка принимается, только если
+    // свободного остатка (баланс за вычетом резерва под активные заявки) хватает
+    // на ее полный объем. Резервы ведутся всегда, проверка по умолчанию выключена.
+    // Рыночная покупка при включенной проверке отклоняется (Status::MarketBuyNotAllowed).
+    void SetRiskChecks(bool aEnabled) { mRiskChecks = aEnabled; }
 
-    // Запрос на добавление новой заявки в стакан
-    std::string PlaceNewOrder(const std::string& aUserId,
-        const std::string& aAmount,
-        const std::string& aPrice,
-        bool isBuy);
+    // Запросы. Результат записывается в последний параметр; при ошибке он не меняется.
+    //
+    // Имя пользователя
+    Status GetUserName(uint64_t aUserId, std::string& aName) const;
+    // Балансы всех активов: котируемый актив инструмента раньше базового
+    Status GetBalances(uint64_t aUserId, std::vector<AssetBalance>& aBalances) const;
+    // Активные заявки по инструментам: в каждом сначала стакан, затем стоп-заявки.
+    // Порядок совпадает с нумерацией CancelQuoteCommand.
+    Status GetActiveOrders(uint64_t aUserId, std::vector<ActiveOrder>& aOrders) const;
+    // Сделки пользователя в порядке их совершения
+    Status GetUserTrades(uint64_t aUserId, std::vector<Trade>& aTrades) const;
+    // Последняя цена, объем и VWAP за 24 часа; с aCandles - и последние свечи
+    Status GetMarketStats(size_t aInstrument, MarketSummary& aSummary,
+        std::optional<MarketStats::Resolution> aCandles = std::nullopt);
+    // Стакан: до aCount (не больше kMaxDepthLevels) лучших уровней каждой стороны
+    // с суммарным объемом и числом заявок. Продажи от худшей цены к лучшей, затем
+    // покупки от лучшей к худшей.
+    Status GetMarketDepth(size_t aInstrument, size_t aCount,
+        std::vector<LevelUpdate>& aLevels);
 
-    // Запрос на вывод активных заявок 
-    std::string GetUserActiveQuotes(const std::string& aUserId) const;
+    // Снимает заявки, срок действия которых истек к aNowMs (мс с начала эпохи).
+    // Возвращает число снятых заявок.
+    size_t ExpireOrders(uint64_t aNowMs);
+    // То же для одного инструмента: сервер вызывает по таймеру в потоке
+    // сопоставления этого инструмента, чтобы не брать блокировки остальных
+    size_t ExpireOrders(size_t aInstrument, uint64_t aNowMs);
 
-    // Запрос на вывод истории сделок
-    std::string GetUserTrades(const std::string& aUserId) const;
+    // Подписывает получателя на события ядра
+    void AddListener(CoreListener* aListener);
+    void RemoveListener(CoreListener* aListener);
 
-    // Запрос на удаление активной заявки
-    std::string CancelUserQuote(const std::string& aUserId, const std::string& aQuote);
+    // Передает в aCallback текущее состояние всех уровней стаканов всех инструментов.
+    // Вызывается под блокировкой всех инструментов, поэтому между снимком
+    // и следующими OnMarketData не теряется ни одно изменение. Снимок может уже
+    // включать уровни, рассылка которых ждет записи команды на диск; они придут
+    // повторно с тем же состоянием.
+    void GetMarketDataSnapshot(
+        const std::function<void(const std::vector<LevelUpdate>&)>& aCallback);
+
+    // Восстанавливает состояние из журнала aPath и далее пишет в него
+    // все принятые команды. Бросает std::runtime_error, если журнал не открыть.
+    // Команды, уже вошедшие в загруженный снимок, пропускаются.
+    void OpenJournal(const std::string& aPath, const Journal::Options& aOptions);
+
+    // Выполняет команду из журнала так же, как при восстановлении, и рассылает
+    // ее результат получателям. Позволяет прогнать записанный поток команд через
+    // ядро без сети (см. Replay.cpp).
+    void ReplayCommand(const JournalCommand& aCommand);
+
+    // Хранит историю сделок в сегментах <aPath>.NNNNNN вместо анонимной памяти.
+    // Вызывается до LoadSnapshot и OpenJournal.
+    void OpenTradeStore(const std::string& aPath);
+
+    // Загружает состояние из снимка aPath. Вызывается до OpenJournal.
+    // Возвращает false, если снимка нет или он поврежден.
+    bool LoadSnapshot(const std::string& aPath);
+
+    // Запускает запись снимка в aPath в дочернем процессе (fork): потомок получает
+    // согласованную копию памяти, а сопоставление заявок продолжается без пауз.
+    // Возвращает false, если предыдущий снимок еще пишется или fork не удался.
+    bool TakeSnapshot(const std::string& aPath);
+
+    // Дожидается окончания записи снимка. Возвращает true, если снимок записан.
+    bool WaitSnapshot();
 
 private:
-    std::map<size_t, UserData> mUsers;
-    std::vector<Order> mBuyOrders;
-    std::vector<Order> mSellOrders;
-    std::vector<Trade> mTrades;
-    std::mutex mMutex;
+    // Номер заявки - номер инструмента в старших битах и порядковый номер
+    // в инструменте в младших. Заявки инструмента нумеруются в порядке его команд,
+    // поэтому при повторе журнала номера совпадают, как бы ни чередовались
+    // команды разных инструментов.
+    static constexpr unsigned kInstrumentShift = 48;
+    static constexpr size_t kUserChunk = 1024;
+    // Сколько пользователей вмещают записи и кошельки
+    static constexpr size_t kMaxUsers = std::min(kUserChunk, Wallets::kChunkUsers) *
+        ChunkedVector<UserData>::kMaxChunks;
+
+    std::vector<std::unique_ptr<Instrument>> mInstruments;
+    // Имена активов по номерам
+    std::vector<std::string> mAssetNames;
+    // Порядок вывода баланса: котируемый актив инструмента раньше базового
+    std::vector<AssetId> mAssetOrder;
+    // Пользователи по номерам. Записи не переезжают, поэтому зарегистрированного
+    // пользователя можно читать без блокировки.
+    ChunkedVector<UserData> mUsers {kUserChunk};
+    // Номер следующего пользователя; номера выдаются без блокировки
+    std::atomic<size_t> mNextUserId {0};
+    Wallets mWallets;
+    // Запись в кошельки и дозапись в mTrades. Берется после блокировок инструментов.
+    std::mutex mUsersMutex;
+    std::unique_ptr<TradeStore> mTrades = std::make_unique<TradeStore>();
+    std::unique_ptr<Journal> mJournal;
+    std::vector<CoreListener*> mListeners;
+    // Номер последней команды журнала, вошедшей в загруженный снимок
+    uint64_t mSnapshotSeq = 0;
+    // Число сделок на момент снимка
+    uint64_t mSnapshotTrades = 0;
+    // Процесс, который пишет снимок
+    pid_t mSnapshotPid = 0;
+    // Включена ли предторговая проверка средств
+    bool mRiskChecks = false;
 
 private:
-    void MatchOrder(Order& order, std::vector<Order>& opp);
-};
+    void MatchOrder(Instrument& aInstrument, Order& order);
 
-struct UserData
-{
-  std::string name;
-  double usd;
-  double rub;
-};
+    void AddUser(size_t aUserId, const std::string& aName);
+    // Заполняет запись и строку кошелька пользователя, не делая его видимым
+    void FillUser(size_t aUserId, const std::string& aName);
+    AssetId AddAsset(const std::string& aName);
+    // Принимает новую заявку aOrder и присваивает ей номер: стоп-заявку откладывает,
+    // остальные исполняет; в aOrder остается неисполненный остаток. При aCheckFunds
+    // возвращает false и ничего не делает, если на заявку не хватает средств.
+    bool AddOrder(Instrument& aInstrument, Order& aOrder, const OrderOptions& aOptions,
+        bool aCheckFunds);
+    uint64_t NextOrderId(Instrument& aInstrument);
+    // Сводит заявку и ставит остаток в стакан или снимает его в зависимости от типа
+    void ExecuteOrder(Instrument& aInstrument, Order& aOrder, OrderType aType);
+    // Исполняет стоп-заявки, сработавшие от последних сделок
+    void TriggerStops(Instrument& aInstrument);
+    uint64_t RemoveQuote(uint64_t aUserId, int64_t aQuote);
+    // Возвращает false, если заявки нет или (при aCheckFunds) на нее не хватает средств
+    bool ModifyOrder(uint64_t aUserId, uint64_t aOrderId, double aAmount, double aPrice,
+        bool aCheckFunds = false);
+    // Снимает заявки пользователя, подходящие под aFilter, за один проход
+    // по его индексу заявок. Возвращает их число.
+    size_t CancelUserOrders(uint64_t aUserId, const OrderFilter& aFilter);
+    // Снимает заявки инструмента aInstrument (-1 - всех) при блокировке
+    void BlockUser(uint64_t aUserId, bool aBlock, int64_t aInstrument = -1);
+    // Снимает заявку по номеру. Возвращает false, если ее уже нет.
+    bool CancelOrder(uint64_t aOrderId);
+    // Если задан aAccepted, котировки, на которые не хватает средств, пропускаются,
+    // а поставленные записываются в aAccepted
+    void ApplyMassQuote(Instrument& aInstrument, uint64_t aUserId,
+        bool aReplaceBuys, bool aReplaceSells,
+        const std::vector<QuoteEntry>& aQuotes, std::vector<uint64_t>* aOrderIds = nullptr,
+        std::vector<QuoteEntry>* aAccepted = nullptr);
+    // Снимает заявку с истекшим сроком. Возвращает false, если ее уже нет в стакане.
+    bool ExpireOrder(uint64_t aOrderId);
 
-struct Order
-{
-  std::string userId;
-  double amount;
-  double price;
-  bool isBuy;
+    // Инструмент заявки; nullptr, если номер заявки не относится ни к одному
+    Instrument* FindOrderInstrument(uint64_t aOrderId) const;
+    // Блокирует все инструменты по порядку номеров
+    std::vector<std::unique_lock<std::mutex>> LockInstruments();
+    // Блокирует по порядку номеров инструменты заявок aOrderIds и записывает
+    // их в aInstruments
+    std::vector<std::unique_lock<std::mutex>> LockOrderInstruments(
+        const std::vector<uint64_t>& aOrderIds, std::vector<Instrument*>& aInstruments) const;
 
-  std::chrono::steady_clock::time_point timepoint;
+    // Резервирует средства под aAmount новой заявки. При aCheckFunds - только если
+    // свободного остатка хватает с учетом освобождаемого резерва aFreed. Проверка
+    // и резерв идут под одной блокировкой, поэтому заявки разных инструментов
+    // не займут одни и те же средства.
+    bool ReserveFunds(const Instrument& aInstrument, uint64_t aUserId, bool isBuy,
+        double aAmount, double aPrice, bool aCheckFunds, double aFreed = 0);
+    void ReleaseFunds(const Order& aOrder, double aAmount);
+    // Снимает заявку с отчетом aType и освобождает ее резерв
+    void RetireOrder(ExecutionReport::Type aType, const Order& aOrder);
 
-  Order(const std::string& id, double am, double pr, bool buy)
-    : userId{id}, amount{am}, price{pr}, isBuy{buy}, timepoint{std::chrono::steady_clock::now()}
-  {
-  }
+    static uint64_t NowMs();
 
-  bool operator<(const Order& other) {
-    // в приоритете более ранние заявки
-    if (price == other.price)
-    {
-      return timepoint > other.timepoint;
-    }
-
-    if (isBuy)
-    {
-      return price < other.price;
-    }
-    
-    return price > other.price;
-  }
+    // Пишет снимок в aPath. Выполняется в дочернем процессе, поэтому не выделяет память.
+    bool WriteSnapshot(const char* aPath, uint64_t aJournalSeq) const;
 
-  friend std::ostream& operator<<(std::ostream& os, const Order& order) {
-    os << order.userId << ' ' << order.amount << ' ' << order.price <<
-      (order.isBuy ? " BUY" : " SELL");
+    // Запоминает отчет об исполнении для рассылки
+    void Report(ExecutionReport::Type aType, const Order& aOrder,
+        double aLastAmount, double aLastPrice);
 
-    return os;
-  }
+    // Публикует для запросов новые списки заявок затронутых пользователей
+    // и рассылает изменения стакана, сделки и отчеты выполненной команды aSeq.
+    // В режиме Durability::AckAfterFsync рассылка откладывается до записи
+    // команды на диск (см. WaitDurable).
+    void Publish(Instrument& aInstrument, uint64_t aSeq = 0);
+    void Deliver(const std::vector<LevelUpdate>& aLevels, const std::vector<Trade>& aTrades,
+        const std::vector<ExecutionReport>& aReports);
+    // Рассылает отложенные события инструмента, команды которых уже на диске.
+    // Вызывается без блокировки инструмента.
+    void DeliverDurable(Instrument& aInstrument);
+    void PublishUserOrders(Instrument& aInstrument);
+
+    // Пересчитывает статистику инструментов по сделкам за последние сутки из mTrades
+    void RebuildStats();
+    // Заново строит номера сделок пользователей по mTrades. Вызывается, когда
+    // сделки не дописываются: под блокировками всех инструментов или при загрузке.
+    void RebuildUserTrades();
+    // Добавляет сделку aIndex из mTrades в номера сделок ее участников.
+    // Вызывается под mUsersMutex.
+    void IndexTrade(size_t aIndex);
+
+    // Повтор команды из журнала при восстановлении
+    void ApplyCommand(const JournalCommand& aCommand);
+
+    // Пишет команду в журнал (если он открыт) и возвращает ее номер
+    uint64_t Journalize(const JournalCommand& aCommand);
+    // В режиме Durability::AckAfterFsync ждет, пока команда aSeq попадет на диск,
+    // и рассылает отложенные события инструмента aInstrument (всех, если не задан).
+    // Вызывается после снятия блокировок инструментов.
+    void WaitDurable(uint64_t aSeq, Instrument* aInstrument = nullptr);
 };
 
-struct Trade
+// Блок опубликованных заявок пользователя по возрастанию номеров
+using ActiveOrders = std::vector<ActiveOrder>;
+// Опубликованные заявки пользователя в одном инструменте: непустые блоки по
+// возрастанию номеров заявок, в блоке не больше 2 * Core::kOrderBlock заявок
+using PublishedOrders = std::vector<std::shared_ptr<const ActiveOrders>>;
+
+// Номера сделок пользователя в Core::mTrades по возрастанию. Номера дописываются
+// под Core::mUsersMutex в свободные ячейки, поэтому первые size номеров можно читать
+// без блокировки; заполненный массив заменяется вдвое большим.
+struct UserTrades
 {
-  std::string buyerId;
-  std::string sellerId;
-  double amount;
-  double price;
-  std::chrono::steady_clock::time_point timepoint;
-
-  Trade(const std::string& buyer, const std::string& seller, double am, double pr)
-    : buyerId{buyer}, sellerId{seller}, amount{am}, price{pr}, timepoint{std::chrono::steady_clock::now()}
+  explicit UserTrades(size_t aCapacity)
+    : capacity{aCapacity},
+      ids{new uint64_t[aCapacity]}
   {
   }
 
-  friend std::ostream& operator<<(std::ostream& os, const Trade& t)
-  {
-    os << t.sellerId << " SOLD "
-       << t.buyerId << ' '
-       << t.amount << " USD for "
-       << t.price << " RUB";
+  const size_t capacity;
+  std::unique_ptr<uint64_t[]> ids;
+  std::atomic<size_t> size {0};
+};
 
-    return os;
-  }
+// Балансы и резервы пользователя лежат в Core::mWallets
+struct UserData
+{
+  std::string name;
+  // Торговля остановлена службой рисков (kill switch). Меняется под блокировкой
+  // одного инструмента, а читается под блокировками остальных.
+  std::atomic<bool> blocked {false};
+  // Опубликованные заявки по номерам инструментов; пустой указатель - заявок нет.
+  // Меняются под блокировкой инструмента, читаются через std::atomic_load.
+  std::vector<std::shared_ptr<const PublishedOrders>> orders;
+  // Номера сделок; пустой указатель - сделок нет. Заменяется через std::atomic_store.
+  std::shared_ptr<UserTrades> trades;
+  // Запись заполнена, и пользователь виден остальным потокам
+  std::atomic<bool> registered {false};
+};
 
+// События команды, отложенные до ее записи на диск
+struct DeferredEvents
+{
+  uint64_t seq;
+  std::vector<LevelUpdate> levels;
+  std::vector<Trade> trades;
+  std::vector<ExecutionReport> reports;
 };
+
+// Состояние инструмента (шарда). Все поля, кроме неизменных symbol, base, quote
+// и index, меняются только под mutex.
+struct Instrument
+{
+  Instrument(size_t aIndex, AssetId aBase, AssetId aQuote, std::string aSymbol,
+      uint64_t aNowMs);
+
+  const size_t index;
+  const AssetId base;
+  const AssetId quote;
+  const std::string symbol;
+
+  std::mutex mutex;
+  OrderBook book;
+  StopBook stops;
+  MarketStats stats;
+  // Сроки действия заявок. Снятые раньше срока заявки остаются в колесе
+  // и пропускаются при срабатывании.
+  TimerWheel expiries;
+  // Порядковый номер следующей заявки инструмента
+  uint64_t nextOrderId = 1;
+  // Цена последней сделки; по ней срабатывают стоп-заявки
+  double lastPrice = 0;
+  // Число сделок инструмента: по его изменению видно, что команда дала сделки
+  uint64_t tradeCount = 0;
+  // Изменения уровней, сделки и отчеты текущей команды для рассылки. Буферы
+  // переиспользуются от команды к команде.
+  std::vector<LevelUpdate> pendingLevels;
+  std::vector<Trade> pendingTrades;
+  std::vector<ExecutionReport> pendingReports;
+  // Заявки (пользователь, номер заявки), которые изменила текущая команда;
+  // возможны повторы
+  std::vector<std::pair<uint64_t, uint64_t>> changedOrders;
+  // События команд, ждущих записи на диск, по порядку номеров команд
+  std::deque<DeferredEvents> deferredEvents;
+  // Размер deferredEvents для проверки без блокировки
+  std::atomic<size_t> deferredCount {0};
+};
+
+#endif //CLIENSERVERECN_CORE_HPP
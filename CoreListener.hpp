@@ -0,0 +1,60 @@
+#ifndef CLIENSERVERECN_CORELISTENER_HPP
+#define CLIENSERVERECN_CORELISTENER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "OrderBook.hpp"
+#include "TradeStore.hpp"
+
+// Отчет об исполнении для владельца заявки
+struct ExecutionReport
+{
+  enum class Type : uint8_t
+  {
+    New,      // заявка принята
+    Fill,     // заявка (частично) исполнена
+    Cancel,   // заявка снята
+    Expire,   // истек срок действия заявки
+    Amend     // изменены объем или цена заявки
+  };
+
+  Type type;
+  uint64_t userId;
+  uint64_t orderId;
+  bool isBuy;
+  // цена заявки
+  double price;
+  // объем и цена последней сделки (для Fill), снятый объем (для Cancel и Expire);
+  // для Amend price и leaves - новые цена и объем
+  double lastAmount;
+  double lastPrice;
+  // остаток заявки
+  double leaves;
+  // номер инструмента
+  size_t instrument;
+};
+
+// Получатель событий ядра. Методы вызываются под блокировкой инструмента в потоке,
+// выполнившем команду, поэтому должны быстро возвращать управление. События разных
+// инструментов могут приходить одновременно из разных потоков. В режиме
+// Durability::AckAfterFsync события команды приходят только после ее записи
+// на диск, иногда в потоке одной из следующих команд того же инструмента.
+class CoreListener
+{
+public:
+  virtual ~CoreListener() = default;
+
+  // Изменения стакана и сделки, вызванные одной командой
+  virtual void OnMarketData(const std::vector<LevelUpdate>& /*aLevels*/,
+      const std::vector<Trade>& /*aTrades*/)
+  {
+  }
+
+  // Отчеты об исполнении заявок, вызванные одной командой
+  virtual void OnExecutions(const std::vector<ExecutionReport>& /*aReports*/)
+  {
+  }
+};
+
+#endif //CLIENSERVERECN_CORELISTENER_HPP
@@ -0,0 +1,451 @@
+#include "Journal.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+  // Заголовок записи: длина тела и его контрольная сумма
+  constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+  // Защита от мусора вместо длины в поврежденном файле
+  constexpr uint32_t kMaxBodySize = 1 << 20;
+
+  uint32_t checksum(const char* aData, size_t aSize)
+  {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < aSize; ++i)
+    {
+      hash ^= static_cast<unsigned char>(aData[i]);
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  template <typename T>
+  void put(std::vector<char>& aOut, const T& aValue)
+  {
+    const char* bytes = reinterpret_cast<const char*>(&aValue);
+    aOut.insert(aOut.end(), bytes, bytes + sizeof(T));
+  }
+
+  template <typename T>
+  bool get(const char*& aIt, const char* aEnd, T& aValue)
+  {
+    if (static_cast<size_t>(aEnd - aIt) < sizeof(T))
+    {
+      return false;
+    }
+    std::memcpy(&aValue, aIt, sizeof(T));
+    aIt += sizeof(T);
+    return true;
+  }
+
+  // Дописывает в aOut запись с командой
+  void encode(const JournalCommand& aCommand, std::vector<char>& aOut)
+  {
+    const size_t headerPos = aOut.size();
+    aOut.resize(headerPos + kHeaderSize);
+
+    put(aOut, aCommand.seq);
+    put(aOut, static_cast<uint8_t>(aCommand.type));
+    put(aOut, aCommand.userId);
+
+    switch (aCommand.type)
+    {
+      case JournalCommand::Type::Register:
+        put(aOut, static_cast<uint32_t>(aCommand.name.size()));
+        aOut.insert(aOut.end(), aCommand.name.begin(), aCommand.name.end());
+        break;
+      case JournalCommand::Type::PlaceOrder:
+        put(aOut, aCommand.amount);
+        put(aOut, aCommand.price);
+        put(aOut, static_cast<uint8_t>(aCommand.isBuy));
+        put(aOut, static_cast<uint8_t>(aCommand.orderType));
+        put(aOut, aCommand.expireMs);
+        put(aOut, aCommand.stopPrice);
+        put(aOut, aCommand.displayAmount);
+        put(aOut, aCommand.instrument);
+        break;
+      case JournalCommand::Type::Cancel:
+        put(aOut, aCommand.quote);
+        break;
+      case JournalCommand::Type::Expire:
+        put(aOut, aCommand.orderId);
+        break;
+      case JournalCommand::Type::Amend:
+        put(aOut, aCommand.orderId);
+        put(aOut, aCommand.amount);
+        put(aOut, aCommand.price);
+        break;
+      case JournalCommand::Type::MassQuote:
+        put(aOut, static_cast<uint8_t>(aCommand.replaceBuys | aCommand.replaceSells << 1));
+        put(aOut, static_cast<uint32_t>(aCommand.quotes.size()));
+        for (const QuoteEntry& quote : aCommand.quotes)
+        {
+          put(aOut, quote.amount);
+          put(aOut, quote.price);
+          put(aOut, static_cast<uint8_t>(quote.isBuy));
+        }
+        put(aOut, aCommand.instrument);
+        break;
+      case JournalCommand::Type::MassCancel:
+        put(aOut, static_cast<uint8_t>(aCommand.filter.buys | aCommand.filter.sells << 1 |
+                                       aCommand.filter.stops << 2));
+        put(aOut, aCommand.filter.minPrice);
+        put(aOut, aCommand.filter.maxPrice);
+        put(aOut, aCommand.filter.instrument);
+        break;
+      case JournalCommand::Type::Block:
+        put(aOut, static_cast<uint8_t>(aCommand.block));
+        put(aOut, aCommand.filter.instrument);
+        break;
+      case JournalCommand::Type::CancelOrders:
+        put(aOut, static_cast<uint32_t>(aCommand.orderIds.size()));
+        for (uint64_t id : aCommand.orderIds)
+        {
+          put(aOut, id);
+        }
+        break;
+      case JournalCommand::Type::Deposit:
+        put(aOut, aCommand.asset);
+        put(aOut, aCommand.amount);
+        break;
+    }
+
+    const uint32_t bodySize = static_cast<uint32_t>(aOut.size() - headerPos - kHeaderSize);
+    const uint32_t sum = checksum(aOut.data() + headerPos + kHeaderSize, bodySize);
+    std::memcpy(aOut.data() + headerPos, &bodySize, sizeof(bodySize));
+    std::memcpy(aOut.data() + headerPos + sizeof(bodySize), &sum, sizeof(sum));
+  }
+
+  bool decode(const char* aIt, const char* aEnd, JournalCommand& aCommand)
+  {
+    uint8_t type;
+    if (!get(aIt, aEnd, aCommand.seq) || !get(aIt, aEnd, type) ||
+        !get(aIt, aEnd, aCommand.userId))
+    {
+      return false;
+    }
+
+    aCommand.type = static_cast<JournalCommand::Type>(type);
+    switch (aCommand.type)
+    {
+      case JournalCommand::Type::Register:
+      {
+        uint32_t size;
+        if (!get(aIt, aEnd, size) || static_cast<size_t>(aEnd - aIt) < size)
+        {
+          return false;
+        }
+        aCommand.name.assign(aIt, size);
+        return true;
+      }
+      case JournalCommand::Type::PlaceOrder:
+      {
+        uint8_t isBuy;
+        if (!get(aIt, aEnd, aCommand.amount) || !get(aIt, aEnd, aCommand.price) ||
+            !get(aIt, aEnd, isBuy))
+        {
+          return false;
+        }
+        aCommand.isBuy = isBuy != 0;
+
+        // Старые записи заканчиваются раньше: недостающие поля остаются
+        // по умолчанию (лимитная бессрочная видимая заявка, не стоп, инструмент 0)
+        uint8_t orderType = static_cast<uint8_t>(OrderType::Limit);
+        if (aIt != aEnd && !get(aIt, aEnd, orderType))
+        {
+          return false;
+        }
+        aCommand.orderType = static_cast<OrderType>(orderType);
+        return (aIt == aEnd || get(aIt, aEnd, aCommand.expireMs)) &&
+               (aIt == aEnd || get(aIt, aEnd, aCommand.stopPrice)) &&
+               (aIt == aEnd || get(aIt, aEnd, aCommand.displayAmount)) &&
+               (aIt == aEnd || get(aIt, aEnd, aCommand.instrument));
+      }
+      case JournalCommand::Type::Cancel:
+        return get(aIt, aEnd, aCommand.quote);
+      case JournalCommand::Type::Expire:
+        return get(aIt, aEnd, aCommand.orderId);
+      case JournalCommand::Type::Amend:
+        return get(aIt, aEnd, aCommand.orderId) && get(aIt, aEnd, aCommand.amount) &&
+               get(aIt, aEnd, aCommand.price);
+      case JournalCommand::Type::MassQuote:
+      {
+        uint8_t replace;
+        uint32_t count;
+        if (!get(aIt, aEnd, replace) || !get(aIt, aEnd, count))
+        {
+          return false;
+        }
+        aCommand.replaceBuys = (replace & 1) != 0;
+        aCommand.replaceSells = (replace & 2) != 0;
+
+        aCommand.quotes.resize(count);
+        for (QuoteEntry& quote : aCommand.quotes)
+        {
+          uint8_t isBuy;
+          if (!get(aIt, aEnd, quote.amount) || !get(aIt, aEnd, quote.price) ||
+              !get(aIt, aEnd, isBuy))
+          {
+            return false;
+          }
+          quote.isBuy = isBuy != 0;
+        }
+        return aIt == aEnd || get(aIt, aEnd, aCommand.instrument);
+      }
+      case JournalCommand::Type::MassCancel:
+      {
+        uint8_t flags;
+        if (!get(aIt, aEnd, flags) || !get(aIt, aEnd, aCommand.filter.minPrice) ||
+            !get(aIt, aEnd, aCommand.filter.maxPrice))
+        {
+          return false;
+        }
+        aCommand.filter.buys = (flags & 1) != 0;
+        aCommand.filter.sells = (flags & 2) != 0;
+        aCommand.filter.stops = (flags & 4) != 0;
+        // В старых записях инструмента нет: снимались заявки всех инструментов
+        return aIt == aEnd || get(aIt, aEnd, aCommand.filter.instrument);
+      }
+      case JournalCommand::Type::Block:
+      {
+        uint8_t block;
+        if (!get(aIt, aEnd, block))
+        {
+          return false;
+        }
+        aCommand.block = block != 0;
+        // В старых записях инструмента нет: снимались заявки всех инструментов
+        return aIt == aEnd || get(aIt, aEnd, aCommand.filter.instrument);
+      }
+      case JournalCommand::Type::CancelOrders:
+      {
+        uint32_t count;
+        if (!get(aIt, aEnd, count))
+        {
+          return false;
+        }
+        aCommand.orderIds.resize(count);
+        for (uint64_t& id : aCommand.orderIds)
+        {
+          if (!get(aIt, aEnd, id))
+          {
+            return false;
+          }
+        }
+        return true;
+      }
+      case JournalCommand::Type::Deposit:
+      {
+        return get(aIt, aEnd, aCommand.asset) && get(aIt, aEnd, aCommand.amount);
+      }
+    }
+
+    return false;
+  }
+
+  // Читает записи с начала файла. Возвращает длину корректной части,
+  // в aLastSeq - номер последней команды. Отбрасывается только оборванный хвост:
+  // недописанная запись в конце файла или последняя запись с неверной суммой.
+  // Поврежденная запись посреди файла и запись неизвестного типа (журнал более
+  // новой версии) - ошибка: отрезав их, мы потеряли бы все следующие команды.
+  uint64_t scan(const std::string& aPath, const Journal::Handler& aHandler,
+      uint64_t& aLastSeq)
+  {
+    aLastSeq = 0;
+    std::ifstream in(aPath, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+      return 0;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    uint64_t validBytes = 0;
+    std::vector<char> body;
+    char header[kHeaderSize];
+    while (in.read(header, kHeaderSize))
+    {
+      uint32_t bodySize, sum;
+      std::memcpy(&bodySize, header, sizeof(bodySize));
+      std::memcpy(&sum, header + sizeof(bodySize), sizeof(sum));
+      const uint64_t recordEnd = validBytes + kHeaderSize + bodySize;
+      if (recordEnd > fileSize)
+      {
+        // Запись не дописана
+        break;
+      }
+      if (bodySize > kMaxBodySize)
+      {
+        throw std::runtime_error("Corrupted journal " + aPath + " at offset " +
+            std::to_string(validBytes));
+      }
+
+      body.resize(bodySize);
+      if (!in.read(body.data(), bodySize))
+      {
+        break;
+      }
+      if (checksum(body.data(), bodySize) != sum)
+      {
+        if (recordEnd == fileSize)
+        {
+          break;
+        }
+        throw std::runtime_error("Corrupted journal " + aPath + " at offset " +
+            std::to_string(validBytes));
+      }
+
+      // Сумма сошлась, значит запись целая, но эта версия ее не понимает
+      JournalCommand command;
+      if (!decode(body.data(), body.data() + bodySize, command))
+      {
+        throw std::runtime_error("Unknown journal record in " + aPath + " at offset " +
+            std::to_string(validBytes));
+      }
+
+      if (aHandler)
+      {
+        aHandler(command);
+      }
+      aLastSeq = command.seq;
+      validBytes = recordEnd;
+    }
+
+    return validBytes;
+  }
+} // namespace
+
+Journal::Journal(const std::string& aPath, const Options& aOptions, const Handler& aHandler)
+  : mOptions{aOptions}
+{
+  const uint64_t validBytes = scan(aPath, aHandler, mLastSeq);
+  mDurableSeq = mLastSeq;
+
+  mFd = ::open(aPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (mFd < 0)
+  {
+    throw std::runtime_error("Could not open journal " + aPath);
+  }
+  if (::ftruncate(mFd, validBytes) != 0)
+  {
+    ::close(mFd);
+    throw std::runtime_error("Could not truncate journal " + aPath);
+  }
+
+  mWriter = std::thread(&Journal::WriterLoop, this);
+}
+
+Journal::~Journal()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWriterCv.notify_one();
+  mWriter.join();
+  ::close(mFd);
+}
+
+uint64_t Journal::Append(JournalCommand aCommand)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  aCommand.seq = ++mLastSeq;
+
+  if (mPending.empty())
+  {
+    mFirstPending = std::chrono::steady_clock::now();
+    mWriterCv.notify_one();
+  }
+
+  encode(aCommand, mPending);
+  if (mPending.size() >= mOptions.groupBytes)
+  {
+    mWriterCv.notify_one();
+  }
+
+  return aCommand.seq;
+}
+
+void Journal::WaitDurable(uint64_t aSeq)
+{
+  std::unique_lock<std::mutex> lock(mMutex);
+  mDurableCv.wait(lock, [&] { return mDurableSeq >= aSeq; });
+}
+
+uint64_t Journal::GetLastSeq()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mLastSeq;
+}
+
+uint64_t Journal::GetDurableSeq()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mDurableSeq;
+}
+
+uint64_t Journal::Replay(const std::string& aPath, const Handler& aHandler)
+{
+  uint64_t lastSeq;
+  scan(aPath, aHandler, lastSeq);
+  return lastSeq;
+}
+
+void Journal::WriterLoop()
+{
+  std::vector<char> batch;
+  std::unique_lock<std::mutex> lock(mMutex);
+
+  while (true)
+  {
+    mWriterCv.wait(lock, [&] { return mStop || !mPending.empty(); });
+    if (mPending.empty())
+    {
+      break;
+    }
+
+    // Копим пачку до порога по размеру или по времени
+    mWriterCv.wait_until(lock, mFirstPending + mOptions.groupDelay,
+        [&] { return mStop || mPending.size() >= mOptions.groupBytes; });
+
+    batch.swap(mPending);
+    const uint64_t batchSeq = mLastSeq;
+    lock.unlock();
+
+    size_t written = 0;
+    while (written < batch.size())
+    {
+      const ssize_t n = ::write(mFd, batch.data() + written, batch.size() - written);
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n < 0)
+      {
+        // Журнал, который нельзя дописать, хуже остановки сервера
+        std::cerr << "Journal write failed: " << std::strerror(errno) << std::endl;
+        std::abort();
+      }
+      written += static_cast<size_t>(n);
+    }
+    if (::fdatasync(mFd) != 0)
+    {
+      std::cerr << "Journal fsync failed: " << std::strerror(errno) << std::endl;
+      std::abort();
+    }
+    batch.clear();
+
+    lock.lock();
+    mDurableSeq = batchSeq;
+    mDurableCv.notify_all();
+  }
+}
@@ -0,0 +1,151 @@
+#ifndef CLIENSERVERECN_JOURNAL_HPP
+#define CLIENSERVERECN_JOURNAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Asset.hpp"
+#include "OrderBook.hpp"
+
+// Когда клиент получает ответ на команду
+enum class Durability
+{
+  AckBeforeFsync, // сразу, запись на диск догонит позже
+  AckAfterFsync   // только после fsync пачки, в которую попала команда
+};
+
+// Команда, принятая ядром
+struct JournalCommand
+{
+  enum class Type : uint8_t
+  {
+    Register = 1,
+    PlaceOrder = 2,
+    Cancel = 3,
+    Expire = 4,
+    Amend = 5,
+    MassQuote = 6,
+    MassCancel = 7,
+    Block = 8,
+    CancelOrders = 9,
+    Deposit = 10
+  };
+
+  uint64_t seq = 0;
+  Type type = Type::Register;
+  uint64_t userId = 0;
+
+  // Register
+  std::string name;
+
+  // PlaceOrder
+  double amount = 0;
+  double price = 0;
+  bool isBuy = false;
+  OrderType orderType = OrderType::Limit;
+  uint64_t expireMs = 0;
+  double stopPrice = 0;
+  double displayAmount = 0;
+
+  // Cancel
+  int64_t quote = 0;
+
+  // Expire, Amend (вместе с amount и price)
+  uint64_t orderId = 0;
+
+  // MassQuote: какие стороны заменяются и новые котировки
+  bool replaceBuys = false;
+  bool replaceSells = false;
+  std::vector<QuoteEntry> quotes;
+
+  // MassCancel; у Block - только filter.instrument, заявки какого инструмента сняты
+  OrderFilter filter;
+
+  // Block
+  bool block = false;
+
+  // CancelOrders
+  std::vector<uint64_t> orderIds;
+
+  // Deposit (вместе с amount): номер актива
+  AssetId asset = 0;
+
+  // PlaceOrder, MassQuote: номер инструмента
+  uint64_t instrument = 0;
+};
+
+// Журнал упреждающей записи: двоичный файл, в который только дописываются
+// пронумерованные команды. Запись на диск и fsync выполняет отдельный поток
+// пачками (group commit), поэтому Append никогда не ждет диска.
+//
+// Формат записи: uint32 длина тела, uint32 контрольная сумма тела, тело.
+// Оборванный хвост (например, после падения посреди write) при чтении отбрасывается,
+// поврежденная запись посреди файла или запись неизвестного типа - ошибка.
+class Journal
+{
+public:
+  struct Options
+  {
+    Durability durability = Durability::AckBeforeFsync;
+    // Пачка сбрасывается, когда накопилось столько байт...
+    size_t groupBytes = 64 * 1024;
+    // ...или когда первая команда пачки ждет дольше этого
+    std::chrono::microseconds groupDelay {1000};
+  };
+
+  using Handler = std::function<void(const JournalCommand&)>;
+
+  // Проигрывает уже записанные команды через aHandler, отрезает оборванный хвост
+  // и открывает журнал на дозапись. Бросает std::runtime_error, если файл не открыть
+  // или он поврежден не только в хвосте.
+  Journal(const std::string& aPath, const Options& aOptions, const Handler& aHandler = {});
+  ~Journal();
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  // Присваивает команде очередной номер и ставит ее в очередь на запись.
+  // Возвращает присвоенный номер.
+  uint64_t Append(JournalCommand aCommand);
+
+  // Блокирует вызывающий поток, пока команда aSeq не окажется на диске.
+  void WaitDurable(uint64_t aSeq);
+
+  Durability GetDurability() const { return mOptions.durability; }
+
+  // Номер последней принятой команды
+  uint64_t GetLastSeq();
+  // Номер последней команды, уже записанной на диск
+  uint64_t GetDurableSeq();
+
+  // Читает журнал и передает команды в aHandler по порядку.
+  // Возвращает номер последней прочитанной команды (0, если файла нет).
+  // Бросает std::runtime_error, если журнал поврежден не только в хвосте.
+  static uint64_t Replay(const std::string& aPath, const Handler& aHandler);
+
+private:
+  void WriterLoop();
+
+private:
+  Options mOptions;
+  int mFd;
+
+  std::mutex mMutex;
+  std::condition_variable mWriterCv;
+  std::condition_variable mDurableCv;
+  std::vector<char> mPending;
+  uint64_t mLastSeq;
+  uint64_t mDurableSeq;
+  std::chrono::steady_clock::time_point mFirstPending;
+  bool mStop = false;
+
+  std::thread mWriter;
+};
+
+#endif //CLIENSERVERECN_JOURNAL_HPP
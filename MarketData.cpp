@@ -0,0 +1,144 @@
+#include "MarketData.hpp"
+
+#include <algorithm>
+
+market_data_channel::market_data_channel(Core& core, poster post)
+    : core_(core), post_(std::move(post))
+{
+}
+
+void market_data_channel::subscribe(const market_data_subscriber_ptr& subscriber)
+{
+    core_.GetMarketDataSnapshot([&](const std::vector<LevelUpdate>& levels)
+    {
+        const uint64_t seq = seq_;
+        nlohmann::json snapshot;
+        snapshot["Type"] = "Snapshot";
+        snapshot["Seq"] = seq;
+        snapshot["Levels"] = levels_json(core_, levels);
+
+        subscribers_.insert(subscriber);
+        subscriber->deliver_snapshot(
+            std::make_shared<const std::string>(snapshot.dump() + "\n"), seq);
+    });
+}
+
+void market_data_channel::unsubscribe(const market_data_subscriber_ptr& subscriber)
+{
+    subscribers_.erase(subscriber);
+}
+
+void market_data_channel::OnMarketData(const std::vector<LevelUpdate>& levels,
+    const std::vector<Trade>& trades)
+{
+    const uint64_t seq = ++seq_;
+    if (!post_)
+    {
+        publish(levels, trades, seq);
+        return;
+    }
+    post_([this, levels, trades, seq]() { publish(levels, trades, seq); });
+}
+
+void market_data_channel::publish(const std::vector<LevelUpdate>& levels,
+    const std::vector<Trade>& trades, uint64_t seq)
+{
+    if (subscribers_.empty())
+    {
+        return;
+    }
+
+    nlohmann::json update;
+    update["Type"] = "Update";
+    update["Seq"] = seq;
+    update["Levels"] = levels_json(core_, levels);
+    update["Trades"] = trades_json(core_, trades);
+    const auto message = std::make_shared<const std::string>(update.dump() + "\n");
+
+    for (const market_data_subscriber_ptr& subscriber : subscribers_)
+    {
+        subscriber->deliver_market_data(message, levels, trades, seq);
+    }
+}
+
+bool market_data_conflator::offer(const std::vector<LevelUpdate>& levels,
+    const std::vector<Trade>& trades, uint64_t seq, size_t queued)
+{
+    // Обновление успело войти в снимок, пока ждало потока подписчиков
+    if (seq <= snapshot_seq_)
+    {
+        return false;
+    }
+    if (empty() && queued < max_queued)
+    {
+        return true;
+    }
+
+    for (const LevelUpdate& level : levels)
+    {
+        levels_[std::make_tuple(level.instrument, level.isBuy, level.price)] = level;
+    }
+    // Сделки не сливаются, поэтому храним только последние
+    trades_.insert(trades_.end(), trades.begin(), trades.end());
+    if (trades_.size() > max_trades)
+    {
+        trades_.erase(trades_.begin(), trades_.end() - max_trades);
+    }
+    seq_ = std::max(seq_, seq);
+    return false;
+}
+
+std::shared_ptr<const std::string> market_data_conflator::take(const Core& core)
+{
+    if (empty())
+    {
+        return nullptr;
+    }
+
+    std::vector<LevelUpdate> levels;
+    levels.reserve(levels_.size());
+    for (const auto& level : levels_)
+    {
+        levels.push_back(level.second);
+    }
+
+    nlohmann::json update;
+    update["Type"] = "Update";
+    update["Seq"] = seq_;
+    update["Conflated"] = true;
+    update["Levels"] = levels_json(core, levels);
+    update["Trades"] = trades_json(core, trades_);
+
+    levels_.clear();
+    trades_.clear();
+    return std::make_shared<const std::string>(update.dump() + "\n");
+}
+
+nlohmann::json levels_json(const Core& core, const std::vector<LevelUpdate>& levels)
+{
+    nlohmann::json result = nlohmann::json::array();
+    for (const LevelUpdate& level : levels)
+    {
+        result.push_back({
+            {"Instrument", core.GetInstrumentSymbol(level.instrument)},
+            {"Side", level.isBuy ? "BUY" : "SELL"},
+            {"Price", level.price},
+            {"Amount", level.total},
+            {"Orders", level.count}});
+    }
+    return result;
+}
+
+nlohmann::json trades_json(const Core& core, const std::vector<Trade>& trades)
+{
+    nlohmann::json result = nlohmann::json::array();
+    for (const Trade& trade : trades)
+    {
+        result.push_back({
+            {"Instrument", core.GetInstrumentSymbol(trade.instrument)},
+            {"Price", trade.price},
+            {"Amount", trade.amount},
+            {"Time", trade.timeNs}});
+    }
+    return result;
+}
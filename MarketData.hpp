@@ -0,0 +1,102 @@
+#ifndef CLIENSERVERECN_MARKETDATA_HPP
+#define CLIENSERVERECN_MARKETDATA_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "json.hpp"
+#include "Core.hpp"
+
+// Получатель рыночных данных (сессия клиента)
+class market_data_subscriber
+{
+public:
+    virtual ~market_data_subscriber() = default;
+
+    // Снимок всех уровней стаканов с номером seq
+    virtual void deliver_snapshot(const std::shared_ptr<const std::string>& message,
+        uint64_t seq) = 0;
+
+    // Обновление с номером seq: message - готовый текст, levels и trades - его
+    // содержимое для слияния
+    virtual void deliver_market_data(const std::shared_ptr<const std::string>& message,
+        const std::vector<LevelUpdate>& levels, const std::vector<Trade>& trades,
+        uint64_t seq) = 0;
+};
+
+typedef std::shared_ptr<market_data_subscriber> market_data_subscriber_ptr;
+
+// Канал рыночных данных.
+// Подписчик получает снимок всех уровней стаканов, затем изменения уровней и сделки
+// каждой команды. Сообщения нумеруются; одно обновление сериализуется один раз
+// и рассылается всем подписчикам общим буфером. Номер присваивается под блокировкой
+// инструмента, поэтому обновления одного инструмента приходят по возрастанию
+// номеров; обновления с номером не больше номера снимка в снимок уже вошли.
+class market_data_channel : public CoreListener
+{
+public:
+    // Переносит рассылку в поток подписчиков (поток ввода-вывода сервера)
+    using poster = std::function<void(const std::function<void()>&)>;
+
+    // Без post рассылка идет прямо в потоке команды
+    explicit market_data_channel(Core& core, poster post = {});
+
+    // Подписки меняются в потоке подписчиков
+    void subscribe(const market_data_subscriber_ptr& subscriber);
+    void unsubscribe(const market_data_subscriber_ptr& subscriber);
+
+    void OnMarketData(const std::vector<LevelUpdate>& levels,
+        const std::vector<Trade>& trades) override;
+
+private:
+    void publish(const std::vector<LevelUpdate>& levels, const std::vector<Trade>& trades,
+        uint64_t seq);
+
+    Core& core_;
+    poster post_;
+    std::set<market_data_subscriber_ptr> subscribers_;
+    std::atomic<uint64_t> seq_ {0};
+};
+
+// Слияние рыночных данных для подписчика, который не успевает их забирать:
+// обновления не копятся в очереди, по каждому уровню остается только последнее
+// состояние, из сделок - последние max_trades.
+class market_data_conflator
+{
+public:
+    // Сколько сообщений может ждать отправки, прежде чем обновления начнут сливаться
+    enum { max_queued = 64 };
+    enum { max_trades = 256 };
+
+    // Запоминает номер полученного снимка: более ранние обновления в него уже вошли
+    void on_snapshot(uint64_t seq) { snapshot_seq_ = seq; }
+
+    // Решает судьбу обновления seq при queued сообщениях в очереди подписчика.
+    // Возвращает true, если обновление надо отправить как есть; иначе оно
+    // отброшено (уже в снимке) или слито с накопленным.
+    bool offer(const std::vector<LevelUpdate>& levels, const std::vector<Trade>& trades,
+        uint64_t seq, size_t queued);
+
+    bool empty() const { return levels_.empty() && trades_.empty(); }
+
+    // Накопленное слитое обновление одним сообщением; nullptr, если сливать нечего
+    std::shared_ptr<const std::string> take(const Core& core);
+
+private:
+    std::map<std::tuple<size_t, bool, double>, LevelUpdate> levels_;
+    std::vector<Trade> trades_;
+    uint64_t seq_ = 0;
+    uint64_t snapshot_seq_ = 0;
+};
+
+nlohmann::json levels_json(const Core& core, const std::vector<LevelUpdate>& levels);
+nlohmann::json trades_json(const Core& core, const std::vector<Trade>& trades);
+
+#endif //CLIENSERVERECN_MARKETDATA_HPP
@@ -0,0 +1,130 @@
+#include "MarketStats.hpp"
+
+#include <algorithm>
+
+namespace
+{
+  constexpr int64_t kNsPerSecond = 1000000000;
+  constexpr int64_t kNsPerMinute = 60 * kNsPerSecond;
+} // namespace
+
+MarketStats::MarketStats()
+  : mDay(kMinutesPerDay)
+{
+  // Сколько свечей каждого разрешения помним: минуту секундных,
+  // час минутных и сутки часовых
+  mRings[Second].periodNs = kNsPerSecond;
+  mRings[Second].candles.resize(60);
+  mRings[Minute].periodNs = kNsPerMinute;
+  mRings[Minute].candles.resize(60);
+  mRings[Hour].periodNs = 60 * kNsPerMinute;
+  mRings[Hour].candles.resize(24);
+}
+
+void MarketStats::OnTrade(double aPrice, double aAmount, int64_t aTimeNs)
+{
+  mLastPrice = aPrice;
+
+  for (CandleRing& ring : mRings)
+  {
+    const int64_t start = aTimeNs / ring.periodNs * ring.periodNs;
+    Candle* last = ring.count > 0 ?
+        &ring.candles[(ring.count - 1) % ring.candles.size()] : nullptr;
+
+    if (last && last->startNs == start)
+    {
+      last->high = std::max(last->high, aPrice);
+      last->low = std::min(last->low, aPrice);
+      last->close = aPrice;
+      last->volume += aAmount;
+    }
+    else if (!last || start > last->startNs)
+    {
+      ring.candles[ring.count++ % ring.candles.size()] =
+          Candle{start, aPrice, aPrice, aPrice, aPrice, aAmount};
+    }
+  }
+
+  Expire(aTimeNs);
+  const int64_t minute = aTimeNs / kNsPerMinute;
+  if (minute < mOldestMinute)
+  {
+    return;
+  }
+
+  MinuteBucket& bucket = mDay[minute % kMinutesPerDay];
+  if (bucket.minute != minute)
+  {
+    bucket = MinuteBucket{minute, 0, 0};
+  }
+  bucket.volume += aAmount;
+  bucket.notional += aAmount * aPrice;
+  mDayVolume += aAmount;
+  mDayNotional += aAmount * aPrice;
+}
+
+double MarketStats::GetVolume24h(int64_t aNowNs)
+{
+  Expire(aNowNs);
+  return mDayVolume;
+}
+
+double MarketStats::GetVwap24h(int64_t aNowNs)
+{
+  Expire(aNowNs);
+  return mDayVolume > 0 ? mDayNotional / mDayVolume : 0;
+}
+
+std::vector<Candle> MarketStats::GetCandles(Resolution aResolution) const
+{
+  const CandleRing& ring = mRings[aResolution];
+  const size_t size = std::min(ring.count, ring.candles.size());
+
+  std::vector<Candle> candles;
+  candles.reserve(size);
+  for (size_t i = ring.count - size; i < ring.count; ++i)
+  {
+    candles.push_back(ring.candles[i % ring.candles.size()]);
+  }
+
+  return candles;
+}
+
+// Вычитает из окна минуты старше 24 часов. Каждая минута вычитается один раз,
+// поэтому в среднем это O(1) на вызов.
+void MarketStats::Expire(int64_t aNowNs)
+{
+  const int64_t windowStart = aNowNs / kNsPerMinute - static_cast<int64_t>(kMinutesPerDay) + 1;
+  if (windowStart <= mOldestMinute)
+  {
+    return;
+  }
+
+  if (windowStart - mOldestMinute >= static_cast<int64_t>(kMinutesPerDay))
+  {
+    std::fill(mDay.begin(), mDay.end(), MinuteBucket{});
+    mDayVolume = 0;
+    mDayNotional = 0;
+  }
+  else
+  {
+    for (int64_t minute = mOldestMinute; minute < windowStart; ++minute)
+    {
+      MinuteBucket& bucket = mDay[minute % kMinutesPerDay];
+      if (bucket.minute == minute)
+      {
+        mDayVolume -= bucket.volume;
+        mDayNotional -= bucket.notional;
+        bucket = MinuteBucket{};
+      }
+    }
+  }
+
+  mOldestMinute = windowStart;
+  if (mDayVolume < 1e-9)
+  {
+    // Окно опустело, сбрасываем накопленную ошибку округления
+    mDayVolume = 0;
+    mDayNotional = 0;
+  }
+}
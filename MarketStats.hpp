@@ -0,0 +1,81 @@
+#ifndef CLIENSERVERECN_MARKETSTATS_HPP
+#define CLIENSERVERECN_MARKETSTATS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Свеча OHLCV
+struct Candle
+{
+  int64_t startNs = 0;
+  double open = 0;
+  double high = 0;
+  double low = 0;
+  double close = 0;
+  double volume = 0;
+};
+
+// Рыночная статистика, которая обновляется за O(1) на каждую сделку:
+// свечи 1s/1m/1h, последняя цена, объем и VWAP за скользящие 24 часа.
+class MarketStats
+{
+public:
+  enum Resolution
+  {
+    Second,
+    Minute,
+    Hour,
+
+    ResolutionCount
+  };
+
+  MarketStats();
+
+  void OnTrade(double aPrice, double aAmount, int64_t aTimeNs);
+
+  // Цена последней сделки, 0 - сделок не было
+  double GetLastPrice() const { return mLastPrice; }
+
+  // Объем и VWAP за 24 часа до aNowNs
+  double GetVolume24h(int64_t aNowNs);
+  double GetVwap24h(int64_t aNowNs);
+
+  // Последние свечи разрешения aResolution, от старых к новым
+  std::vector<Candle> GetCandles(Resolution aResolution) const;
+
+private:
+  // Кольцо последних свечей одного разрешения
+  struct CandleRing
+  {
+    int64_t periodNs;
+    std::vector<Candle> candles;
+    // Число свечей за все время, последняя лежит в candles[(count - 1) % size]
+    size_t count = 0;
+  };
+
+  // Поминутная корзина скользящего окна 24 часа
+  struct MinuteBucket
+  {
+    int64_t minute = -1;
+    double volume = 0;
+    double notional = 0;
+  };
+
+  void Expire(int64_t aNowNs);
+
+private:
+  static constexpr size_t kMinutesPerDay = 24 * 60;
+
+  double mLastPrice = 0;
+  std::array<CandleRing, ResolutionCount> mRings;
+
+  std::vector<MinuteBucket> mDay;
+  // Самая старая минута, которая еще может лежать в окне
+  int64_t mOldestMinute = 0;
+  double mDayVolume = 0;
+  double mDayNotional = 0;
+};
+
+#endif //CLIENSERVERECN_MARKETSTATS_HPP
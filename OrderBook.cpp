@@ -0,0 +1,270 @@
+#include "OrderBook.hpp"
+
+namespace
+{
+  // Сколько разных глубин стакана держим в кеше одновременно
+  constexpr size_t kMaxDepthCaches = 8;
+} // namespace
+
+OrderBook::OrderBook()
+  : mBids(BetterPrice{true}), mAsks(BetterPrice{false})
+{
+}
+
+void OrderBook::Add(const Order& aOrder)
+{
+  const auto levelIt = GetSide(aOrder.isBuy).try_emplace(aOrder.price).first;
+  PriceLevel& level = levelIt->second;
+  level.orders.push_back(aOrder);
+  level.total += aOrder.amount;
+  level.hidden += aOrder.hidden;
+  ++level.count;
+  PriceLevel::UserVolume& user = level.users[aOrder.userId];
+  user.volume += aOrder.amount + aOrder.hidden;
+  ++user.count;
+
+  mOrders.emplace(aOrder.id, Locator{aOrder.isBuy, levelIt, std::prev(level.orders.end())});
+  mUserOrders[aOrder.userId].insert(aOrder.id);
+  OnLevelChanged(aOrder.isBuy, aOrder.price);
+}
+
+bool OrderBook::Remove(uint64_t aOrderId)
+{
+  const auto locatorIt = mOrders.find(aOrderId);
+  if (locatorIt == mOrders.end())
+  {
+    return false;
+  }
+
+  const Locator locator = locatorIt->second;
+  const double price = locator.level->first;
+  PriceLevel& level = locator.level->second;
+
+  level.total -= locator.it->amount;
+  level.hidden -= locator.it->hidden;
+  --level.count;
+  RemoveUserVolume(level, *locator.it);
+  Unindex(*locator.it);
+  level.orders.erase(locator.it);
+  if (level.orders.empty())
+  {
+    GetSide(locator.isBuy).erase(locator.level);
+  }
+
+  OnLevelChanged(locator.isBuy, price);
+  return true;
+}
+
+bool OrderBook::Reduce(uint64_t aOrderId, double aAmount)
+{
+  const auto locatorIt = mOrders.find(aOrderId);
+  if (locatorIt == mOrders.end())
+  {
+    return false;
+  }
+
+  const Locator& locator = locatorIt->second;
+  Order& order = *locator.it;
+  if (aAmount <= 0 || aAmount >= order.amount + order.hidden)
+  {
+    return false;
+  }
+
+  PriceLevel& level = locator.level->second;
+  level.users.find(order.userId)->second.volume -= order.amount + order.hidden - aAmount;
+  const double hiddenCut = std::min(order.hidden, order.amount + order.hidden - aAmount);
+  order.hidden -= hiddenCut;
+  level.hidden -= hiddenCut;
+  level.total -= order.amount - (aAmount - order.hidden);
+  order.amount = aAmount - order.hidden;
+
+  OnLevelChanged(locator.isBuy, locator.level->first);
+  return true;
+}
+
+const Order* OrderBook::Find(uint64_t aOrderId) const
+{
+  const auto locatorIt = mOrders.find(aOrderId);
+  return locatorIt == mOrders.end() ? nullptr : &*locatorIt->second.it;
+}
+
+bool OrderBook::CanFill(const Order& aOrder) const
+{
+  const Side& opp = GetSide(!aOrder.isBuy);
+
+  double available = 0;
+  for (auto levelIt = opp.begin();
+       levelIt != opp.end() && !BetterPrice{aOrder.isBuy}(levelIt->first, aOrder.price);
+       ++levelIt)
+  {
+    const PriceLevel& level = levelIt->second;
+    available += level.total + level.hidden;
+    const auto userIt = level.users.find(aOrder.userId);
+    if (userIt != level.users.end())
+    {
+      available -= userIt->second.volume;
+    }
+    if (available >= aOrder.amount)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+size_t OrderBook::CountUserOrders(uint64_t aUserId) const
+{
+  const auto userIt = mUserOrders.find(aUserId);
+  return userIt == mUserOrders.end() ? 0 : userIt->second.size();
+}
+
+std::vector<const Order*> OrderBook::GetUserOrders(uint64_t aUserId) const
+{
+  std::vector<const Order*> orders;
+  const auto userIt = mUserOrders.find(aUserId);
+  if (userIt == mUserOrders.end())
+  {
+    return orders;
+  }
+
+  orders.reserve(userIt->second.size());
+  for (uint64_t id : userIt->second)
+  {
+    orders.push_back(Find(id));
+  }
+
+  // Номера заявок растут со временем, а внутри уровня очередь идет по времени
+  std::sort(orders.begin(), orders.end(), [](const Order* aLeft, const Order* aRight)
+  {
+    return UserOrderLess(*aLeft, *aRight);
+  });
+
+  return orders;
+}
+
+bool OrderBook::UserOrderLess(const Order& aLeft, const Order& aRight)
+{
+  if (aLeft.isBuy != aRight.isBuy)
+  {
+    return aLeft.isBuy;
+  }
+  if (aLeft.price != aRight.price)
+  {
+    return BetterPrice{aLeft.isBuy}(aLeft.price, aRight.price);
+  }
+  return aLeft.id < aRight.id;
+}
+
+const std::vector<LevelUpdate>& OrderBook::GetDepth(size_t aLevels)
+{
+  DepthCache& cache = mDepth[aLevels];
+  if (cache.valid)
+  {
+    return cache.levels;
+  }
+  cache.levels.clear();
+
+  // Продажи сверху, от худшей цены к лучшей, затем покупки от лучшей к худшей
+  std::vector<Side::const_iterator> asks;
+  for (auto it = mAsks.cbegin(); it != mAsks.cend() && asks.size() < aLevels; ++it)
+  {
+    asks.push_back(it);
+  }
+  for (auto it = asks.rbegin(); it != asks.rend(); ++it)
+  {
+    cache.levels.push_back(LevelUpdate{false, (*it)->first, (*it)->second.total,
+        (*it)->second.count});
+  }
+
+  size_t bids = 0;
+  for (auto it = mBids.cbegin(); it != mBids.cend() && bids < aLevels; ++it, ++bids)
+  {
+    cache.levels.push_back(LevelUpdate{true, it->first, it->second.total, it->second.count});
+    cache.worstBid = it->first;
+  }
+
+  cache.asksFull = asks.size() == aLevels;
+  cache.worstAsk = asks.empty() ? 0 : asks.back()->first;
+  cache.bidsFull = bids == aLevels;
+  cache.valid = true;
+
+  return cache.levels;
+}
+
+std::vector<LevelUpdate> OrderBook::GetLevels() const
+{
+  std::vector<LevelUpdate> levels;
+  levels.reserve(mBids.size() + mAsks.size());
+  for (bool isBuy : {true, false})
+  {
+    for (const auto& [price, level] : GetSide(isBuy))
+    {
+      levels.push_back(LevelUpdate{isBuy, price, level.total, level.count});
+    }
+  }
+
+  return levels;
+}
+
+void OrderBook::TakeChangedLevels(std::vector<LevelUpdate>& aOut)
+{
+  std::sort(mChangedLevels.begin(), mChangedLevels.end());
+  mChangedLevels.erase(std::unique(mChangedLevels.begin(), mChangedLevels.end()),
+      mChangedLevels.end());
+
+  for (const auto& [isBuy, price] : mChangedLevels)
+  {
+    const Side& side = GetSide(isBuy);
+    const auto levelIt = side.find(price);
+    aOut.push_back(levelIt == side.end() ?
+        LevelUpdate{isBuy, price, 0, 0} :
+        LevelUpdate{isBuy, price, levelIt->second.total, levelIt->second.count});
+  }
+  mChangedLevels.clear();
+}
+
+void OrderBook::Unindex(const Order& aOrder)
+{
+  mOrders.erase(aOrder.id);
+
+  const auto userIt = mUserOrders.find(aOrder.userId);
+  userIt->second.erase(aOrder.id);
+  if (userIt->second.empty())
+  {
+    mUserOrders.erase(userIt);
+  }
+}
+
+void OrderBook::RemoveUserVolume(PriceLevel& aLevel, const Order& aOrder)
+{
+  const auto userIt = aLevel.users.find(aOrder.userId);
+  userIt->second.volume -= aOrder.amount + aOrder.hidden;
+  if (--userIt->second.count == 0)
+  {
+    aLevel.users.erase(userIt);
+  }
+}
+
+// Запоминает изменение уровня и сбрасывает закешированные стаканы, в которые он попадает
+void OrderBook::OnLevelChanged(bool isBuy, double aPrice)
+{
+  mChangedLevels.emplace_back(isBuy, aPrice);
+
+  if (mDepth.size() > kMaxDepthCaches)
+  {
+    mDepth.clear();
+    return;
+  }
+
+  const BetterPrice better {isBuy};
+  for (auto& [levels, cache] : mDepth)
+  {
+    const bool full = isBuy ? cache.bidsFull : cache.asksFull;
+    const double worst = isBuy ? cache.worstBid : cache.worstAsk;
+    if (cache.valid && (!full || !better(worst, aPrice)))
+    {
+      cache.valid = false;
+    }
+  }
+}
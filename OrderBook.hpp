@@ -0,0 +1,279 @@
+#ifndef CLIENSERVERECN_ORDERBOOK_HPP
+#define CLIENSERVERECN_ORDERBOOK_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <map>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Тип заявки по поведению неисполненного остатка
+enum class OrderType : uint8_t
+{
+  Limit = 0,             // остаток встает в стакан
+  Market = 1,            // исполняется по любой цене, остаток снимается
+  ImmediateOrCancel = 2, // исполняется в пределах цены, остаток снимается
+  FillOrKill = 3         // исполняется целиком или не исполняется вовсе
+};
+
+struct Order
+{
+  uint64_t id;
+  uint64_t userId;
+  double amount;
+  double price;
+  bool isBuy;
+  // Срок действия, мс с начала эпохи; 0 - до отмены
+  uint64_t expireMs = 0;
+  // Айсберг: видимая часть не больше display, остаток hidden в стакане не виден
+  double display = 0;
+  double hidden = 0;
+
+  Order(uint64_t aId, uint64_t aUserId, double am, double pr, bool buy)
+    : id{aId}, userId{aUserId}, amount{am}, price{pr}, isBuy{buy}
+  {
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const Order& order) {
+    os << order.userId << ' ' << order.amount << ' ' << order.price <<
+      (order.isBuy ? " BUY" : " SELL");
+
+    return os;
+  }
+};
+
+// Котировка в пакете заявок маркет-мейкера
+struct QuoteEntry
+{
+  double amount;
+  double price;
+  bool isBuy;
+};
+
+// Какие заявки пользователя снимать
+struct OrderFilter
+{
+  bool buys = true;
+  bool sells = true;
+  // Диапазон цен заявки, включительно
+  double minPrice = 0;
+  double maxPrice = std::numeric_limits<double>::infinity();
+  // Снимать ли и стоп-заявки
+  bool stops = true;
+  // Номер инструмента; -1 - все инструменты
+  int64_t instrument = -1;
+};
+
+// Ценовой уровень: очередь заявок по времени и агрегаты для стакана
+struct PriceLevel
+{
+  double total = 0;
+  size_t count = 0;
+  // Скрытые остатки айсбергов, в стакане не показываются
+  double hidden = 0;
+  std::list<Order> orders;
+
+  // Полный объем (со скрытыми остатками) и число заявок каждого пользователя
+  // на уровне: проверке FOK не нужно обходить заявки
+  struct UserVolume
+  {
+    double volume = 0;
+    size_t count = 0;
+  };
+  std::unordered_map<uint64_t, UserVolume> users;
+};
+
+// Состояние ценового уровня для рассылки рыночных данных.
+// Нулевой total означает, что уровень исчез.
+struct LevelUpdate
+{
+  bool isBuy;
+  double price;
+  double total;
+  size_t count;
+  // Номер инструмента; заполняет ядро
+  size_t instrument = 0;
+};
+
+// Стакан заявок. Заявки сгруппированы по ценовым уровням, внутри уровня - по времени.
+// Агрегаты уровней поддерживаются при каждом изменении, поэтому стакан L2
+// не требует обхода заявок.
+class OrderBook
+{
+public:
+  // Лучшая цена стороны идет первой
+  struct BetterPrice
+  {
+    bool isBuy;
+
+    bool operator()(double aLeft, double aRight) const
+    {
+      return isBuy ? aLeft > aRight : aLeft < aRight;
+    }
+  };
+
+  using Side = std::map<double, PriceLevel, BetterPrice>;
+
+  OrderBook();
+
+  const Side& GetSide(bool isBuy) const { return isBuy ? mBids : mAsks; }
+
+  // Ставит заявку в конец очереди ее цены
+  void Add(const Order& aOrder);
+
+  // Снимает заявку. Возвращает false, если ее нет в стакане.
+  bool Remove(uint64_t aOrderId);
+
+  const Order* Find(uint64_t aOrderId) const;
+
+  // Уменьшает полный объем заявки (с учетом скрытого остатка айсберга) до aAmount,
+  // сохраняя ее место в очереди. Сначала уменьшается скрытый остаток.
+  // Возвращает false, если заявки нет или aAmount не меньше текущего объема.
+  bool Reduce(uint64_t aOrderId, double aAmount);
+
+  // Сводит aOrder со встречной стороной в порядке приоритета. Свои заявки
+  // пользователя пропускаются. На каждую сделку вызывается
+  // aOnFill(const Order& resting, double amount, double price) после того, как
+  // объемы обеих заявок уменьшены; исполненные встречные заявки снимаются.
+  // Исполненная видимая часть айсберга пополняется из скрытого остатка и уходит
+  // в конец очереди своей цены.
+  template <typename OnFill>
+  void Match(Order& aOrder, OnFill&& aOnFill);
+
+  // Хватит ли встречной ликвидности по цене не хуже aOrder.price, чтобы исполнить
+  // aOrder целиком. Складываются объемы уровней, заявки не обходятся; из каждого
+  // уровня вычитается объем самого пользователя, с которым сделки не будет.
+  bool CanFill(const Order& aOrder) const;
+
+  // Активные заявки пользователя: сначала покупки, затем продажи, каждая сторона
+  // в порядке приоритета
+  std::vector<const Order*> GetUserOrders(uint64_t aUserId) const;
+
+  // Порядок заявок в GetUserOrders
+  static bool UserOrderLess(const Order& aLeft, const Order& aRight);
+
+  // Число активных заявок пользователя, без их обхода
+  size_t CountUserOrders(uint64_t aUserId) const;
+
+  // Стакан L2: до aLevels лучших уровней каждой стороны, продажи от худшей цены
+  // к лучшей, затем покупки от лучшей к худшей. Результат кешируется и собирается
+  // заново, только если изменился один из попавших в него уровней.
+  const std::vector<LevelUpdate>& GetDepth(size_t aLevels);
+
+  // Текущее состояние всех уровней: покупки, затем продажи, от лучшей цены
+  std::vector<LevelUpdate> GetLevels() const;
+
+  // Дописывает в aOut уровни, изменившиеся с прошлого вызова, в их текущем состоянии
+  void TakeChangedLevels(std::vector<LevelUpdate>& aOut);
+
+private:
+  // Где лежит заявка
+  struct Locator
+  {
+    bool isBuy;
+    Side::iterator level;
+    std::list<Order>::iterator it;
+  };
+
+  // Закешированный стакан для одного значения aLevels
+  struct DepthCache
+  {
+    bool valid = false;
+    std::vector<LevelUpdate> levels;
+    // Худшая цена, попавшая в снимок, и заполнена ли сторона до aLevels
+    double worstBid = 0;
+    double worstAsk = 0;
+    bool bidsFull = false;
+    bool asksFull = false;
+  };
+
+  Side& GetSide(bool isBuy) { return isBuy ? mBids : mAsks; }
+
+  void Unindex(const Order& aOrder);
+  // Снимает заявку aOrder с учета объемов пользователя на уровне
+  static void RemoveUserVolume(PriceLevel& aLevel, const Order& aOrder);
+  void OnLevelChanged(bool isBuy, double aPrice);
+
+private:
+  Side mBids;
+  Side mAsks;
+  std::unordered_map<uint64_t, Locator> mOrders;
+  std::unordered_map<uint64_t, std::unordered_set<uint64_t>> mUserOrders;
+  std::map<size_t, DepthCache> mDepth;
+  // Изменившиеся уровни (сторона, цена), возможны повторы
+  std::vector<std::pair<bool, double>> mChangedLevels;
+};
+
+template <typename OnFill>
+void OrderBook::Match(Order& aOrder, OnFill&& aOnFill)
+{
+  Side& opp = GetSide(!aOrder.isBuy);
+  const BetterPrice better {aOrder.isBuy};
+
+  auto levelIt = opp.begin();
+  while (aOrder.amount > 0 && levelIt != opp.end() && !better(levelIt->first, aOrder.price))
+  {
+    const double price = levelIt->first;
+    PriceLevel& level = levelIt->second;
+    bool changed = false;
+
+    auto it = level.orders.begin();
+    while (aOrder.amount > 0 && it != level.orders.end())
+    {
+      if (it->userId == aOrder.userId)
+      {
+        ++it;
+        continue;
+      }
+
+      const double amount = std::min(aOrder.amount, it->amount);
+      aOrder.amount -= amount;
+      it->amount -= amount;
+      level.total -= amount;
+      level.users.find(it->userId)->second.volume -= amount;
+      changed = true;
+
+      aOnFill(*it, amount, price);
+
+      if (it->amount == 0 && it->hidden > 0)
+      {
+        it->amount = std::min(it->display, it->hidden);
+        it->hidden -= it->amount;
+        level.total += it->amount;
+        level.hidden -= it->amount;
+
+        // Пополненная часть теряет приоритет. Если заявка и так последняя,
+        // продолжаем с нее же.
+        const auto next = std::next(it);
+        if (next != level.orders.end())
+        {
+          level.orders.splice(level.orders.end(), level.orders, it);
+          it = next;
+        }
+      }
+      else if (it->amount == 0)
+      {
+        RemoveUserVolume(level, *it);
+        Unindex(*it);
+        it = level.orders.erase(it);
+        --level.count;
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    if (changed)
+    {
+      OnLevelChanged(!aOrder.isBuy, price);
+    }
+    levelIt = level.orders.empty() ? opp.erase(levelIt) : std::next(levelIt);
+  }
+}
+
+#endif //CLIENSERVERECN_ORDERBOOK_HPP
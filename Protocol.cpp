@@ -0,0 +1,525 @@
+#include "Protocol.hpp"
+#include "Common.hpp"
+
+#include <limits>
+#include <sstream>
+
+namespace
+{
+    void remove_trailing_zeros(std::string& str)
+    {
+        str.erase(str.find_last_not_of('0') + 1, std::string::npos);
+        str.erase(str.find_last_not_of('.') + 1, std::string::npos);
+    }
+} // namespace
+
+size_t parse_instrument(const Core& core, const nlohmann::json& message)
+{
+    if (!message.contains("Instrument"))
+    {
+        return 0;
+    }
+    const int64_t index = core.GetInstrumentIndex(message["Instrument"].get<std::string>());
+    return index < 0 ? core.GetInstrumentCount() : static_cast<size_t>(index);
+}
+
+size_t split_instrument(const Core& core, std::string& argument)
+{
+    const size_t space = argument.find(' ');
+    if (space == std::string::npos)
+    {
+        return 0;
+    }
+    const int64_t index = core.GetInstrumentIndex(argument.substr(space + 1));
+    argument.erase(space);
+    return index < 0 ? core.GetInstrumentCount() : static_cast<size_t>(index);
+}
+
+bool parse_order_options(const Core& core, const nlohmann::json& order, OrderOptions& options)
+{
+    const std::string type = order.value("Type", OrderTypes::Limit);
+    if (type == OrderTypes::Limit)
+    {
+        options.type = OrderType::Limit;
+    }
+    else if (type == OrderTypes::Market)
+    {
+        options.type = OrderType::Market;
+    }
+    else if (type == OrderTypes::ImmediateOrCancel)
+    {
+        options.type = OrderType::ImmediateOrCancel;
+    }
+    else if (type == OrderTypes::FillOrKill)
+    {
+        options.type = OrderType::FillOrKill;
+    }
+    else
+    {
+        return false;
+    }
+
+    // Срок действия (GTT/GTD), мс с начала эпохи
+    options.expireMs = std::stoull(order.value("ExpireAt", std::string("0")));
+    options.stopPrice = std::stod(order.value("StopPrice", std::string("0")));
+    // Видимая часть айсберга
+    options.displayAmount = std::stod(order.value("Display", std::string("0")));
+    options.instrument = parse_instrument(core, order);
+
+    return true;
+}
+
+mass_quote parse_mass_quote(const Core& core, const nlohmann::json& message)
+{
+    const std::string replace = message.value("Replace", std::string("ALL"));
+    mass_quote result;
+    result.replace_buys = (replace == "ALL" || replace == "BUY");
+    result.replace_sells = (replace == "ALL" || replace == "SELL");
+    for (const auto& quote : message["Quotes"])
+    {
+        result.quotes.push_back(QuoteEntry{std::stod(quote["Amount"].get<std::string>()),
+            std::stod(quote["Price"].get<std::string>()), quote["Side"] == "BUY"});
+    }
+    result.instrument = parse_instrument(core, message);
+    return result;
+}
+
+OrderFilter parse_mass_cancel(const Core& core, const nlohmann::json& message)
+{
+    const std::string side = message.value("Side", std::string("ALL"));
+    OrderFilter filter;
+    filter.buys = (side != "SELL");
+    filter.sells = (side != "BUY");
+    if (message.contains("MinPrice"))
+    {
+        filter.minPrice = std::stod(message["MinPrice"].get<std::string>());
+    }
+    if (message.contains("MaxPrice"))
+    {
+        filter.maxPrice = std::stod(message["MaxPrice"].get<std::string>());
+    }
+    if (message.contains("Instrument"))
+    {
+        filter.instrument = parse_instrument(core, message);
+    }
+    return filter;
+}
+
+std::string status_text(Status status)
+{
+    switch (status)
+    {
+        case Status::Ok:
+            break;
+        case Status::UnknownUser:
+            return "Error! Unknown User\n";
+        case Status::UnknownInstrument:
+            return "Error! Unknown instrument\n";
+        case Status::UnknownOrder:
+            return "Error! Unknown order\n";
+        case Status::UnknownAsset:
+            return "Error. Unknown asset.\n";
+        case Status::InvalidAmount:
+            return "Error. Incorrect USD amount.\n";
+        case Status::InvalidPrice:
+            return "Error. Incorrect USD price.\n";
+        case Status::InvalidStopPrice:
+            return "Error. Incorrect stop price.\n";
+        case Status::InvalidDisplayAmount:
+            return "Error. Incorrect display amount.\n";
+        case Status::ExpiryPassed:
+            return "Error. Order expiry time has already passed.\n";
+        case Status::TradingDisabled:
+            return "Error! Trading is disabled for this user\n";
+        case Status::InsufficientFunds:
+            return "Error. Insufficient funds.\n";
+        case Status::MarketBuyNotAllowed:
+            return "Error. Market buy orders are not accepted with risk checks, use IOC.\n";
+        case Status::TooManyUsers:
+            return "Error! Too many users\n";
+    }
+    return {};
+}
+
+uint64_t parse_user_id(const std::string& user_id)
+{
+    const int64_t id = std::stoll(user_id);
+    return id < 0 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(id);
+}
+
+std::string register_user(Core& core, const std::string& name)
+{
+    uint64_t user_id;
+    const Status status = core.RegisterUser(name, user_id);
+    return status == Status::Ok ? std::to_string(user_id) : status_text(status);
+}
+
+std::string user_name(const Core& core, const std::string& user_id)
+{
+    std::string name;
+    const Status status = core.GetUserName(parse_user_id(user_id), name);
+    return status == Status::Ok ? name : status_text(status);
+}
+
+std::string user_balance(const Core& core, const std::string& user_id)
+{
+    std::vector<AssetBalance> balances;
+    const Status status = core.GetBalances(parse_user_id(user_id), balances);
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+
+    std::string reply;
+    for (const AssetBalance& balance : balances)
+    {
+        std::string amount {std::to_string(balance.amount)};
+        remove_trailing_zeros(amount);
+        reply += core.GetAssetName(balance.asset) + " " + amount + "\n";
+    }
+    return reply;
+}
+
+std::string place_order(Core& core, const std::string& user_id,
+    const std::string& amount, const std::string& price, bool is_buy,
+    const OrderOptions& options, uint64_t* order_id)
+{
+    NewOrderCommand command;
+    command.userId = parse_user_id(user_id);
+    if (!core.IsUser(command.userId))
+    {
+        return status_text(Status::UnknownUser);
+    }
+    command.amount = std::stod(amount);
+    command.price = std::stod(price);
+    command.isBuy = is_buy;
+    command.options = options;
+
+    const OrderResult result = core.Execute(command);
+    if (result.status != Status::Ok)
+    {
+        return status_text(result.status);
+    }
+    if (order_id)
+    {
+        *order_id = result.orderId;
+    }
+
+    if (options.stopPrice > 0)
+    {
+        return "Your stop order was succesfully placed.\n";
+    }
+    if (options.type == OrderType::Limit || result.filled == command.amount)
+    {
+        return "Your order was succesfully placed.\n";
+    }
+    if (result.filled == 0)
+    {
+        return "Your order was not filled and has been cancelled.\n";
+    }
+    return "Your order was partially filled, the rest has been cancelled.\n";
+}
+
+std::string amend_order(Core& core, const std::string& user_id,
+    const std::string& order_id, const std::string& amount, const std::string& price)
+{
+    AmendCommand command;
+    command.userId = parse_user_id(user_id);
+    if (!core.IsUser(command.userId))
+    {
+        return status_text(Status::UnknownUser);
+    }
+    command.amount = std::stod(amount);
+    command.price = std::stod(price);
+    // Проверки объема и цены идут раньше разбора номера заявки
+    if (command.amount > 0 && command.price >= 0)
+    {
+        command.orderId = std::stoull(order_id);
+    }
+
+    const OrderResult result = core.Execute(command);
+    if (result.status != Status::Ok)
+    {
+        return status_text(result.status);
+    }
+    return "Your order was succesfully amended.\n";
+}
+
+std::string place_mass_quote(Core& core, const std::string& user_id,
+    bool replace_buys, bool replace_sells, const std::vector<QuoteEntry>& quotes,
+    std::vector<uint64_t>* order_ids, size_t instrument)
+{
+    MassQuoteCommand command;
+    command.userId = parse_user_id(user_id);
+    command.replaceBuys = replace_buys;
+    command.replaceSells = replace_sells;
+    command.quotes = quotes;
+    command.instrument = instrument;
+
+    const BatchResult result = core.Execute(command, order_ids);
+    if (result.status != Status::Ok)
+    {
+        return status_text(result.status);
+    }
+
+    std::string reply = "Mass quote accepted: " + std::to_string(result.count) +
+        " orders placed.\n";
+    if (result.count != quotes.size())
+    {
+        reply += "Error. Insufficient funds for " + std::to_string(quotes.size() - result.count) +
+            " quotes.\n";
+    }
+    return reply;
+}
+
+std::string mass_cancel(Core& core, const std::string& user_id, const OrderFilter& filter)
+{
+    return mass_cancel_reply(core.Execute(MassCancelCommand{parse_user_id(user_id), filter}));
+}
+
+std::string mass_cancel_reply(const BatchResult& result)
+{
+    if (result.status != Status::Ok)
+    {
+        return status_text(result.status);
+    }
+    return "Cancelled " + std::to_string(result.count) + " orders.\n";
+}
+
+std::string deposit(Core& core, const std::string& user_id, const std::string& asset,
+    const std::string& amount)
+{
+    DepositCommand command;
+    command.userId = parse_user_id(user_id);
+    if (!core.IsUser(command.userId))
+    {
+        return status_text(Status::UnknownUser);
+    }
+    const int64_t asset_id = core.FindAsset(asset);
+    if (asset_id < 0)
+    {
+        return status_text(Status::UnknownAsset);
+    }
+    command.asset = static_cast<AssetId>(asset_id);
+    command.amount = std::stod(amount);
+
+    const Status status = core.Execute(command);
+    if (status == Status::InvalidAmount)
+    {
+        return "Error. Incorrect deposit amount.\n";
+    }
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+    return "Your deposit was succesfully credited.\n";
+}
+
+std::string set_user_blocked(Core& core, const std::string& user_id, bool block)
+{
+    return set_user_blocked_reply(core.Execute(BlockCommand{parse_user_id(user_id), block}),
+        user_id, block);
+}
+
+std::string set_user_blocked_reply(Status status, const std::string& user_id, bool block)
+{
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+    return block ? "Trading is disabled for user " + user_id + ".\n" :
+                   "Trading is enabled for user " + user_id + ".\n";
+}
+
+std::string user_active_quotes(const Core& core, const std::string& user_id)
+{
+    std::vector<ActiveOrder> orders;
+    const Status status = core.GetActiveOrders(parse_user_id(user_id), orders);
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+    if (orders.empty())
+    {
+        return "You have no active quotes.\n";
+    }
+
+    // Заявки нумеруются сквозь все инструменты; при нескольких инструментах
+    // к заявке приписывается ее инструмент
+    const bool named = core.GetInstrumentCount() > 1;
+    std::stringstream ss;
+    int i = 0;
+    for (const ActiveOrder& active : orders)
+    {
+        const Order& o = active.order;
+        ss << ++i << ") " << o;
+        if (active.stopPrice > 0)
+        {
+            ss << " STOP " << active.stopPrice;
+        }
+        else if (o.hidden > 0)
+        {
+            ss << " HIDDEN " << o.hidden;
+        }
+        if (named)
+        {
+            ss << ' ' << core.GetInstrumentSymbol(active.instrument);
+        }
+        ss << '\n';
+    }
+    return ss.str();
+}
+
+std::string user_trades(const Core& core, const std::string& user_id)
+{
+    std::vector<Trade> trades;
+    const Status status = core.GetUserTrades(parse_user_id(user_id), trades);
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+    if (trades.empty())
+    {
+        return "You have no completed trades.\n";
+    }
+
+    std::stringstream ss;
+    for (const Trade& t : trades)
+    {
+        ss << t.sellerId << " SOLD " << t.buyerId << ' ' << t.amount << ' '
+           << core.GetAssetName(core.GetInstrumentBase(t.instrument)) << " for " << t.price << ' '
+           << core.GetAssetName(core.GetInstrumentQuote(t.instrument)) << '\n';
+    }
+    return ss.str();
+}
+
+std::string cancel_user_quote(Core& core, const std::string& user_id, const std::string& quote)
+{
+    CancelQuoteCommand command;
+    command.userId = parse_user_id(user_id);
+    if (!core.IsUser(command.userId))
+    {
+        return status_text(Status::UnknownUser);
+    }
+    command.quote = std::stoi(quote);
+    if (command.quote < 1)
+    {
+        return "Incorrect Quote number.\n";
+    }
+
+    const OrderResult result = core.Execute(command);
+    if (result.status == Status::UnknownOrder)
+    {
+        return "Could not find quote " + quote + '\n';
+    }
+    if (result.status != Status::Ok)
+    {
+        return status_text(result.status);
+    }
+    return "Success!\n";
+}
+
+std::string find_user_quote(const Core& core, const std::string& user_id,
+    const std::string& quote, uint64_t& order_id)
+{
+    std::vector<ActiveOrder> orders;
+    const Status status = core.GetActiveOrders(parse_user_id(user_id), orders);
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+    const int64_t index = std::stoi(quote);
+    if (index < 1)
+    {
+        return "Incorrect Quote number.\n";
+    }
+    if (index > static_cast<int64_t>(orders.size()))
+    {
+        return "Could not find quote " + quote + '\n';
+    }
+    order_id = orders[index - 1].order.id;
+    return std::string();
+}
+
+std::string cancel_user_order(Core& core, const std::string& user_id, uint64_t order_id,
+    const std::string& quote)
+{
+    // Заявку могли исполнить или снять, пока запрос шел в поток инструмента
+    const OrderResult result = core.Execute(CancelCommand{parse_user_id(user_id), order_id});
+    if (result.status == Status::UnknownOrder)
+    {
+        return "Could not find quote " + quote + '\n';
+    }
+    if (result.status != Status::Ok)
+    {
+        return status_text(result.status);
+    }
+    return "Success!\n";
+}
+
+std::string market_stats(Core& core, const std::string& resolution, size_t instrument)
+{
+    static const std::pair<const char*, MarketStats::Resolution> resolutions[] = {
+        {"1s", MarketStats::Second},
+        {"1m", MarketStats::Minute},
+        {"1h", MarketStats::Hour},
+    };
+
+    std::optional<MarketStats::Resolution> candles;
+    for (const auto& [name, value] : resolutions)
+    {
+        if (resolution == name)
+        {
+            candles = value;
+        }
+    }
+
+    MarketSummary summary;
+    const Status status = core.GetMarketStats(instrument, summary, candles);
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+
+    std::stringstream ss;
+    ss << "Last " << summary.last << '\n'
+       << "Volume24h " << summary.volume24h << '\n'
+       << "VWAP24h " << summary.vwap24h << '\n';
+    // Время начала свечи в секундах, затем OHLCV
+    for (const Candle& c : summary.candles)
+    {
+        ss << c.startNs / 1000000000 << ' ' << c.open << ' ' << c.high << ' '
+           << c.low << ' ' << c.close << ' ' << c.volume << '\n';
+    }
+    return ss.str();
+}
+
+std::string market_depth(Core& core, const std::string& levels, size_t instrument)
+{
+    constexpr int default_levels = 10;
+
+    const int count = levels.empty() ? default_levels : std::stoi(levels);
+    if (count < 1)
+    {
+        return "Incorrect number of levels.\n";
+    }
+
+    std::vector<LevelUpdate> depth;
+    const Status status = core.GetMarketDepth(instrument, count, depth);
+    if (status != Status::Ok)
+    {
+        return status_text(status);
+    }
+    if (depth.empty())
+    {
+        return "Market is empty.\n";
+    }
+
+    std::stringstream ss;
+    for (const LevelUpdate& level : depth)
+    {
+        ss << (level.isBuy ? "BUY " : "SELL ") << level.price << ' ' << level.total << ' '
+           << level.count << '\n';
+    }
+    return ss.str();
+}
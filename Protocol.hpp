@@ -0,0 +1,109 @@
+#ifndef CLIENSERVERECN_PROTOCOL_HPP
+#define CLIENSERVERECN_PROTOCOL_HPP
+
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "Core.hpp"
+
+// Клиентский протокол поверх типизированного ядра (см. Common.hpp): разбор полей
+// запросов и текст ответов. Общий для сервера и для прогона записанных запросов
+// (Replay). Разбор и форматирование идут вне блокировок ядра.
+
+// Номер инструмента из необязательного поля "Instrument" ("EUR/RUB"); без поля -
+// основной инструмент. Неизвестное имя дает несуществующий номер, и ядро отклонит команду.
+size_t parse_instrument(const Core& core, const nlohmann::json& message);
+
+// Отделяет от аргумента запроса имя инструмента: "10 EUR/RUB" -> "10" и номер EUR/RUB
+size_t split_instrument(const Core& core, std::string& argument);
+
+// Разбирает необязательные поля заявки. Возвращает false, если они некорректны.
+bool parse_order_options(const Core& core, const nlohmann::json& order, OrderOptions& options);
+
+// Пакет котировок Requests::MassQuote
+struct mass_quote
+{
+    bool replace_buys;
+    bool replace_sells;
+    std::vector<QuoteEntry> quotes;
+    size_t instrument;
+};
+
+// {"Replace": "ALL" | "BUY" | "SELL" | "NONE",
+//  "Quotes": [{"Side": "BUY", "Amount": "...", "Price": "..."}, ...],
+//  "Instrument": "EUR/RUB"} - инструмент необязателен
+mass_quote parse_mass_quote(const Core& core, const nlohmann::json& message);
+
+// Фильтр Requests::MassCancel:
+// {"Side": "BUY" | "SELL" | "ALL", "MinPrice": "...", "MaxPrice": "...",
+//  "Instrument": "EUR/RUB"}, все поля необязательны
+OrderFilter parse_mass_cancel(const Core& core, const nlohmann::json& message);
+
+// Текст ответа на команду, отклоненную с кодом status
+std::string status_text(Status status);
+
+// Номер пользователя из поля "UserId"; отрицательный номер не принадлежит никому
+uint64_t parse_user_id(const std::string& user_id);
+
+// Обработчики запросов. Принимают поля запроса как они пришли от клиента
+// и возвращают текст ответа.
+
+// Регистрирует пользователя и возвращает его номер
+std::string register_user(Core& core, const std::string& name);
+
+std::string user_name(const Core& core, const std::string& user_id);
+
+// Балансы по строке на актив: "<актив> <сумма>"
+std::string user_balance(const Core& core, const std::string& user_id);
+
+// Номер принятой заявки записывается в order_id
+std::string place_order(Core& core, const std::string& user_id,
+    const std::string& amount, const std::string& price, bool is_buy,
+    const OrderOptions& options = {}, uint64_t* order_id = nullptr);
+
+std::string amend_order(Core& core, const std::string& user_id,
+    const std::string& order_id, const std::string& amount, const std::string& price);
+
+// Номера поставленных котировок дописываются в order_ids
+std::string place_mass_quote(Core& core, const std::string& user_id,
+    bool replace_buys, bool replace_sells, const std::vector<QuoteEntry>& quotes,
+    std::vector<uint64_t>* order_ids = nullptr, size_t instrument = 0);
+
+std::string mass_cancel(Core& core, const std::string& user_id, const OrderFilter& filter);
+// Текст ответа на снятие по фильтру; сервер складывает итоги команд по инструментам
+std::string mass_cancel_reply(const BatchResult& result);
+
+// Зачисление amount актива asset ("USD", "RUB", ...)
+std::string deposit(Core& core, const std::string& user_id, const std::string& asset,
+    const std::string& amount);
+
+std::string set_user_blocked(Core& core, const std::string& user_id, bool block);
+// Текст ответа на kill switch; сервер выполняет его командами по инструментам
+std::string set_user_blocked_reply(Status status, const std::string& user_id, bool block);
+
+// Активные заявки по строке на заявку, пронумерованные с 1 сквозь все инструменты
+std::string user_active_quotes(const Core& core, const std::string& user_id);
+
+// Сделки по строке на сделку: "<продавец> SOLD <покупатель> <объем> <актив> for <цена> <актив>"
+std::string user_trades(const Core& core, const std::string& user_id);
+
+// Снимает заявку по ее номеру в списке user_active_quotes
+std::string cancel_user_quote(Core& core, const std::string& user_id, const std::string& quote);
+
+// То же в два шага, чтобы снятие шло в потоке инструмента заявки: find_user_quote
+// находит номер заявки по опубликованному списку без блокировок ядра и возвращает
+// пустую строку или текст ошибки, cancel_user_order снимает найденную заявку
+std::string find_user_quote(const Core& core, const std::string& user_id,
+    const std::string& quote, uint64_t& order_id);
+std::string cancel_user_order(Core& core, const std::string& user_id, uint64_t order_id,
+    const std::string& quote);
+
+// Последняя цена, объем и VWAP за 24 часа; resolution ("1s", "1m" или "1h")
+// добавляет последние свечи этого разрешения
+std::string market_stats(Core& core, const std::string& resolution, size_t instrument = 0);
+
+// levels лучших уровней каждой стороны (по умолчанию 10)
+std::string market_depth(Core& core, const std::string& levels, size_t instrument = 0);
+
+#endif //CLIENSERVERECN_PROTOCOL_HPP
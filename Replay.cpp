@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "Common.hpp"
+#include "Core.hpp"
+#include "Journal.hpp"
+#include "Protocol.hpp"
+
+// Прогон записанного потока команд через ядро без сети: бэктест стратегий на
+// исторических заявках и замер производительности ядра. Команды выполняются
+// подряд в одном потоке, как можно быстрее; сделки пишутся в stdout (или в файл),
+// статистика - в stderr.
+
+using clock_type = std::chrono::steady_clock;
+
+struct ReplayOptions
+{
+    std::string inputPath;
+    bool jsonl = false;
+    // Куда писать сделки; "-" - stdout, пусто - никуда
+    std::string tradesPath = "-";
+    bool riskChecks = false;
+    std::vector<std::pair<std::string, std::string>> instruments;
+};
+
+// Разбор аргументов командной строки:
+//   Replay [параметры] <файл>
+//   <файл>                       двоичный журнал сервера (--journal) или файл .jsonl,
+//                                каждая строка которого - запрос клиентского протокола
+//                                {"ReqType": ..., "UserId": ..., "Message": ...}
+//   --format journal|jsonl       формат файла; по умолчанию - по расширению
+//   --trades <path>|-            куда писать сделки (по умолчанию stdout)
+//   --no-trades                  не выводить сделки, только статистику
+//   --risk-checks                отклонять заявки, на которые не хватает свободных средств,
+//                                и рыночные покупки
+//   --instrument <BASE/QUOTE>    добавить инструмент, как у сервера (можно повторять)
+ReplayOptions ParseOptions(int argc, char* argv[])
+{
+    ReplayOptions options;
+    bool formatSet = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc)
+        {
+            const std::string format = argv[++i];
+            if (format != "journal" && format != "jsonl")
+            {
+                throw std::invalid_argument("Unknown format " + format);
+            }
+            options.jsonl = (format == "jsonl");
+            formatSet = true;
+        }
+        else if (arg == "--trades" && i + 1 < argc)
+        {
+            options.tradesPath = argv[++i];
+        }
+        else if (arg == "--no-trades")
+        {
+            options.tradesPath.clear();
+        }
+        else if (arg == "--risk-checks")
+        {
+            options.riskChecks = true;
+        }
+        else if (arg == "--instrument" && i + 1 < argc)
+        {
+            const std::string symbol = argv[++i];
+            const size_t slash = symbol.find('/');
+            if (slash == std::string::npos)
+            {
+                throw std::invalid_argument("Incorrect instrument " + symbol);
+            }
+            options.instruments.emplace_back(symbol.substr(0, slash), symbol.substr(slash + 1));
+        }
+        else if (options.inputPath.empty() && arg.compare(0, 2, "--") != 0)
+        {
+            options.inputPath = arg;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (options.inputPath.empty())
+    {
+        throw std::invalid_argument("Usage: Replay [options] <journal|file.jsonl>");
+    }
+    if (!formatSet)
+    {
+        const std::string suffix = ".jsonl";
+        options.jsonl = options.inputPath.size() >= suffix.size() &&
+            options.inputPath.compare(options.inputPath.size() - suffix.size(),
+                suffix.size(), suffix) == 0;
+    }
+
+    return options;
+}
+
+// Пишет сделки в текстовый поток, по строке на сделку:
+// <инструмент> <продавец> SOLD <покупатель> <объем> for <цена>
+class trade_writer : public CoreListener
+{
+public:
+    trade_writer(const Core& core, std::ostream* out)
+        : core_(core), out_(out)
+    {
+    }
+
+    void OnMarketData(const std::vector<LevelUpdate>&,
+        const std::vector<Trade>& trades) override
+    {
+        count_ += trades.size();
+        if (!out_)
+        {
+            return;
+        }
+        for (const Trade& t : trades)
+        {
+            *out_ << core_.GetInstrumentSymbol(t.instrument) << ' ' << t.sellerId << " SOLD "
+                  << t.buyerId << ' ' << t.amount << " for " << t.price << '\n';
+        }
+    }
+
+    uint64_t count() const { return count_; }
+
+private:
+    const Core& core_;
+    std::ostream* out_;
+    uint64_t count_ = 0;
+};
+
+// Время выполнения команд ядром
+class latency_stats
+{
+public:
+    void add(clock_type::duration latency)
+    {
+        samples_.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    }
+
+    size_t count() const { return samples_.size(); }
+
+    void print(std::ostream& out, clock_type::duration elapsed)
+    {
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        uint64_t total = 0;
+        for (uint64_t sample : samples_)
+        {
+            total += sample;
+        }
+        const double engine = total / 1e9;
+
+        out << "Elapsed: " << seconds << " s, " << rate(samples_.size(), seconds)
+            << " commands/s\n"
+            << "Engine: " << engine << " s, " << rate(samples_.size(), engine)
+            << " commands/s\n";
+        if (samples_.empty())
+        {
+            return;
+        }
+
+        std::sort(samples_.begin(), samples_.end());
+        out << "Latency, ns: p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+            << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999)
+            << ", max " << samples_.back() << '\n';
+    }
+
+private:
+    static double rate(size_t count, double seconds)
+    {
+        return seconds > 0 ? count / seconds : 0;
+    }
+
+    uint64_t percentile(double p) const
+    {
+        return samples_[std::min(samples_.size() - 1,
+            static_cast<size_t>(p * samples_.size()))];
+    }
+
+    std::vector<uint64_t> samples_;
+};
+
+// Выполняет запрос клиентского протокола. Возвращает ответ ядра или пустую строку,
+// если запрос не меняет состояние ядра и пропускается.
+std::string apply_request(Core& core, const nlohmann::json& j)
+{
+    const std::string reqType = j["ReqType"];
+    if (reqType == Requests::Registration)
+    {
+        return register_user(core, j["Message"]);
+    }
+    if (reqType == Requests::BuyOrder || reqType == Requests::SellOrder)
+    {
+        auto order = nlohmann::json::parse(j["Message"].get<std::string>());
+        OrderOptions options;
+        if (!parse_order_options(core, order, options))
+        {
+            return "Error! Unknown order type\n";
+        }
+        return place_order(core, j["UserId"], order["Amount"],
+            order.value("Price", std::string("0")), reqType == Requests::BuyOrder, options);
+    }
+    if (reqType == Requests::Cancel)
+    {
+        return cancel_user_quote(core, j["UserId"], j["Message"]);
+    }
+    if (reqType == Requests::Amend)
+    {
+        auto amend = nlohmann::json::parse(j["Message"].get<std::string>());
+        return amend_order(core, j["UserId"], amend["OrderId"], amend["Amount"], amend["Price"]);
+    }
+    if (reqType == Requests::MassQuote)
+    {
+        const mass_quote quote = parse_mass_quote(core,
+            nlohmann::json::parse(j["Message"].get<std::string>()));
+        return place_mass_quote(core, j["UserId"], quote.replace_buys, quote.replace_sells,
+            quote.quotes, nullptr, quote.instrument);
+    }
+    if (reqType == Requests::MassCancel)
+    {
+        return mass_cancel(core, j["UserId"], parse_mass_cancel(core,
+            nlohmann::json::parse(j["Message"].get<std::string>())));
+    }
+    if (reqType == Requests::KillSwitch)
+    {
+        auto message = nlohmann::json::parse(j["Message"].get<std::string>());
+        return set_user_blocked(core, message["UserId"], message["Block"] != "0");
+    }
+    if (reqType == Requests::Deposit)
+    {
+        auto message = nlohmann::json::parse(j["Message"].get<std::string>());
+        return deposit(core, message["UserId"], message["Asset"], message["Amount"]);
+    }
+    return {};
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        const ReplayOptions options = ParseOptions(argc, argv);
+        std::ifstream in(options.inputPath, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open " + options.inputPath);
+        }
+
+        Core core;
+        for (const auto& [base, quote] : options.instruments)
+        {
+            core.AddInstrument(base, quote);
+        }
+        core.SetRiskChecks(options.riskChecks);
+
+        std::ios::sync_with_stdio(false);
+        std::ofstream tradesFile;
+        std::ostream* tradesOut = nullptr;
+        if (options.tradesPath == "-")
+        {
+            tradesOut = &std::cout;
+        }
+        else if (!options.tradesPath.empty())
+        {
+            tradesFile.open(options.tradesPath);
+            if (!tradesFile)
+            {
+                throw std::runtime_error("Could not open " + options.tradesPath);
+            }
+            tradesOut = &tradesFile;
+        }
+        trade_writer trades(core, tradesOut);
+        core.AddListener(&trades);
+
+        latency_stats latencies;
+        uint64_t rejected = 0;
+        uint64_t skipped = 0;
+        const auto start = clock_type::now();
+
+        if (options.jsonl)
+        {
+            // Разбор строки запроса в замер ядра не входит
+            std::string line;
+            while (std::getline(in, line))
+            {
+                if (line.empty())
+                {
+                    continue;
+                }
+                const nlohmann::json request = nlohmann::json::parse(line);
+                const auto before = clock_type::now();
+                const std::string reply = apply_request(core, request);
+                if (reply.empty())
+                {
+                    ++skipped;
+                    continue;
+                }
+                latencies.add(clock_type::now() - before);
+                if (reply.compare(0, 5, "Error") == 0)
+                {
+                    ++rejected;
+                }
+            }
+        }
+        else
+        {
+            Journal::Replay(options.inputPath, [&](const JournalCommand& command)
+            {
+                const auto before = clock_type::now();
+                core.ReplayCommand(command);
+                latencies.add(clock_type::now() - before);
+            });
+        }
+
+        const auto elapsed = clock_type::now() - start;
+        core.RemoveListener(&trades);
+        if (tradesOut)
+        {
+            tradesOut->flush();
+        }
+
+        std::cerr << "Commands: " << latencies.count() << " (rejected " << rejected
+                  << ", skipped " << skipped << ")\n"
+                  << "Trades: " << trades.count() << '\n';
+        latencies.print(std::cerr, elapsed);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,27 +1,220 @@
+#include <atomic>
 #include <cstdlib>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <boost/bind/bind.hpp>
 #include <boost/asio.hpp>
 
 #include "json.hpp"
+#include "Capture.hpp"
 #include "Common.hpp"
 #include "Core.hpp"
+#include "MarketData.hpp"
+#include "Protocol.hpp"
+#include "Trace.hpp"
 
 using boost::asio::ip::tcp;
 
+// Файл, в который команда Requests::TraceDump сбрасывает трассировку
+static const std::string traceFile = "trace.json";
+
 Core& GetCore()
 {
     static Core core;
     return core;
 }
 
+// Запись трафика сессий (--capture); пустой указатель - запись выключена
+std::unique_ptr<Capture>& GetCapture()
+{
+    static std::unique_ptr<Capture> capture;
+    return capture;
+}
+
+class session;
+typedef std::shared_ptr<session> session_ptr;
+
+// Потоки сопоставления.
+// Команды стакана выполняются в потоке своего инструмента, поэтому команды одного
+// инструмента идут по порядку, а разных - параллельно. Ответы и рассылки
+// возвращаются в поток ввода-вывода. Без потоков все выполняется в потоке
+// ввода-вывода, как и раньше.
+class matching_threads
+{
+public:
+    void start(boost::asio::io_service& io_service, size_t count);
+    void stop();
+
+    // Выполняет command в потоке инструмента, затем done в потоке ввода-вывода
+    void execute(size_t instrument, const std::function<void()>& command,
+        const std::function<void()>& done);
+
+    // Выполняет fn в потоке инструмента без ответа
+    void post(size_t instrument, const std::function<void()>& fn);
+
+    // Выполняет command(instrument) для каждого из count инструментов в его потоке,
+    // затем done в потоке ввода-вывода. Инструменты одного потока обходятся одной задачей.
+    void execute_all(size_t count, const std::function<void(size_t instrument)>& command,
+        const std::function<void()>& done);
+
+    // Выполняет fn в потоке ввода-вывода
+    void to_io(const std::function<void()>& fn);
+
+private:
+    boost::asio::io_service* io_service_ = nullptr;
+    std::vector<std::unique_ptr<boost::asio::io_service>> workers_;
+    std::vector<std::unique_ptr<boost::asio::io_service::work>> work_;
+    std::vector<std::thread> threads_;
+};
+
+matching_threads& GetMatching()
+{
+    static matching_threads threads;
+    return threads;
+}
+
+void matching_threads::start(boost::asio::io_service& io_service, size_t count)
+{
+    io_service_ = &io_service;
+    for (size_t i = 0; i < count; ++i)
+    {
+        workers_.push_back(std::make_unique<boost::asio::io_service>());
+        work_.push_back(std::make_unique<boost::asio::io_service::work>(*workers_.back()));
+        boost::asio::io_service& worker = *workers_.back();
+        threads_.emplace_back([&worker]() { worker.run(); });
+    }
+}
+
+void matching_threads::stop()
+{
+    work_.clear();
+    for (std::thread& thread : threads_)
+    {
+        thread.join();
+    }
+    threads_.clear();
+    workers_.clear();
+}
+
+void matching_threads::execute(size_t instrument, const std::function<void()>& command,
+    const std::function<void()>& done)
+{
+    if (workers_.empty())
+    {
+        command();
+        done();
+        return;
+    }
+
+    boost::asio::io_service& io_service = *io_service_;
+    workers_[instrument % workers_.size()]->post([command, done, &io_service]()
+    {
+        command();
+        io_service.post(done);
+    });
+}
+
+void matching_threads::post(size_t instrument, const std::function<void()>& fn)
+{
+    if (workers_.empty())
+    {
+        fn();
+        return;
+    }
+    workers_[instrument % workers_.size()]->post(fn);
+}
+
+void matching_threads::execute_all(size_t count,
+    const std::function<void(size_t instrument)>& command, const std::function<void()>& done)
+{
+    if (workers_.empty() || count == 0)
+    {
+        for (size_t instrument = 0; instrument < count; ++instrument)
+        {
+            command(instrument);
+        }
+        done();
+        return;
+    }
+
+    // Инструмент выполняется в потоке instrument % workers_.size(), как в execute
+    const size_t step = workers_.size();
+    const size_t shards = std::min(count, step);
+    auto remaining = std::make_shared<std::atomic<size_t>>(shards);
+    boost::asio::io_service& io_service = *io_service_;
+    for (size_t shard = 0; shard < shards; ++shard)
+    {
+        workers_[shard]->post([=, &io_service]()
+        {
+            for (size_t instrument = shard; instrument < count; instrument += step)
+            {
+                command(instrument);
+            }
+            if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                io_service.post(done);
+            }
+        });
+    }
+}
+
+void matching_threads::to_io(const std::function<void()>& fn)
+{
+    if (workers_.empty())
+    {
+        fn();
+        return;
+    }
+    io_service_->post(fn);
+}
+
+market_data_channel& GetMarketData()
+{
+    static market_data_channel channel(GetCore(), [](const std::function<void()>& fn)
+    {
+        GetMatching().to_io(fn);
+    });
+    return channel;
+}
+
+// Рассылка отчетов об исполнении.
+// Сессия подписывается на отчеты своего пользователя; отчет уходит всем его
+// живым сессиям, поиск получателей по ID пользователя - одна операция хеш-таблицы.
+class execution_router : public CoreListener
+{
+public:
+    void subscribe(uint64_t user_id, const session_ptr& subscriber);
+    void unsubscribe(uint64_t user_id, const session_ptr& subscriber);
+
+    void OnExecutions(const std::vector<ExecutionReport>& reports) override;
+
+private:
+    // Рассылает отчеты в потоке ввода-вывода
+    void route(const std::vector<ExecutionReport>& reports);
+    static const char* type_name(ExecutionReport::Type type);
+
+    std::unordered_map<uint64_t, std::vector<session_ptr>> sessions_;
+};
+
+execution_router& GetExecutions()
+{
+    static execution_router router;
+    return router;
+}
+
 // Oбработка клиентских сессий
-// Класс обрабатывает входящие сообщения от клиента и отправляет ответы
-class session
+// Класс обрабатывает входящие сообщения от клиента и отправляет ответы.
+// Все исходящие сообщения (ответы и рыночные данные) идут через очередь outbox_.
+class session : public std::enable_shared_from_this<session>, public market_data_subscriber
 {
 public:
-    session(boost::asio::io_service& io_service)
-        : socket_(io_service)
+    session(boost::asio::io_service& io_service, uint32_t id)
+        : socket_(io_service), id_(id)
     {
     }
 
@@ -32,10 +225,8 @@ public:
 
     void start()
     {
-        socket_.async_read_some(boost::asio::buffer(data_, max_length),
-            boost::bind(&session::handle_read, this,
-                boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred));
+        capture(CaptureRecord::Type::Connect);
+        read();
     }
 
     // Обработка полученного сообщения.
@@ -44,19 +235,33 @@ public:
     {
         if (!error)
         {
+            TRACE_INSTANT(ReadComplete);
             data_[bytes_transferred] = '\0';
+            capture(CaptureRecord::Type::Request, data_, bytes_transferred);
 
-            auto j = nlohmann::json::parse(data_);
+            nlohmann::json j;
+            {
+                TRACE_SCOPE(JsonParse);
+                j = nlohmann::json::parse(data_);
+            }
             auto reqType = j["ReqType"];
 
+            TRACE_SCOPE(Dispatch);
             std::string reply = "Error! Unknown request type";
             if (reqType == Requests::Registration)
             {
-                reply = GetCore().RegisterNewUser(j["Message"]);
+              // Регистрация ждет записи в журнал, поэтому, как и зачисление, идет
+              // в поток сопоставления; поток выбирается по номеру сессии
+              const std::string name = j["Message"];
+              execute(id_, [=](std::vector<uint64_t>&)
+              {
+                  return register_user(GetCore(), name);
+              });
+              return;
             }
             else if (reqType == Requests::Balance)
             {
-                reply = GetCore().GetUserBalance(j["UserId"]);
+                reply = user_balance(GetCore(), j["UserId"]);
             }
             else if (reqType == Requests::BuyOrder ||
                      reqType == Requests::SellOrder)
@@ -64,30 +269,239 @@ public:
               std::string message = j["Message"];
               auto order = nlohmann::json::parse(message);
               bool isBuy = (reqType == Requests::BuyOrder) ? true : false;
-              reply = GetCore().PlaceNewOrder(j["UserId"], order["Amount"],
-                  order["Price"], isBuy);
+              OrderOptions options;
+              if (parse_order_options(GetCore(), order, options))
+              {
+                const std::string user_id = j["UserId"];
+                const std::string amount = order["Amount"];
+                const std::string price = order.value("Price", std::string("0"));
+                execute(options.instrument, [=](std::vector<uint64_t>& order_ids)
+                {
+                    uint64_t order_id = 0;
+                    std::string result = place_order(GetCore(), user_id, amount, price,
+                        isBuy, options, &order_id);
+                    order_ids.push_back(order_id);
+                    return result;
+                });
+                return;
+              }
+              else
+              {
+                reply = "Error! Unknown order type\n";
+              }
             }
             else if (reqType == Requests::ActiveQuotes)
             {
-              reply = GetCore().GetUserActiveQuotes(j["UserId"]);
+              reply = user_active_quotes(GetCore(), j["UserId"]);
             }
             else if (reqType == Requests::Trades)
             {
-              reply = GetCore().GetUserTrades(j["UserId"]);
+              reply = user_trades(GetCore(), j["UserId"]);
             }
             else if (reqType == Requests::Cancel)
             {
-              reply = GetCore().CancelUserQuote(j["UserId"], j["Message"]);
+              // Номер в списке переводится в номер заявки без блокировок ядра,
+              // а снимается заявка в потоке своего инструмента
+              const std::string user_id = j["UserId"];
+              const std::string quote = j["Message"];
+              uint64_t order_id = 0;
+              reply = find_user_quote(GetCore(), user_id, quote, order_id);
+              if (reply.empty())
+              {
+                execute(Core::GetOrderInstrument(order_id), [=](std::vector<uint64_t>&)
+                {
+                    return cancel_user_order(GetCore(), user_id, order_id, quote);
+                });
+                return;
+              }
+            }
+            else if (reqType == Requests::Amend)
+            {
+              // {"OrderId": "...", "Amount": "...", "Price": "..."}
+              auto amend = nlohmann::json::parse(j["Message"].get<std::string>());
+              const std::string user_id = j["UserId"];
+              const std::string order_id = amend["OrderId"];
+              const std::string amount = amend["Amount"];
+              const std::string price = amend["Price"];
+              execute(Core::GetOrderInstrument(std::stoull(order_id)),
+                  [=](std::vector<uint64_t>&)
+                  {
+                      return amend_order(GetCore(), user_id, order_id, amount, price);
+                  });
+              return;
+            }
+            else if (reqType == Requests::MassQuote)
+            {
+              // Формат сообщения - см. parse_mass_quote
+              const mass_quote quote = parse_mass_quote(GetCore(),
+                  nlohmann::json::parse(j["Message"].get<std::string>()));
+              const std::string user_id = j["UserId"];
+              execute(quote.instrument, [=](std::vector<uint64_t>& order_ids)
+              {
+                  return place_mass_quote(GetCore(), user_id, quote.replace_buys,
+                      quote.replace_sells, quote.quotes, &order_ids, quote.instrument);
+              });
+              return;
             }
+            else if (reqType == Requests::MassCancel)
+            {
+              // Формат сообщения - см. parse_mass_cancel
+              const OrderFilter filter = parse_mass_cancel(GetCore(),
+                  nlohmann::json::parse(j["Message"].get<std::string>()));
+              const std::string user_id = j["UserId"];
+              if (filter.instrument >= 0)
+              {
+                execute(filter.instrument, [=](std::vector<uint64_t>&)
+                {
+                    return mass_cancel(GetCore(), user_id, filter);
+                });
+                return;
+              }
 
-            boost::asio::async_write(socket_,
-                boost::asio::buffer(reply, reply.size()),
-                boost::bind(&session::handle_write, this,
-                    boost::asio::placeholders::error));
+              // Снятие по всем инструментам - отдельная команда в потоке каждого
+              auto results = std::make_shared<std::vector<BatchResult>>(
+                  GetCore().GetInstrumentCount());
+              execute_all([=](size_t instrument)
+              {
+                  OrderFilter one = filter;
+                  one.instrument = static_cast<int64_t>(instrument);
+                  (*results)[instrument] = GetCore().Execute(
+                      MassCancelCommand{parse_user_id(user_id), one});
+              },
+              [results]()
+              {
+                  BatchResult total;
+                  for (const BatchResult& result : *results)
+                  {
+                      if (result.status != Status::Ok)
+                      {
+                          return mass_cancel_reply(result);
+                      }
+                      total.count += result.count;
+                  }
+                  return mass_cancel_reply(total);
+              });
+              return;
+            }
+            else if (reqType == Requests::MarketDepth)
+            {
+              // "<уровни>[ <инструмент>]"
+              std::string levels = j["Message"];
+              const size_t instrument = split_instrument(GetCore(), levels);
+              reply = market_depth(GetCore(), levels, instrument);
+            }
+            else if (reqType == Requests::MarketStats)
+            {
+              // "<разрешение>[ <инструмент>]"
+              std::string resolution = j["Message"];
+              const size_t instrument = split_instrument(GetCore(), resolution);
+              reply = market_stats(GetCore(), resolution, instrument);
+            }
+            else if (reqType == Requests::Subscribe)
+            {
+              // Снимок стакана придет следующим сообщением после ответа
+              const bool on = (j["Message"] != "0");
+              reply = on ? "Subscribed to market data.\n" : "Unsubscribed from market data.\n";
+              deliver(std::make_shared<const std::string>(reply));
+              reply.clear();
+              if (on)
+              {
+                GetMarketData().subscribe(shared_from_this());
+              }
+              else
+              {
+                GetMarketData().unsubscribe(shared_from_this());
+              }
+            }
+            else if (reqType == Requests::Executions)
+            {
+              const uint64_t user_id = std::stoull(j["UserId"].get<std::string>());
+              if (j["Message"] != "0")
+              {
+                reply = "Subscribed to execution reports.\n";
+                GetExecutions().subscribe(user_id, shared_from_this());
+                execution_users_.insert(user_id);
+              }
+              else
+              {
+                reply = "Unsubscribed from execution reports.\n";
+                GetExecutions().unsubscribe(user_id, shared_from_this());
+                execution_users_.erase(user_id);
+              }
+            }
+            else if (reqType == Requests::KillSwitch)
+            {
+              // Message: {"UserId": "...", "Block": "1" | "0"} - чью торговлю
+              // остановить или возобновить. Заявки снимаются командой на каждый
+              // инструмент в его потоке; новые заявки отклоняются уже после первой.
+              auto message = nlohmann::json::parse(j["Message"].get<std::string>());
+              const std::string user_id = message["UserId"];
+              const bool block = message["Block"] != "0";
+              auto statuses = std::make_shared<std::vector<Status>>(
+                  GetCore().GetInstrumentCount(), Status::Ok);
+              execute_all([=](size_t instrument)
+              {
+                  (*statuses)[instrument] = GetCore().Execute(BlockCommand{
+                      parse_user_id(user_id), block, static_cast<int64_t>(instrument)});
+              },
+              [=]()
+              {
+                  Status status = Status::Ok;
+                  for (Status one : *statuses)
+                  {
+                      if (one != Status::Ok)
+                      {
+                          status = one;
+                          break;
+                      }
+                  }
+                  return set_user_blocked_reply(status, user_id, block);
+              });
+              return;
+            }
+            else if (reqType == Requests::Deposit)
+            {
+              // Message: {"UserId": "...", "Asset": "USD" | "RUB" | ..., "Amount": "..."} -
+              // зачисление средств на счет пользователя
+              // Стаканов зачисление не касается; поток сопоставления выбирается по
+              // пользователю, чтобы поток ввода-вывода не ждал записи на диск
+              auto message = nlohmann::json::parse(j["Message"].get<std::string>());
+              const std::string user_id = message["UserId"];
+              const std::string asset = message["Asset"];
+              const std::string amount = message["Amount"];
+              execute(parse_user_id(user_id), [=](std::vector<uint64_t>&)
+              {
+                  return deposit(GetCore(), user_id, asset, amount);
+              });
+              return;
+            }
+            else if (reqType == Requests::CancelOnDisconnect)
+            {
+              // Действует на заявки, созданные после включения
+              cancel_on_disconnect_ = (j["Message"] != "0");
+              if (!cancel_on_disconnect_)
+              {
+                clear_created_orders();
+              }
+              reply = cancel_on_disconnect_ ? "Cancel on disconnect enabled.\n" :
+                                              "Cancel on disconnect disabled.\n";
+            }
+            else if (reqType == Requests::TraceDump)
+            {
+              reply = Trace::Dump(traceFile) ?
+                  "Trace written to " + traceFile + "\n" :
+                  "Error! Tracing is disabled or file is not writable\n";
+            }
+
+            if (!reply.empty())
+            {
+                deliver(std::make_shared<const std::string>(std::move(reply)));
+            }
+            read();
         }
         else
         {
-            delete this;
+            close();
         }
     }
 
@@ -95,23 +509,340 @@ public:
     {
         if (!error)
         {
-            socket_.async_read_some(boost::asio::buffer(data_, max_length),
-                boost::bind(&session::handle_read, this,
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred));
+            TRACE_INSTANT(WriteComplete);
+            capture(CaptureRecord::Type::Reply, outbox_.front()->data(),
+                outbox_.front()->size());
+            outbox_.pop_front();
+            if (outbox_.empty())
+            {
+                flush_conflated();
+            }
+
+            if (!outbox_.empty())
+            {
+                write();
+            }
         }
         else
         {
-            delete this;
+            close();
+        }
+    }
+
+    // Ставит сообщение в очередь на отправку
+    void deliver(const std::shared_ptr<const std::string>& message)
+    {
+        outbox_.push_back(message);
+        if (outbox_.size() == 1)
+        {
+            write();
         }
     }
 
+    // Отправляет обновление рыночных данных. Если клиент не успевает забирать
+    // сообщения, обновления не копятся в очереди, а сливаются.
+    void deliver_market_data(const std::shared_ptr<const std::string>& message,
+        const std::vector<LevelUpdate>& levels, const std::vector<Trade>& trades,
+        uint64_t seq) override
+    {
+        if (conflator_.offer(levels, trades, seq, outbox_.size()))
+        {
+            deliver(message);
+        }
+    }
+
+    // Отправляет снимок рыночных данных с номером seq
+    void deliver_snapshot(const std::shared_ptr<const std::string>& message,
+        uint64_t seq) override
+    {
+        conflator_.on_snapshot(seq);
+        deliver(message);
+    }
+
+private:
+    // Выполняет команду инструмента в его потоке сопоставления и отвечает клиенту.
+    // Следующий запрос читается только после ответа, поэтому команды сессии
+    // выполняются по порядку.
+    void execute(size_t instrument,
+        const std::function<std::string(std::vector<uint64_t>& order_ids)>& command)
+    {
+        auto self = shared_from_this();
+        auto reply = std::make_shared<std::string>();
+        auto order_ids = std::make_shared<std::vector<uint64_t>>();
+        GetMatching().execute(instrument,
+            [command, reply, order_ids]()
+            {
+                *reply = command(*order_ids);
+            },
+            [this, self, reply, order_ids]()
+            {
+                for (uint64_t order_id : *order_ids)
+                {
+                    track_order(order_id);
+                }
+                complete(std::move(*reply));
+            });
+    }
+
+    // Выполняет command для каждого инструмента в его потоке сопоставления,
+    // затем отвечает клиенту текстом reply()
+    void execute_all(const std::function<void(size_t instrument)>& command,
+        const std::function<std::string()>& reply)
+    {
+        auto self = shared_from_this();
+        GetMatching().execute_all(GetCore().GetInstrumentCount(), command,
+            [this, self, reply]()
+            {
+                complete(reply());
+            });
+    }
+
+    // Отвечает на выполненную команду и читает следующий запрос
+    void complete(std::string reply)
+    {
+        // Сессия закрылась, пока команда выполнялась
+        if (!socket_.is_open())
+        {
+            close();
+            return;
+        }
+        deliver(std::make_shared<const std::string>(std::move(reply)));
+        read();
+    }
+
+    void read()
+    {
+        socket_.async_read_some(boost::asio::buffer(data_, max_length - 1),
+            boost::bind(&session::handle_read, shared_from_this(),
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+    }
+
+    void write()
+    {
+        boost::asio::async_write(socket_,
+            boost::asio::buffer(*outbox_.front()),
+            boost::bind(&session::handle_write, shared_from_this(),
+                boost::asio::placeholders::error));
+    }
+
+    // Отправляет накопленное слитое обновление одним сообщением
+    void flush_conflated()
+    {
+        if (auto update = conflator_.take(GetCore()))
+        {
+            deliver(update);
+        }
+    }
+
+    // Запоминает заявку сессии для снятия при отключении. Номера исполненных
+    // и снятых заявок время от времени вычищаются, чтобы список не рос.
+    void track_order(uint64_t order_id)
+    {
+        if (!cancel_on_disconnect_ || order_id == 0)
+        {
+            return;
+        }
+
+        created_orders_.push_back(order_id);
+        if (created_orders_.size() >= prune_threshold_ && !pruning_)
+        {
+            prune_created_orders();
+        }
+    }
+
+    // Проверка идет в потоках инструментов заявок. Номера, добавленные за это
+    // время, сохраняются; если список успели очистить, итог проверки не нужен.
+    void prune_created_orders()
+    {
+        const size_t count = created_orders_.size();
+        const uint64_t generation = created_generation_;
+        auto groups = std::make_shared<std::vector<std::vector<uint64_t>>>(
+            GetCore().GetInstrumentCount());
+        for (uint64_t order_id : created_orders_)
+        {
+            (*groups)[Core::GetOrderInstrument(order_id)].push_back(order_id);
+        }
+
+        pruning_ = true;
+        auto self = shared_from_this();
+        GetMatching().execute_all(groups->size(),
+            [groups](size_t instrument)
+            {
+                GetCore().KeepActiveOrders((*groups)[instrument]);
+            },
+            [this, self, groups, count, generation]()
+            {
+                pruning_ = false;
+                if (generation != created_generation_)
+                {
+                    return;
+                }
+
+                std::vector<uint64_t> kept;
+                for (const std::vector<uint64_t>& group : *groups)
+                {
+                    kept.insert(kept.end(), group.begin(), group.end());
+                }
+                kept.insert(kept.end(), created_orders_.begin() + count, created_orders_.end());
+                created_orders_.swap(kept);
+                prune_threshold_ = std::max<size_t>(min_prune_threshold,
+                    2 * created_orders_.size());
+            });
+    }
+
+    void clear_created_orders()
+    {
+        created_orders_.clear();
+        ++created_generation_;
+    }
+
+    void capture(CaptureRecord::Type type, const char* data = nullptr, size_t size = 0)
+    {
+        if (GetCapture())
+        {
+            GetCapture()->Record(id_, type, data, size);
+        }
+    }
+
+    void close()
+    {
+        if (socket_.is_open())
+        {
+            capture(CaptureRecord::Type::Disconnect);
+        }
+        if (!created_orders_.empty())
+        {
+            // Заявки снимаются в потоках их инструментов, ответа никто не ждет
+            std::unordered_map<size_t, std::vector<uint64_t>> by_instrument;
+            for (uint64_t order_id : created_orders_)
+            {
+                by_instrument[Core::GetOrderInstrument(order_id)].push_back(order_id);
+            }
+            for (const auto& orders : by_instrument)
+            {
+                const std::vector<uint64_t> order_ids = orders.second;
+                GetMatching().post(orders.first, [order_ids]()
+                {
+                    GetCore().CancelOrders(order_ids);
+                });
+            }
+            clear_created_orders();
+        }
+
+        GetMarketData().unsubscribe(shared_from_this());
+        for (uint64_t user_id : execution_users_)
+        {
+            GetExecutions().unsubscribe(user_id, shared_from_this());
+        }
+        execution_users_.clear();
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+
 private:
     tcp::socket socket_;
-    enum { max_length = 1024 };
+    // Номер сессии в записи трафика
+    const uint32_t id_;
+    // Пакет котировок может занимать несколько килобайт
+    enum { max_length = 16384 };
     char data_[max_length];
+
+    std::deque<std::shared_ptr<const std::string>> outbox_;
+
+    // Слияние рыночных данных, пока клиент не забирает сообщения
+    market_data_conflator conflator_;
+
+    // Пользователи, на отчеты которых подписана сессия
+    std::set<uint64_t> execution_users_;
+
+    // Cancel-on-disconnect: заявки, созданные через эту сессию
+    bool cancel_on_disconnect_ = false;
+    std::vector<uint64_t> created_orders_;
+    enum { min_prune_threshold = 1024 };
+    size_t prune_threshold_ = min_prune_threshold;
+    // Идет ли проверка списка в потоках сопоставления; сколько раз список очищался
+    bool pruning_ = false;
+    uint64_t created_generation_ = 0;
 };
 
+void execution_router::subscribe(uint64_t user_id, const session_ptr& subscriber)
+{
+    std::vector<session_ptr>& sessions = sessions_[user_id];
+    if (std::find(sessions.begin(), sessions.end(), subscriber) == sessions.end())
+    {
+        sessions.push_back(subscriber);
+    }
+}
+
+void execution_router::unsubscribe(uint64_t user_id, const session_ptr& subscriber)
+{
+    const auto it = sessions_.find(user_id);
+    if (it == sessions_.end())
+    {
+        return;
+    }
+
+    std::vector<session_ptr>& sessions = it->second;
+    sessions.erase(std::remove(sessions.begin(), sessions.end(), subscriber), sessions.end());
+    if (sessions.empty())
+    {
+        sessions_.erase(it);
+    }
+}
+
+void execution_router::OnExecutions(const std::vector<ExecutionReport>& reports)
+{
+    GetMatching().to_io([this, reports]() { route(reports); });
+}
+
+void execution_router::route(const std::vector<ExecutionReport>& reports)
+{
+    for (const ExecutionReport& report : reports)
+    {
+        const auto it = sessions_.find(report.userId);
+        if (it == sessions_.end())
+        {
+            continue;
+        }
+
+        nlohmann::json message;
+        message["Type"] = "Execution";
+        message["Exec"] = type_name(report.type);
+        message["OrderId"] = report.orderId;
+        message["Instrument"] = GetCore().GetInstrumentSymbol(report.instrument);
+        message["Side"] = report.isBuy ? "BUY" : "SELL";
+        message["Price"] = report.price;
+        message["LastAmount"] = report.lastAmount;
+        message["LastPrice"] = report.lastPrice;
+        message["Leaves"] = report.leaves;
+        const auto text = std::make_shared<const std::string>(message.dump() + "\n");
+
+        for (const session_ptr& subscriber : it->second)
+        {
+            subscriber->deliver(text);
+        }
+    }
+}
+
+const char* execution_router::type_name(ExecutionReport::Type type)
+{
+    switch (type)
+    {
+    case ExecutionReport::Type::New:
+        return "New";
+    case ExecutionReport::Type::Fill:
+        return "Fill";
+    case ExecutionReport::Type::Cancel:
+        return "Cancel";
+    case ExecutionReport::Type::Expire:
+        return "Expire";
+    case ExecutionReport::Type::Amend:
+        return "Amend";
+    }
+    return "";
+}
+
 // Управление сервером
 // Создает новые сессии для каждого нового подключения
 class server
@@ -123,45 +854,260 @@ public:
     {
         std::cout << "Server started! Listen " << port << " port" << std::endl;
 
-        session* new_session = new session(io_service_);
+        accept();
+    }
+
+    void handle_accept(session_ptr new_session,
+        const boost::system::error_code& error)
+    {
+        if (!error)
+        {
+            TRACE_INSTANT(Accept);
+            new_session->start();
+            accept();
+        }
+    }
+
+private:
+    void accept()
+    {
+        session_ptr new_session = std::make_shared<session>(io_service_, ++session_count_);
         acceptor_.async_accept(new_session->socket(),
             boost::bind(&server::handle_accept, this, new_session,
                 boost::asio::placeholders::error));
     }
 
-    void handle_accept(session* new_session,
-        const boost::system::error_code& error)
+private:
+    boost::asio::io_service& io_service_;
+    tcp::acceptor acceptor_;
+    uint32_t session_count_ = 0;
+};
+
+// Периодически сохраняет снимок состояния Core
+class snapshot_timer
+{
+public:
+    snapshot_timer(boost::asio::io_service& io_service,
+        const std::string& path, boost::posix_time::seconds interval)
+        : timer_(io_service), path_(path), interval_(interval)
+    {
+        schedule();
+    }
+
+    void handle_timeout(const boost::system::error_code& error)
     {
         if (!error)
         {
-            new_session->start();
-            new_session = new session(io_service_);
-            acceptor_.async_accept(new_session->socket(),
-                boost::bind(&server::handle_accept, this, new_session,
-                    boost::asio::placeholders::error));
+            // Если предыдущий снимок еще пишется, пропускаем этот такт
+            GetCore().TakeSnapshot(path_);
+            schedule();
         }
-        else
+    }
+
+private:
+    void schedule()
+    {
+        timer_.expires_from_now(interval_);
+        timer_.async_wait(boost::bind(&snapshot_timer::handle_timeout, this,
+            boost::asio::placeholders::error));
+    }
+
+    boost::asio::deadline_timer timer_;
+    std::string path_;
+    boost::posix_time::seconds interval_;
+};
+
+// Снимает заявки с истекшим сроком. Срабатывает часто, поэтому отдельный таймер
+// на каждую заявку не нужен. Снятие каждого инструмента уходит в его поток
+// сопоставления: поток ввода-вывода не ждет блокировок стаканов.
+class expiry_timer
+{
+public:
+    expiry_timer(boost::asio::io_service& io_service)
+        : timer_(io_service)
+    {
+        schedule();
+    }
+
+    void handle_timeout(const boost::system::error_code& error)
+    {
+        if (!error)
         {
-            delete new_session;
+            const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch());
+            const uint64_t now_ms = now.count();
+            for (size_t instrument = 0; instrument < GetCore().GetInstrumentCount(); ++instrument)
+            {
+                GetMatching().post(instrument, [instrument, now_ms]()
+                {
+                    GetCore().ExpireOrders(instrument, now_ms);
+                });
+            }
+            schedule();
         }
     }
 
 private:
-    boost::asio::io_service& io_service_;
-    tcp::acceptor acceptor_;
+    void schedule()
+    {
+        timer_.expires_from_now(interval_);
+        timer_.async_wait(boost::bind(&expiry_timer::handle_timeout, this,
+            boost::asio::placeholders::error));
+    }
+
+    boost::asio::deadline_timer timer_;
+    boost::posix_time::milliseconds interval_ {10};
 };
 
-int main()
+struct ServerOptions
+{
+    std::string journalPath;
+    Journal::Options journalOptions;
+    std::string snapshotPath;
+    long snapshotInterval = 60;
+    std::string tradesPath;
+    std::string capturePath;
+    bool riskChecks = false;
+    // Инструменты сверх основного USD/RUB
+    std::vector<std::pair<std::string, std::string>> instruments;
+    size_t matchingThreads = 0;
+};
+
+// Разбор аргументов командной строки:
+//   --journal <path>             журнал команд, из которого восстанавливается состояние
+//   --durability fsync|async     отвечать клиенту после fsync журнала или сразу
+//   --snapshot <path>            снимок состояния, с которого начинается восстановление
+//   --snapshot-interval <sec>    как часто сохранять снимок (по умолчанию 60 секунд)
+//   --trades <path>              хранить историю сделок в файлах <path>.NNNNNN
+//   --capture <path>             записывать трафик сессий для CaptureReplay
+//   --risk-checks                отклонять заявки, на которые не хватает свободных средств,
+//                                и рыночные покупки
+//   --instrument <BASE/QUOTE>    добавить инструмент, например EUR/RUB или BTC/USD
+//                                (можно повторять)
+//   --matching-threads <n>       выполнять команды стаканов в n потоках по инструментам
+ServerOptions ParseOptions(int argc, char* argv[])
+{
+    ServerOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--journal" && i + 1 < argc)
+        {
+            options.journalPath = argv[++i];
+        }
+        else if (arg == "--durability" && i + 1 < argc)
+        {
+            const std::string mode = argv[++i];
+            options.journalOptions.durability = (mode == "fsync") ?
+                Durability::AckAfterFsync : Durability::AckBeforeFsync;
+        }
+        else if (arg == "--snapshot" && i + 1 < argc)
+        {
+            options.snapshotPath = argv[++i];
+        }
+        else if (arg == "--snapshot-interval" && i + 1 < argc)
+        {
+            options.snapshotInterval = std::stol(argv[++i]);
+        }
+        else if (arg == "--trades" && i + 1 < argc)
+        {
+            options.tradesPath = argv[++i];
+        }
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            options.capturePath = argv[++i];
+        }
+        else if (arg == "--risk-checks")
+        {
+            options.riskChecks = true;
+        }
+        else if (arg == "--instrument" && i + 1 < argc)
+        {
+            const std::string symbol = argv[++i];
+            const size_t slash = symbol.find('/');
+            if (slash == std::string::npos)
+            {
+                throw std::invalid_argument("Incorrect instrument " + symbol);
+            }
+            // Имена активов проверяет ядро
+            options.instruments.emplace_back(symbol.substr(0, slash), symbol.substr(slash + 1));
+        }
+        else if (arg == "--matching-threads" && i + 1 < argc)
+        {
+            options.matchingThreads = std::stoul(argv[++i]);
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    return options;
+}
+
+// Восстанавливает состояние: снимок, затем хвост журнала после него
+void RecoverCore(const ServerOptions& options)
+{
+    // Набор инструментов должен совпадать с тем, на котором писались снимок и журнал
+    for (const auto& [base, quote] : options.instruments)
+    {
+        const std::string symbol = base + "/" + quote;
+        if (GetCore().GetInstrumentIndex(symbol) < 0)
+        {
+            GetCore().AddInstrument(base, quote);
+        }
+    }
+
+    if (!options.tradesPath.empty())
+    {
+        GetCore().OpenTradeStore(options.tradesPath);
+    }
+
+    if (!options.snapshotPath.empty() && GetCore().LoadSnapshot(options.snapshotPath))
+    {
+        std::cout << "Snapshot " << options.snapshotPath << " loaded" << std::endl;
+    }
+
+    if (!options.journalPath.empty())
+    {
+        GetCore().OpenJournal(options.journalPath, options.journalOptions);
+        std::cout << "Journal " << options.journalPath << " opened" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
 {
     try
     {
+        const ServerOptions options = ParseOptions(argc, argv);
+        RecoverCore(options);
+        GetCore().SetRiskChecks(options.riskChecks);
+        if (!options.capturePath.empty())
+        {
+            GetCapture() = std::make_unique<Capture>(options.capturePath);
+        }
+
         boost::asio::io_service io_service;
         // ???
         /* static Core core; */
 
         server s(io_service);
+        GetCore().AddListener(&GetMarketData());
+        GetCore().AddListener(&GetExecutions());
+
+        expiry_timer expiries(io_service);
+        GetMatching().start(io_service, options.matchingThreads);
+
+        std::unique_ptr<snapshot_timer> snapshots;
+        if (!options.snapshotPath.empty())
+        {
+            snapshots = std::make_unique<snapshot_timer>(io_service,
+                options.snapshotPath, boost::posix_time::seconds(options.snapshotInterval));
+        }
 
         io_service.run();
+        GetMatching().stop();
     }
     catch (std::exception& e)
     {
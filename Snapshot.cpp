@@ -0,0 +1,156 @@
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Snapshot::Writer::Writer(const char* aPath)
+{
+  mOk = std::snprintf(mPath, sizeof(mPath), "%s", aPath) < static_cast<int>(sizeof(mPath)) &&
+        std::snprintf(mTmpPath, sizeof(mTmpPath), "%s.tmp", aPath) < static_cast<int>(sizeof(mTmpPath));
+  mFd = mOk ? ::open(mTmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+  mOk = mOk && mFd >= 0;
+}
+
+Snapshot::Writer::~Writer()
+{
+  if (mFd >= 0)
+  {
+    ::close(mFd);
+  }
+}
+
+bool Snapshot::Writer::Write(const void* aData, size_t aSize)
+{
+  const char* data = static_cast<const char*>(aData);
+  while (mOk && aSize > 0)
+  {
+    if (mUsed == kBufferSize)
+    {
+      Flush();
+    }
+
+    const size_t chunk = std::min(aSize, kBufferSize - mUsed);
+    std::memcpy(mBuffer + mUsed, data, chunk);
+    mUsed += chunk;
+    data += chunk;
+    aSize -= chunk;
+  }
+
+  return mOk;
+}
+
+bool Snapshot::Writer::Flush()
+{
+  size_t written = 0;
+  while (mOk && written < mUsed)
+  {
+    const ssize_t n = ::write(mFd, mBuffer + written, mUsed - written);
+    if (n < 0 && errno != EINTR)
+    {
+      mOk = false;
+    }
+    else if (n > 0)
+    {
+      written += static_cast<size_t>(n);
+    }
+  }
+  mUsed = 0;
+
+  return mOk;
+}
+
+bool Snapshot::Writer::Commit()
+{
+  mOk = Flush() && ::fsync(mFd) == 0;
+  ::close(mFd);
+  mFd = -1;
+
+  return mOk && ::rename(mTmpPath, mPath) == 0;
+}
+
+Snapshot::MappedFile::MappedFile(const std::string& aPath)
+{
+  const int fd = ::open(aPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+  {
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      mData = static_cast<const char*>(data);
+      mSize = st.st_size;
+    }
+  }
+  ::close(fd);
+
+  if (!mData)
+  {
+    return;
+  }
+
+  const Header* header = reinterpret_cast<const Header*>(mData);
+  const uint64_t expected = sizeof(Header) +
+      header->assetCount * sizeof(Asset) +
+      header->userCount * sizeof(User) +
+      header->userCount * header->assetCount * sizeof(double) +
+      header->instrumentCount * sizeof(Instrument) +
+      header->orderCount * sizeof(Order) +
+      header->namesSize;
+
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 && expected == mSize)
+  {
+    mHeader = header;
+  }
+}
+
+Snapshot::MappedFile::~MappedFile()
+{
+  if (mData)
+  {
+    ::munmap(const_cast<char*>(mData), mSize);
+  }
+}
+
+const Snapshot::Asset* Snapshot::MappedFile::GetAssets() const
+{
+  return reinterpret_cast<const Asset*>(mData + sizeof(Header));
+}
+
+const Snapshot::User* Snapshot::MappedFile::GetUsers() const
+{
+  return reinterpret_cast<const User*>(GetAssets() + mHeader->assetCount);
+}
+
+const double* Snapshot::MappedFile::GetBalances() const
+{
+  return reinterpret_cast<const double*>(GetUsers() + mHeader->userCount);
+}
+
+const Snapshot::Instrument* Snapshot::MappedFile::GetInstruments() const
+{
+  return reinterpret_cast<const Instrument*>(
+      GetBalances() + mHeader->userCount * mHeader->assetCount);
+}
+
+const Snapshot::Order* Snapshot::MappedFile::GetOrders() const
+{
+  return reinterpret_cast<const Order*>(GetInstruments() + mHeader->instrumentCount);
+}
+
+const char* Snapshot::MappedFile::GetNames() const
+{
+  return reinterpret_cast<const char*>(
+      GetOrders() + mHeader->orderCount);
+}
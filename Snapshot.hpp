@@ -0,0 +1,137 @@
+#ifndef CLIENSERVERECN_SNAPSHOT_HPP
+#define CLIENSERVERECN_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Asset.hpp"
+
+// Двоичный снимок состояния Core.
+//
+// Файл состоит из заголовка и массивов записей фиксированного размера, поэтому
+// его можно отобразить в память и читать записи на месте:
+//   Header
+//   Asset      [assetCount]
+//   User       [userCount]
+//   double     [userCount * assetCount] - балансы пользователей по номерам активов
+//   Instrument [instrumentCount]
+//   Order      [orderCount] - по инструментам: заявки стакана (покупки, затем продажи,
+//                             в порядке приоритета), за ними стоп-заявки в порядке
+//                             срабатывания
+//   имена пользователей подряд, без разделителей
+// Сами сделки лежат в TradeStore, в снимке хранится только их число.
+namespace Snapshot
+{
+  constexpr char kMagic[8] = {'E', 'C', 'N', 'S', 'N', 'A', 'P', '9'};
+
+  struct Header
+  {
+    char magic[8];
+    // Номер последней команды журнала, вошедшей в снимок
+    uint64_t journalSeq;
+    uint64_t assetCount;
+    uint64_t instrumentCount;
+    uint64_t userCount;
+    uint64_t orderCount;
+    uint64_t tradeCount;
+    uint64_t namesSize;
+  };
+
+  struct User
+  {
+    uint64_t id;
+    uint64_t nameOffset;
+    uint64_t nameSize;
+    uint64_t blocked;
+  };
+
+  struct Asset
+  {
+    // Имя, дополненное нулями
+    char name[kMaxAssetName];
+  };
+
+  struct Instrument
+  {
+    // Номера активов
+    uint64_t base;
+    uint64_t quote;
+    uint64_t nextOrderId;
+  };
+
+  struct Order
+  {
+    uint64_t id;
+    uint64_t userId;
+    double amount;
+    double price;
+    uint64_t isBuy;
+    uint64_t expireMs;
+    // OrderType и стоп-цена; у заявок стакана стоп-цена 0
+    uint64_t type;
+    double stopPrice;
+    // Айсберг: видимая часть и скрытый остаток
+    double display;
+    double hidden;
+  };
+
+  // Буферизованная запись в файл без выделения памяти в куче.
+  // Используется в дочернем процессе после fork, где malloc небезопасен.
+  class Writer
+  {
+  public:
+    // Пишет во временный файл рядом с aPath
+    explicit Writer(const char* aPath);
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    bool Write(const void* aData, size_t aSize);
+
+    // Сбрасывает буфер, делает fsync и атомарно переименовывает файл в aPath
+    bool Commit();
+
+  private:
+    bool Flush();
+
+  private:
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    char mPath[4096];
+    char mTmpPath[4096];
+    int mFd;
+    bool mOk;
+    size_t mUsed = 0;
+    char mBuffer[kBufferSize];
+  };
+
+  // Файл снимка, отображенный в память только для чтения
+  class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::string& aPath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // nullptr, если файла нет или он поврежден
+    const Header* GetHeader() const { return mHeader; }
+    const Asset* GetAssets() const;
+    const User* GetUsers() const;
+    // Балансы пользователя i - с индекса i * assetCount
+    const double* GetBalances() const;
+    const Instrument* GetInstruments() const;
+    const Order* GetOrders() const;
+    const char* GetNames() const;
+
+  private:
+    const char* mData = nullptr;
+    size_t mSize = 0;
+    const Header* mHeader = nullptr;
+  };
+} // namespace Snapshot
+
+#endif //CLIENSERVERECN_SNAPSHOT_HPP
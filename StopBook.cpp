@@ -0,0 +1,92 @@
+#include "StopBook.hpp"
+
+StopBook::StopBook()
+  : mBuys(TriggerOrder{true}), mSells(TriggerOrder{false})
+{
+}
+
+void StopBook::Add(const StopOrder& aStop)
+{
+  const auto it = GetSide(aStop.order.isBuy).emplace(aStop.stopPrice, aStop);
+  mOrders.emplace(aStop.order.id, it);
+  mUserOrders[aStop.order.userId].insert(aStop.order.id);
+}
+
+bool StopBook::Remove(uint64_t aOrderId)
+{
+  const auto orderIt = mOrders.find(aOrderId);
+  if (orderIt == mOrders.end())
+  {
+    return false;
+  }
+
+  const Side::iterator it = orderIt->second;
+  Unindex(it->second.order);
+  GetSide(it->second.order.isBuy).erase(it);
+  return true;
+}
+
+const StopOrder* StopBook::Find(uint64_t aOrderId) const
+{
+  const auto orderIt = mOrders.find(aOrderId);
+  return orderIt == mOrders.end() ? nullptr : &orderIt->second->second;
+}
+
+std::vector<StopOrder> StopBook::TakeTriggered(double aLastPrice)
+{
+  std::vector<StopOrder> triggered;
+  for (bool isBuy : {true, false})
+  {
+    Side& side = GetSide(isBuy);
+    // Покупки со стоп-ценой не выше aLastPrice, продажи - не ниже
+    const auto end = side.upper_bound(aLastPrice);
+    for (auto it = side.begin(); it != end; ++it)
+    {
+      Unindex(it->second.order);
+      triggered.push_back(it->second);
+    }
+    side.erase(side.begin(), end);
+  }
+
+  return triggered;
+}
+
+size_t StopBook::CountUserOrders(uint64_t aUserId) const
+{
+  const auto userIt = mUserOrders.find(aUserId);
+  return userIt == mUserOrders.end() ? 0 : userIt->second.size();
+}
+
+std::vector<const StopOrder*> StopBook::GetUserOrders(uint64_t aUserId) const
+{
+  std::vector<const StopOrder*> orders;
+  const auto userIt = mUserOrders.find(aUserId);
+  if (userIt == mUserOrders.end())
+  {
+    return orders;
+  }
+
+  orders.reserve(userIt->second.size());
+  for (uint64_t id : userIt->second)
+  {
+    orders.push_back(Find(id));
+  }
+  std::sort(orders.begin(), orders.end(), [](const StopOrder* aLeft, const StopOrder* aRight)
+  {
+    return aLeft->order.id < aRight->order.id;
+  });
+
+  return orders;
+}
+
+void StopBook::Unindex(const Order& aOrder)
+{
+  mOrders.erase(aOrder.id);
+
+  const auto userIt = mUserOrders.find(aOrder.userId);
+  userIt->second.erase(aOrder.id);
+  if (userIt->second.empty())
+  {
+    mUserOrders.erase(userIt);
+  }
+}
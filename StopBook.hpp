@@ -0,0 +1,76 @@
+#ifndef CLIENSERVERECN_STOPBOOK_HPP
+#define CLIENSERVERECN_STOPBOOK_HPP
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "OrderBook.hpp"
+
+// Стоп-заявка: после срабатывания order исполняется как заявка типа type
+struct StopOrder
+{
+  Order order;
+  OrderType type;
+  double stopPrice;
+};
+
+// Стоп-заявки, ожидающие срабатывания.
+// Покупка срабатывает, когда цена сделки поднимается до стоп-цены, продажа - когда
+// опускается до нее. Каждая сторона упорядочена по стоп-цене в порядке срабатывания,
+// поэтому сработавшие заявки - это начало стороны: O(log n + k).
+class StopBook
+{
+public:
+  // Ближайшая к срабатыванию стоп-цена идет первой
+  struct TriggerOrder
+  {
+    bool isBuy;
+
+    bool operator()(double aLeft, double aRight) const
+    {
+      return isBuy ? aLeft < aRight : aLeft > aRight;
+    }
+  };
+
+  // Внутри одной стоп-цены заявки идут в порядке поступления
+  using Side = std::multimap<double, StopOrder, TriggerOrder>;
+
+  StopBook();
+
+  const Side& GetSide(bool isBuy) const { return isBuy ? mBuys : mSells; }
+
+  void Add(const StopOrder& aStop);
+
+  // Снимает заявку. Возвращает false, если ее нет.
+  bool Remove(uint64_t aOrderId);
+
+  const StopOrder* Find(uint64_t aOrderId) const;
+
+  // Достает заявки, сработавшие при цене сделки aLastPrice: сначала покупки,
+  // затем продажи, каждая сторона в порядке стоп-цен и поступления
+  std::vector<StopOrder> TakeTriggered(double aLastPrice);
+
+  // Стоп-заявки пользователя в порядке поступления
+  std::vector<const StopOrder*> GetUserOrders(uint64_t aUserId) const;
+
+  // Число активных заявок пользователя, без их обхода
+  size_t CountUserOrders(uint64_t aUserId) const;
+
+  size_t Size() const { return mOrders.size(); }
+
+private:
+  Side& GetSide(bool isBuy) { return isBuy ? mBuys : mSells; }
+
+  void Unindex(const Order& aOrder);
+
+private:
+  Side mBuys;
+  Side mSells;
+  std::unordered_map<uint64_t, Side::iterator> mOrders;
+  std::unordered_map<uint64_t, std::unordered_set<uint64_t>> mUserOrders;
+};
+
+#endif //CLIENSERVERECN_STOPBOOK_HPP
@@ -0,0 +1,64 @@
+#include "TimerWheel.hpp"
+
+TimerWheel::TimerWheel(uint64_t aNowMs)
+  : mNow{aNowMs}
+{
+}
+
+void TimerWheel::Schedule(uint64_t aDeadlineMs, uint64_t aId)
+{
+  ++mCount;
+  Insert(Entry{aDeadlineMs, aId});
+}
+
+void TimerWheel::Insert(const Entry& aEntry)
+{
+  if (aEntry.deadline <= mNow)
+  {
+    mDue.push_back(aEntry);
+    return;
+  }
+
+  // Нижние уровни: старшие биты срока и текущего времени совпадают
+  unsigned level = 0;
+  while (level < kLevels - 1 && (aEntry.deadline >> (kBits * (level + 1))) !=
+                                (mNow >> (kBits * (level + 1))))
+  {
+    ++level;
+  }
+
+  size_t slot = (aEntry.deadline >> (kBits * level)) & kMask;
+  if (level == kLevels - 1 &&
+      (aEntry.deadline >> (kBits * level)) - (mNow >> (kBits * level)) >= kSlots)
+  {
+    // Срок за пределами колеса: ждем в последней ячейке верхнего уровня,
+    // при спуске положение пересчитается
+    slot = ((mNow >> (kBits * level)) - 1) & kMask;
+  }
+
+  mLevels[level][slot].push_back(aEntry);
+  ++mLevelCounts[level];
+}
+
+void TimerWheel::Tick()
+{
+  ++mNow;
+
+  // Сначала верхние уровни: их таймеры могут спуститься в ячейки, которые
+  // тут же разбираются на нижних
+  for (unsigned level = kLevels - 1; level > 0; --level)
+  {
+    if ((mNow & ((uint64_t(1) << (kBits * level)) - 1)) != 0)
+    {
+      continue;
+    }
+
+    Slot entries;
+    entries.swap(mLevels[level][(mNow >> (kBits * level)) & kMask]);
+    mLevelCounts[level] -= entries.size();
+    for (const Entry& entry : entries)
+    {
+      Insert(entry);
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef CLIENSERVERECN_TIMERWHEEL_HPP
+#define CLIENSERVERECN_TIMERWHEEL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Иерархическое колесо таймеров с шагом в 1 мс.
+//
+// kLevels уровней по kSlots ячеек: ячейка уровня L охватывает kSlots^L мс.
+// Таймер кладется на самый низкий уровень, на котором срок отличается от текущего
+// времени только в битах этого уровня, и спускается ниже, когда колесо доходит
+// до его ячейки. Постановка - O(1), каждый таймер спускается не более kLevels раз,
+// пустые участки времени пропускаются целиком.
+//
+// Снять таймер нельзя: владелец сам проверяет при срабатывании, актуален ли он.
+class TimerWheel
+{
+public:
+  explicit TimerWheel(uint64_t aNowMs = 0);
+
+  // Срабатывание aId в момент aDeadlineMs. Просроченный таймер сработает
+  // при следующем Advance.
+  void Schedule(uint64_t aDeadlineMs, uint64_t aId);
+
+  // Продвигает время до aNowMs и вызывает aOnExpire(id) для каждого таймера
+  // со сроком не позже aNowMs, в порядке сроков.
+  template <typename OnExpire>
+  void Advance(uint64_t aNowMs, OnExpire&& aOnExpire);
+
+  uint64_t GetNow() const { return mNow; }
+  size_t Size() const { return mCount; }
+
+private:
+  static constexpr unsigned kBits = 6;
+  static constexpr size_t kSlots = size_t(1) << kBits;
+  static constexpr uint64_t kMask = kSlots - 1;
+  static constexpr unsigned kLevels = 6;
+
+  struct Entry
+  {
+    uint64_t deadline;
+    uint64_t id;
+  };
+
+  using Slot = std::vector<Entry>;
+
+  void Insert(const Entry& aEntry);
+  // Шаг на 1 мс: спуск таймеров с верхних уровней в начале их ячеек
+  void Tick();
+
+private:
+  uint64_t mNow;
+  size_t mCount = 0;
+  std::array<std::array<Slot, kSlots>, kLevels> mLevels;
+  std::array<size_t, kLevels> mLevelCounts {};
+  // Таймеры, срок которых уже наступил
+  Slot mDue;
+};
+
+template <typename OnExpire>
+void TimerWheel::Advance(uint64_t aNowMs, OnExpire&& aOnExpire)
+{
+  Slot fired;
+  fired.swap(mDue);
+
+  while (mNow < aNowMs)
+  {
+    if (mCount == fired.size())
+    {
+      mNow = aNowMs;
+      break;
+    }
+
+    // Пропускаем время до ближайшей границы непустого уровня
+    unsigned empty = 0;
+    while (empty < kLevels && mLevelCounts[empty] == 0)
+    {
+      ++empty;
+    }
+    if (empty > 0)
+    {
+      const uint64_t boundary = mNow | ((uint64_t(1) << (kBits * empty)) - 1);
+      if (boundary >= aNowMs)
+      {
+        mNow = aNowMs;
+        break;
+      }
+      mNow = boundary;
+    }
+
+    Tick();
+    // Спущенные таймеры со сроком ровно в mNow попадают в mDue
+    fired.insert(fired.end(), mDue.begin(), mDue.end());
+    mDue.clear();
+    Slot& slot = mLevels[0][mNow & kMask];
+    mLevelCounts[0] -= slot.size();
+    fired.insert(fired.end(), slot.begin(), slot.end());
+    slot.clear();
+  }
+
+  mCount -= fired.size();
+  for (const Entry& entry : fired)
+  {
+    aOnExpire(entry.id);
+  }
+}
+
+#endif //CLIENSERVERECN_TIMERWHEEL_HPP
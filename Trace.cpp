@@ -0,0 +1,174 @@
+#include "Trace.hpp"
+
+#ifdef ECN_TRACE
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+  // Размер кольцевого буфера одного потока (степень двойки)
+  constexpr size_t kRingSize = 1 << 16;
+
+  const char* const kPointNames[] = {
+    "Accept",
+    "ReadComplete",
+    "JsonParse",
+    "Dispatch",
+    "PlaceNewOrder",
+    "MatchOrder",
+    "WriteComplete",
+  };
+  static_assert(sizeof(kPointNames) / sizeof(kPointNames[0]) ==
+      static_cast<size_t>(Trace::Point::Count), "Trace point without name");
+
+  struct Event
+  {
+    uint64_t tsc;
+    Trace::Point point;
+    Trace::Phase phase;
+  };
+
+  // Буфер пишет только поток-владелец, Dump только читает.
+  // head публикуется с release, поэтому читатель видит заполненные события.
+  struct Ring
+  {
+    std::array<Event, kRingSize> events;
+    std::atomic<uint64_t> head {0};
+    uint32_t tid;
+  };
+
+  uint64_t readTsc() noexcept
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  uint64_t nowNs() noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Опорная точка для перевода тактов TSC в микросекунды
+  struct Calibration
+  {
+    uint64_t tsc = readTsc();
+    uint64_t ns = nowNs();
+  };
+
+  Calibration& GetCalibration()
+  {
+    static Calibration calibration;
+    return calibration;
+  }
+
+  // Реестр буферов. Блокировка берется только при первом событии потока и в Dump.
+  // Буферы не освобождаются, чтобы события завершившихся потоков попали в дамп.
+  struct Registry
+  {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+  };
+
+  Registry& GetRegistry()
+  {
+    static Registry registry;
+    return registry;
+  }
+
+  Ring* registerThread()
+  {
+    GetCalibration();
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.rings.push_back(std::make_unique<Ring>());
+    registry.rings.back()->tid = static_cast<uint32_t>(registry.rings.size());
+    return registry.rings.back().get();
+  }
+} // namespace
+
+void Trace::Record(Point aPoint, Phase aPhase) noexcept
+{
+  thread_local Ring* ring = registerThread();
+
+  const uint64_t head = ring->head.load(std::memory_order_relaxed);
+  ring->events[head & (kRingSize - 1)] = Event{readTsc(), aPoint, aPhase};
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool Trace::Dump(const std::string& aPath)
+{
+  std::ofstream out(aPath, std::ios::trunc);
+  if (!out)
+  {
+    return false;
+  }
+
+  const Calibration& start = GetCalibration();
+  const Calibration now;
+  const double tscPerUs = now.tsc > start.tsc && now.ns > start.ns ?
+      static_cast<double>(now.tsc - start.tsc) / (now.ns - start.ns) * 1000.0 : 1000.0;
+
+  out << "{\"traceEvents\":[";
+  bool first = true;
+
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const auto& ring : registry.rings)
+  {
+    const uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t begin = head > kRingSize ? head - kRingSize : 0;
+
+    std::vector<Event> events;
+    events.reserve(head - begin);
+    for (uint64_t i = begin; i < head; ++i)
+    {
+      events.push_back(ring->events[i & (kRingSize - 1)]);
+    }
+
+    // Пока мы копировали, владелец мог перезаписать начало окна
+    const uint64_t after = ring->head.load(std::memory_order_acquire);
+    const uint64_t overwritten = after > kRingSize ? after - kRingSize : 0;
+    const size_t skip = overwritten > begin ? overwritten - begin : 0;
+
+    for (size_t i = skip; i < events.size(); ++i)
+    {
+      const Event& e = events[i];
+      const double ts = e.tsc >= start.tsc ? (e.tsc - start.tsc) / tscPerUs : 0.0;
+      const char ph = e.phase == Phase::Begin ? 'B' : e.phase == Phase::End ? 'E' : 'i';
+
+      out << (first ? "" : ",") << "\n{\"name\":\""
+          << kPointNames[static_cast<size_t>(e.point)]
+          << "\",\"ph\":\"" << ph << "\",\"ts\":" << std::fixed << ts
+          << ",\"pid\":1,\"tid\":" << ring->tid
+          << (ph == 'i' ? ",\"s\":\"t\"}" : "}");
+      first = false;
+    }
+  }
+
+  out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  return static_cast<bool>(out);
+}
+
+#else
+
+bool Trace::Dump(const std::string&)
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef CLIENSERVERECN_TRACE_HPP
+#define CLIENSERVERECN_TRACE_HPP
+
+#include <cstdint>
+#include <string>
+
+// Трассировка горячего пути.
+// Включается флагом сборки ECN_TRACE (опция CMake ECN_ENABLE_TRACE). Каждый поток
+// пишет события в свой кольцевой буфер без блокировок, метки времени берутся
+// из TSC. Без флага макросы TRACE_* раскрываются в пустую инструкцию.
+namespace Trace
+{
+  // Точки трассировки
+  enum class Point : uint8_t
+  {
+    Accept,
+    ReadComplete,
+    JsonParse,
+    Dispatch,
+    PlaceNewOrder,
+    MatchOrder,
+    WriteComplete,
+
+    Count
+  };
+
+  enum class Phase : uint8_t
+  {
+    Instant,
+    Begin,
+    End
+  };
+
+  // Записывает события всех потоков в файл формата Chrome Trace Event
+  // (открывается в chrome://tracing и ui.perfetto.dev).
+  // Возвращает false, если трассировка выключена или файл не удалось записать.
+  bool Dump(const std::string& aPath);
+
+#ifdef ECN_TRACE
+  void Record(Point aPoint, Phase aPhase) noexcept;
+
+  // Пара событий Begin/End на время жизни объекта
+  class Scope
+  {
+  public:
+    explicit Scope(Point aPoint) noexcept : mPoint{aPoint}
+    {
+      Record(mPoint, Phase::Begin);
+    }
+
+    ~Scope()
+    {
+      Record(mPoint, Phase::End);
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Point mPoint;
+  };
+#endif
+} // namespace Trace
+
+#ifdef ECN_TRACE
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_INSTANT(point) \
+  ::Trace::Record(::Trace::Point::point, ::Trace::Phase::Instant)
+#define TRACE_SCOPE(point) \
+  ::Trace::Scope TRACE_CONCAT(traceScope_, __LINE__)(::Trace::Point::point)
+#else
+#define TRACE_INSTANT(point) do {} while (false)
+#define TRACE_SCOPE(point) do {} while (false)
+#endif
+
+#endif //CLIENSERVERECN_TRACE_HPP
@@ -0,0 +1,158 @@
+#include "TradeStore.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  constexpr uint64_t kSegmentMagic = 0x3254524441525445; // "ETRADRT2"
+} // namespace
+
+TradeStore::TradeStore(const std::string& aPath, size_t aSegmentSize)
+  : mPath{aPath}, mSegmentSize{aSegmentSize}
+{
+  // Подхватываем сегменты, оставшиеся с прошлого запуска
+  while (!mPath.empty() && MapSegment(mSegmentCount, false))
+  {
+    const size_t count = mSegments[mSegmentCount - 1].header->count;
+    mSize += count;
+    if (count < mSegmentSize)
+    {
+      break;
+    }
+  }
+}
+
+TradeStore::~TradeStore()
+{
+  for (size_t i = 0; i < mSegmentCount; ++i)
+  {
+    ::munmap(mSegments[i].header, mSegments[i].bytes);
+  }
+}
+
+void TradeStore::Append(const Trade& aTrade)
+{
+  const size_t size = mSize.load(std::memory_order_relaxed);
+  if (size == mSegmentCount * mSegmentSize && !MapSegment(mSegmentCount, true))
+  {
+    throw std::runtime_error("Could not map trade store segment " +
+        SegmentPath(mSegmentCount));
+  }
+
+  Segment& segment = mSegments[size / mSegmentSize];
+  segment.trades.load(std::memory_order_relaxed)[size % mSegmentSize] = aTrade;
+  // Счетчик обновляется после записи, поэтому в файле не бывает недописанных сделок,
+  // а читатели без блокировки не видят недописанную сделку в памяти
+  ++segment.header->count;
+  mSize.store(size + 1, std::memory_order_release);
+}
+
+void TradeStore::Truncate(size_t aSize)
+{
+  if (aSize >= mSize)
+  {
+    return;
+  }
+
+  mSize = aSize;
+  for (size_t i = 0; i < mSegmentCount; ++i)
+  {
+    const size_t begin = i * mSegmentSize;
+    mSegments[i].header->count =
+        mSize <= begin ? 0 : std::min(mSegmentSize, mSize - begin);
+  }
+}
+
+bool TradeStore::MapSegment(size_t aIndex, bool aCreate)
+{
+  if (aIndex >= kMaxSegments)
+  {
+    return false;
+  }
+
+  const size_t bytes = sizeof(SegmentHeader) + mSegmentSize * sizeof(Trade);
+  void* data = MAP_FAILED;
+
+  if (mPath.empty())
+  {
+    data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+  else
+  {
+    const std::string path = SegmentPath(aIndex);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (aCreate ? O_CREAT : 0), 0644);
+    if (fd < 0)
+    {
+      return false;
+    }
+
+    struct stat st;
+    const bool sized = ::fstat(fd, &st) == 0 &&
+        (static_cast<size_t>(st.st_size) == bytes ||
+         (aCreate && ::ftruncate(fd, bytes) == 0));
+    if (sized)
+    {
+      data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+  }
+
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+
+  SegmentHeader* header = static_cast<SegmentHeader*>(data);
+  if (aCreate)
+  {
+    // Новый сегмент заводится, только когда предыдущие заполнены,
+    // поэтому содержимое старого файла с тем же именем не нужно
+    header->magic = kSegmentMagic;
+    header->count = 0;
+  }
+  else if (header->magic != kSegmentMagic)
+  {
+    ::munmap(data, bytes);
+    return false;
+  }
+
+  Segment& segment = mSegments[aIndex];
+  segment.header = header;
+  segment.bytes = bytes;
+  segment.trades.store(reinterpret_cast<Trade*>(header + 1), std::memory_order_release);
+  ++mSegmentCount;
+  return true;
+}
+
+bool TradeStore::Sync(size_t aCount) const
+{
+  if (mPath.empty())
+  {
+    return true;
+  }
+
+  const size_t segments = std::min(mSegmentCount, (aCount + mSegmentSize - 1) / mSegmentSize);
+  for (size_t i = 0; i < segments; ++i)
+  {
+    if (::msync(mSegments[i].header, mSegments[i].bytes, MS_SYNC) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string TradeStore::SegmentPath(size_t aIndex) const
+{
+  char suffix[16];
+  std::snprintf(suffix, sizeof(suffix), ".%06zu", aIndex);
+  return mPath + suffix;
+}
@@ -0,0 +1,116 @@
+#ifndef CLIENSERVERECN_TRADESTORE_HPP
+#define CLIENSERVERECN_TRADESTORE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// Сделка. Запись фиксированного размера, хранится прямо в отображенном файле.
+struct Trade
+{
+  uint64_t buyerId;
+  uint64_t sellerId;
+  double amount;
+  double price;
+  // время сделки, наносекунды от эпохи system_clock
+  int64_t timeNs;
+  // номер инструмента
+  uint64_t instrument;
+
+  static Trade Make(uint64_t aBuyerId, uint64_t aSellerId, double aAmount, double aPrice,
+      uint64_t aInstrument = 0)
+  {
+    return Trade{aBuyerId, aSellerId, aAmount, aPrice,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count(), aInstrument};
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const Trade& t)
+  {
+    os << t.sellerId << " SOLD "
+       << t.buyerId << ' '
+       << t.amount << " USD for "
+       << t.price << " RUB";
+
+    return os;
+  }
+};
+
+// Хранилище сделок, в которое только дописывают.
+// Сделки лежат в сегментах фиксированной емкости, отображенных в память.
+// С путем сегменты - файлы <path>.000000, <path>.000001, ... и история переживает
+// перезапуск процесса; без пути - анонимная память. Старые сегменты не перемещаются,
+// поэтому ссылки на записи остаются действительными при росте хранилища.
+//
+// Дозапись не ждет диска: после падения машины (а не процесса) на диске гарантированно
+// есть только сделки, сброшенные Sync. Ядро вызывает его при записи снимка,
+// а сделки после снимка восстанавливаются повтором журнала.
+class TradeStore
+{
+public:
+  static constexpr size_t kDefaultSegmentSize = 1 << 20;
+
+  explicit TradeStore(const std::string& aPath = "",
+      size_t aSegmentSize = kDefaultSegmentSize);
+  ~TradeStore();
+
+  TradeStore(const TradeStore&) = delete;
+  TradeStore& operator=(const TradeStore&) = delete;
+
+  void Append(const Trade& aTrade);
+
+  // Сделки с номерами меньше Size() можно читать без блокировки, пока другой
+  // поток дописывает новые
+  size_t Size() const { return mSize.load(std::memory_order_acquire); }
+
+  const Trade& operator[](size_t aIndex) const
+  {
+    return mSegments[aIndex / mSegmentSize].trades.load(std::memory_order_acquire)
+        [aIndex % mSegmentSize];
+  }
+
+  // Отбрасывает сделки начиная с aSize (при восстановлении из снимка и журнала)
+  void Truncate(size_t aSize);
+
+  // Сбрасывает на диск (msync) сегменты с первыми aCount сделками.
+  // Возвращает false при ошибке записи.
+  bool Sync(size_t aCount) const;
+
+private:
+  // Заголовок сегмента в начале файла
+  struct SegmentHeader
+  {
+    uint64_t magic;
+    uint64_t count;
+  };
+
+  // Сегмент подключается записью trades; остальные поля читает только
+  // дописывающий поток
+  struct Segment
+  {
+    std::atomic<Trade*> trades {nullptr};
+    SegmentHeader* header = nullptr;
+    size_t bytes = 0;
+  };
+
+  bool MapSegment(size_t aIndex, bool aCreate);
+  std::string SegmentPath(size_t aIndex) const;
+
+private:
+  // Предел числа сегментов: таблица сегментов создается сразу на пределе и не
+  // перевыделяется, поэтому читатели обращаются к ней без блокировки
+  static constexpr size_t kMaxSegments = 4096;
+
+  std::string mPath;
+  size_t mSegmentSize;
+  std::unique_ptr<Segment[]> mSegments {new Segment[kMaxSegments]};
+  // Число подключенных сегментов; меняет и читает только дописывающий поток
+  size_t mSegmentCount = 0;
+  std::atomic<size_t> mSize {0};
+};
+
+#endif //CLIENSERVERECN_TRADESTORE_HPP
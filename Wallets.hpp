@@ -0,0 +1,147 @@
+#ifndef CLIENSERVERECN_WALLETS_HPP
+#define CLIENSERVERECN_WALLETS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ChunkedVector.hpp"
+
+// Кошельки пользователей: балансы и резервы по номерам активов.
+// Все кошельки лежат в одном массиве строками по пользователям: сначала балансы
+// всех активов, затем резервы. Сделка обращается к строкам двух участников по
+// индексу актива, без ветвлений по валюте, и новый актив не требует новых полей.
+//
+// Массив растет кусками и строки не переезжают, поэтому балансы читаются без
+// блокировки: у каждой строки свой счетчик версий (seqlock). Писатели упорядочены
+// внешней блокировкой и меняют балансы через UpdateBalances, читатель копирует
+// строку через ReadBalances и повторяет чтение, если застал запись. Чтобы чтение
+// наперегонки с записью не было гонкой данных, суммы хранятся в атомиках
+// и читаются и пишутся relaxed; порядок задает счетчик версий.
+class Wallets
+{
+public:
+  static constexpr size_t kChunkUsers = 1024;
+
+  using Cell = std::atomic<double>;
+  static_assert(Cell::is_always_lock_free, "Wallets need lock-free atomic double");
+
+  // Прибавляет aDelta к сумме; вызывается писателем под внешней блокировкой
+  static void Add(Cell& aCell, double aDelta)
+  {
+    aCell.store(aCell.load(std::memory_order_relaxed) + aDelta, std::memory_order_relaxed);
+  }
+
+  size_t GetAssetCount() const { return mAssetCount; }
+
+  // Добавляет актив с нулевым балансом у всех пользователей. Строки переезжают,
+  // поэтому вызывается только до начала обслуживания запросов.
+  void AddAsset()
+  {
+    const size_t stride = 2 * mAssetCount;
+    const size_t users = mUserCount;
+    // Кусок вмещает целое число строк, поэтому строка не разрывается между кусками
+    ChunkedVector<Cell> data(kChunkUsers * (stride + 2));
+    data.Reserve(users * (stride + 2));
+    for (size_t user = 0; user < users; ++user)
+    {
+      const Cell* from = GetBalances(user);
+      Cell* to = &data[user * (stride + 2)];
+      for (size_t i = 0; i < stride; ++i)
+      {
+        to[i < mAssetCount ? i : i + 1].store(from[i].load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+      }
+    }
+    mData = std::move(data);
+    ++mAssetCount;
+  }
+
+  // Заводит нулевой кошелек aUserId. Можно вызывать из нескольких потоков
+  // для разных пользователей, в том числе во время сделок других пользователей.
+  void AddUser(size_t aUserId)
+  {
+    mData.Reserve((aUserId + 1) * 2 * mAssetCount);
+    mVersions.Reserve(aUserId + 1);
+    Cell* row = GetBalances(aUserId);
+    for (size_t i = 0; i < 2 * mAssetCount; ++i)
+    {
+      row[i].store(0, std::memory_order_relaxed);
+    }
+
+    size_t count = mUserCount.load(std::memory_order_relaxed);
+    while (count <= aUserId &&
+           !mUserCount.compare_exchange_weak(count, aUserId + 1, std::memory_order_relaxed))
+    {
+    }
+  }
+
+  Cell* GetBalances(size_t aUserId)
+  {
+    return &mData[aUserId * 2 * mAssetCount];
+  }
+  const Cell* GetBalances(size_t aUserId) const
+  {
+    return &mData[aUserId * 2 * mAssetCount];
+  }
+
+  // Резерв под активные заявки: базовый актив под продажи, котируемый под покупки
+  Cell* GetReserved(size_t aUserId) { return GetBalances(aUserId) + mAssetCount; }
+  const Cell* GetReserved(size_t aUserId) const { return GetBalances(aUserId) + mAssetCount; }
+
+  // Баланс и резерв актива для писателя, который держит внешнюю блокировку
+  double GetBalance(size_t aUserId, size_t aAsset) const
+  {
+    return GetBalances(aUserId)[aAsset].load(std::memory_order_relaxed);
+  }
+  double GetReserve(size_t aUserId, size_t aAsset) const
+  {
+    return GetReserved(aUserId)[aAsset].load(std::memory_order_relaxed);
+  }
+
+  // Вызывает aChange(Cell* balances) так, что ReadBalances не увидит
+  // половину изменения
+  template <typename Change>
+  void UpdateBalances(size_t aUserId, Change&& aChange)
+  {
+    std::atomic<uint64_t>& version = mVersions[aUserId];
+    const uint64_t before = version.load(std::memory_order_relaxed);
+    version.store(before + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    aChange(GetBalances(aUserId));
+    version.store(before + 2, std::memory_order_release);
+  }
+
+  // Копирует согласованные балансы всех активов aUserId в aOut без блокировки
+  void ReadBalances(size_t aUserId, double* aOut) const
+  {
+    const std::atomic<uint64_t>& version = mVersions[aUserId];
+    for (;;)
+    {
+      const uint64_t before = version.load(std::memory_order_acquire);
+      if (before % 2 == 0)
+      {
+        const Cell* row = GetBalances(aUserId);
+        for (size_t i = 0; i < mAssetCount; ++i)
+        {
+          aOut[i] = row[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (version.load(std::memory_order_relaxed) == before)
+        {
+          return;
+        }
+      }
+    }
+  }
+
+private:
+  size_t mAssetCount = 0;
+  // Больше самого старшего номера кошелька
+  std::atomic<size_t> mUserCount {0};
+  // До первого актива строки пустые, размер куска заменит AddAsset
+  ChunkedVector<Cell> mData {kChunkUsers};
+  ChunkedVector<std::atomic<uint64_t>> mVersions {kChunkUsers};
+};
+
+#endif //CLIENSERVERECN_WALLETS_HPP
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../Capture.hpp"
+
+class CaptureTest : public ::testing::Test
+{
+  protected:
+    const std::string path = "capture_test.bin";
+
+    void SetUp() override
+    {
+      std::remove(path.c_str());
+    }
+
+    void TearDown() override
+    {
+      std::remove(path.c_str());
+    }
+
+    std::vector<CaptureRecord> ReadAll()
+    {
+      std::vector<CaptureRecord> records;
+      Capture::Read(path, [&](const CaptureRecord& r) { records.push_back(r); });
+      return records;
+    }
+};
+
+TEST_F(CaptureTest, RecordAndRead)
+{
+  const std::string request = R"({"ReqType":"Bal","UserId":"0","Message":""})";
+  const std::string reply = "RUB 0\nUSD 0\n";
+  {
+    Capture capture(path);
+    capture.Record(1, CaptureRecord::Type::Connect);
+    capture.Record(2, CaptureRecord::Type::Connect);
+    capture.Record(1, CaptureRecord::Type::Request, request.data(), request.size());
+    capture.Record(1, CaptureRecord::Type::Reply, reply.data(), reply.size());
+    capture.Record(2, CaptureRecord::Type::Disconnect);
+  }
+
+  const std::vector<CaptureRecord> records = ReadAll();
+  ASSERT_EQ(records.size(), 5u);
+  EXPECT_EQ(records[0].session, 1u);
+  EXPECT_EQ(records[0].type, CaptureRecord::Type::Connect);
+  EXPECT_EQ(records[1].session, 2u);
+  EXPECT_EQ(records[2].type, CaptureRecord::Type::Request);
+  EXPECT_EQ(records[2].data, request);
+  EXPECT_EQ(records[3].type, CaptureRecord::Type::Reply);
+  EXPECT_EQ(records[3].data, reply);
+  EXPECT_EQ(records[4].type, CaptureRecord::Type::Disconnect);
+  EXPECT_TRUE(records[4].data.empty());
+  for (size_t i = 1; i < records.size(); ++i)
+  {
+    EXPECT_GE(records[i].timeNs, records[i - 1].timeNs);
+  }
+}
+
+TEST_F(CaptureTest, TruncatedTail)
+{
+  const std::string request = R"({"ReqType":"Reg","Message":"User"})";
+  {
+    Capture capture(path);
+    capture.Record(1, CaptureRecord::Type::Request, request.data(), request.size());
+    capture.Record(1, CaptureRecord::Type::Request, request.data(), request.size());
+  }
+
+  // Обрываем вторую запись посреди данных, как при падении сервера
+  std::ifstream in(path, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() - 5);
+
+  const std::vector<CaptureRecord> records = ReadAll();
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].data, request);
+}
+
+TEST_F(CaptureTest, NotACapture)
+{
+  EXPECT_THROW(Capture::Read(path, {}), std::runtime_error);
+  std::ofstream(path) << "not a capture file";
+  EXPECT_THROW(Capture::Read(path, {}), std::runtime_error);
+}
@@ -1,6 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <set>
+#include <thread>
+
 #include "../Core.hpp"
+#include "../Protocol.hpp"
 
 class CoreTest : public ::testing::Test
 {
@@ -9,130 +16,130 @@ class CoreTest : public ::testing::Test
 
     void SetUp() override
     {
-      core.RegisterNewUser("User1");
+      register_user(core, "User1");
     }
 };
 
 TEST_F(CoreTest, RegisterNewUser)
 {
-  EXPECT_EQ(core.GetUserName("0"), "User1");
-  auto usrId = core.RegisterNewUser("User2");
-  EXPECT_EQ(core.GetUserName(usrId), "User2");
+  EXPECT_EQ(user_name(core, "0"), "User1");
+  auto usrId = register_user(core, "User2");
+  EXPECT_EQ(user_name(core, usrId), "User2");
 
-  usrId = core.RegisterNewUser("User3");
-  EXPECT_EQ(core.GetUserName(usrId), "User3");
+  usrId = register_user(core, "User3");
+  EXPECT_EQ(user_name(core, usrId), "User3");
 }
 
 TEST_F(CoreTest, GetUserName)
 {
-  auto usrId = core.RegisterNewUser("User2");
-  EXPECT_EQ(core.GetUserName(usrId), "User2");
+  auto usrId = register_user(core, "User2");
+  EXPECT_EQ(user_name(core, usrId), "User2");
 
-  EXPECT_EQ(core.GetUserName("11"), "Error! Unknown User\n");
+  EXPECT_EQ(user_name(core, "11"), "Error! Unknown User\n");
 }
 
 TEST_F(CoreTest, GetUserBalance1)
 {
-  auto usrId = core.RegisterNewUser("User123");
-  EXPECT_EQ(core.GetUserName(usrId), "User123");
+  auto usrId = register_user(core, "User123");
+  EXPECT_EQ(user_name(core, usrId), "User123");
 
-  EXPECT_EQ(core.GetUserBalance(usrId), "RUB 0\nUSD 0\n");
+  EXPECT_EQ(user_balance(core, usrId), "RUB 0\nUSD 0\n");
 }
 
 TEST_F(CoreTest, GetUserBalance2)
 {
-  auto usrId = core.RegisterNewUser("User user");
-  EXPECT_EQ(core.GetUserName(usrId), "User user");
+  auto usrId = register_user(core, "User user");
+  EXPECT_EQ(user_name(core, usrId), "User user");
 
-  EXPECT_EQ(core.GetUserBalance("1100"), "Error! Unknown User\n");
+  EXPECT_EQ(user_balance(core, "1100"), "Error! Unknown User\n");
 }
 
 TEST_F(CoreTest, PlaceNewOrder1)
 {
-  auto usrId = core.RegisterNewUser("User 4");
-  EXPECT_EQ(core.GetUserName(usrId), "User 4");
+  auto usrId = register_user(core, "User 4");
+  EXPECT_EQ(user_name(core, usrId), "User 4");
 
   // заявка на покупку
-  EXPECT_EQ(core.PlaceNewOrder(usrId, "100", "62.5", true),
+  EXPECT_EQ(place_order(core, usrId, "100", "62.5", true),
       "Your order was succesfully placed.\n");
 }
 
 TEST_F(CoreTest, PlaceNewOrder2)
 {
-  auto usrId = core.RegisterNewUser("User 5");
-  EXPECT_EQ(core.GetUserName(usrId), "User 5");
+  auto usrId = register_user(core, "User 5");
+  EXPECT_EQ(user_name(core, usrId), "User 5");
 
   // заявка на покупку
-  EXPECT_EQ(core.PlaceNewOrder("111", "100", "62.5", true),
+  EXPECT_EQ(place_order(core, "111", "100", "62.5", true),
       "Error! Unknown User\n");
 }
 
 TEST_F(CoreTest, PlaceNewOrder3)
 {
-  auto usrId = core.RegisterNewUser("User 0");
-  EXPECT_EQ(core.GetUserName(usrId), "User 0");
+  auto usrId = register_user(core, "User 0");
+  EXPECT_EQ(user_name(core, usrId), "User 0");
 
   // заявка на покупку
-  EXPECT_EQ(core.PlaceNewOrder(usrId, "0.0", "62.5", true),
+  EXPECT_EQ(place_order(core, usrId, "0.0", "62.5", true),
       "Error. Incorrect USD amount.\n");
 }
 
 TEST_F(CoreTest, PlaceNewOrder4)
 {
-  auto usrId = core.RegisterNewUser("User 1");
-  EXPECT_EQ(core.GetUserName(usrId), "User 1");
+  auto usrId = register_user(core, "User 1");
+  EXPECT_EQ(user_name(core, usrId), "User 1");
 
   // заявка на покупку
-  EXPECT_EQ(core.PlaceNewOrder(usrId, "0.5", "-0.8", true),
+  EXPECT_EQ(place_order(core, usrId, "0.5", "-0.8", true),
       "Error. Incorrect USD price.\n");
 }
 
 TEST_F(CoreTest, PlaceNewOrder5)
 {
-  auto usrId_1 = core.RegisterNewUser("User p1");
-  EXPECT_EQ(core.GetUserName(usrId_1), "User p1");
+  auto usrId_1 = register_user(core, "User p1");
+  EXPECT_EQ(user_name(core, usrId_1), "User p1");
 
-  auto usrId_2 = core.RegisterNewUser("User p2");
-  EXPECT_EQ(core.GetUserName(usrId_2), "User p2");
+  auto usrId_2 = register_user(core, "User p2");
+  EXPECT_EQ(user_name(core, usrId_2), "User p2");
 
-  auto usrId_3 = core.RegisterNewUser("User p3");
-  EXPECT_EQ(core.GetUserName(usrId_3), "User p3");
+  auto usrId_3 = register_user(core, "User p3");
+  EXPECT_EQ(user_name(core, usrId_3), "User p3");
 
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "10", "62", true),
+  EXPECT_EQ(place_order(core, usrId_1, "10", "62", true),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_2, "20", "63", true),
+  EXPECT_EQ(place_order(core, usrId_2, "20", "63", true),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_3, "50", "61", false),
+  EXPECT_EQ(place_order(core, usrId_3, "50", "61", false),
       "Your order was succesfully placed.\n");
   
-  EXPECT_EQ(core.GetUserBalance(usrId_1), "RUB -620\nUSD 10\n");
-  EXPECT_EQ(core.GetUserBalance(usrId_2), "RUB -1260\nUSD 20\n");
-  EXPECT_EQ(core.GetUserBalance(usrId_3), "RUB 1880\nUSD -30\n");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB -620\nUSD 10\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB -1260\nUSD 20\n");
+  EXPECT_EQ(user_balance(core, usrId_3), "RUB 1880\nUSD -30\n");
 
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_1), "You have no active quotes.\n");
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_2), "You have no active quotes.\n");
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_3),
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_2), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_3),
       "1) " + usrId_3 + " 20 61 SELL\n");
 }
 
 TEST_F(CoreTest, PlaceNewOrder6)
 {
-  auto usrId_1 = core.RegisterNewUser("User 2");
-  EXPECT_EQ(core.GetUserName(usrId_1), "User 2");
+  auto usrId_1 = register_user(core, "User 2");
+  EXPECT_EQ(user_name(core, usrId_1), "User 2");
 
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "100", "62.5", true),
+  EXPECT_EQ(place_order(core, usrId_1, "100", "62.5", true),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "50", "63", true),
+  EXPECT_EQ(place_order(core, usrId_1, "50", "63", true),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "25", "65", true),
+  EXPECT_EQ(place_order(core, usrId_1, "25", "65", true),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "175", "66", false),
+  EXPECT_EQ(place_order(core, usrId_1, "175", "66", false),
       "Your order was succesfully placed.\n");
   
-  auto usrId_2 = core.RegisterNewUser("User -1");
-  EXPECT_EQ(core.GetUserName(usrId_2), "User -1");
+  auto usrId_2 = register_user(core, "User -1");
+  EXPECT_EQ(user_name(core, usrId_2), "User -1");
 
-  EXPECT_EQ(core.PlaceNewOrder(usrId_2, "145", "62.45", false),
+  EXPECT_EQ(place_order(core, usrId_2, "145", "62.45", false),
       "Your order was succesfully placed.\n");
 
   // купит 25 usd по 65
@@ -141,37 +148,37 @@ TEST_F(CoreTest, PlaceNewOrder6)
   //
   // Итого 25*65 + 50*63 + 70*62.5 = 1625 + 3150 + 4375 = 9150 RUB за 145 USD
   
-  EXPECT_EQ(core.GetUserBalance(usrId_1), "RUB -9150\nUSD 145\n");
-  EXPECT_EQ(core.GetUserBalance(usrId_2), "RUB 9150\nUSD -145\n");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB -9150\nUSD 145\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB 9150\nUSD -145\n");
 
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_1),
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
       "1) " + usrId_1 + " 30 62.5 BUY\n"
       "2) " + usrId_1 + " 175 66 SELL\n");
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_2), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_2), "You have no active quotes.\n");
 }
 
 TEST_F(CoreTest, PlaceNeOrder7)
 {
-  auto usrId_1 = core.RegisterNewUser("User 2");
-  EXPECT_EQ(core.GetUserName(usrId_1), "User 2");
+  auto usrId_1 = register_user(core, "User 2");
+  EXPECT_EQ(user_name(core, usrId_1), "User 2");
 
-  auto usrId_3 = core.RegisterNewUser("User 3");
-  EXPECT_EQ(core.GetUserName(usrId_3), "User 3");
+  auto usrId_3 = register_user(core, "User 3");
+  EXPECT_EQ(user_name(core, usrId_3), "User 3");
 
-  auto usrId_4 = core.RegisterNewUser("User 4");
-  EXPECT_EQ(core.GetUserName(usrId_4), "User 4");
+  auto usrId_4 = register_user(core, "User 4");
+  EXPECT_EQ(user_name(core, usrId_4), "User 4");
 
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "100", "62.5", false),
+  EXPECT_EQ(place_order(core, usrId_1, "100", "62.5", false),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_4, "25", "65", false),
+  EXPECT_EQ(place_order(core, usrId_4, "25", "65", false),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_3, "50", "65", false),
+  EXPECT_EQ(place_order(core, usrId_3, "50", "65", false),
       "Your order was succesfully placed.\n");
   
-  auto usrId_2 = core.RegisterNewUser("User -1");
-  EXPECT_EQ(core.GetUserName(usrId_2), "User -1");
+  auto usrId_2 = register_user(core, "User -1");
+  EXPECT_EQ(user_name(core, usrId_2), "User -1");
 
-  EXPECT_EQ(core.PlaceNewOrder(usrId_2, "145", "65", true),
+  EXPECT_EQ(place_order(core, usrId_2, "145", "65", true),
       "Your order was succesfully placed.\n");
 
   // покупает сначала 100 usd по 62.5 (usr1)
@@ -179,19 +186,19 @@ TEST_F(CoreTest, PlaceNeOrder7)
   // и покупает 20 usd по 65 (usr3)
 
   // 6250 + 1625 + 1300 = 9175
-  EXPECT_EQ(core.GetUserBalance(usrId_2), "RUB -9175\nUSD 145\n");
-  EXPECT_EQ(core.GetUserBalance(usrId_4), "RUB 1625\nUSD -25\n");
-  EXPECT_EQ(core.GetUserBalance(usrId_3), "RUB 1300\nUSD -20\n");
-  EXPECT_EQ(core.GetUserBalance(usrId_1), "RUB 6250\nUSD -100\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB -9175\nUSD 145\n");
+  EXPECT_EQ(user_balance(core, usrId_4), "RUB 1625\nUSD -25\n");
+  EXPECT_EQ(user_balance(core, usrId_3), "RUB 1300\nUSD -20\n");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB 6250\nUSD -100\n");
 
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_3),
+  EXPECT_EQ(user_active_quotes(core, usrId_3),
       "1) " + usrId_3 + " 30 65 SELL\n");
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_1), "You have no active quotes.\n");
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_2), "You have no active quotes.\n");
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_4), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_2), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_4), "You have no active quotes.\n");
 
-  EXPECT_EQ(core.GetUserTrades("228"), "Error! Unknown User\n");
-  EXPECT_EQ(core.GetUserTrades(usrId_2),
+  EXPECT_EQ(user_trades(core, "228"), "Error! Unknown User\n");
+  EXPECT_EQ(user_trades(core, usrId_2),
       usrId_1 + " SOLD " + usrId_2 + " 100 USD for 62.5 RUB\n" +
       usrId_4 + " SOLD " + usrId_2 + " 25 USD for 65 RUB\n" +
       usrId_3 + " SOLD " + usrId_2 + " 20 USD for 65 RUB\n");
@@ -199,36 +206,981 @@ TEST_F(CoreTest, PlaceNeOrder7)
 
 TEST_F(CoreTest, GetUserActiveQuotes1)
 {
-  auto usrId_1 = core.RegisterNewUser("User 11");
-  EXPECT_EQ(core.GetUserName(usrId_1), "User 11");
+  auto usrId_1 = register_user(core, "User 11");
+  EXPECT_EQ(user_name(core, usrId_1), "User 11");
 
-  EXPECT_EQ(core.GetUserActiveQuotes("11"), "Error! Unknown User\n");
-  EXPECT_EQ(core.PlaceNewOrder("11", "100", "62.5", false),
+  EXPECT_EQ(user_active_quotes(core, "11"), "Error! Unknown User\n");
+  EXPECT_EQ(place_order(core, "11", "100", "62.5", false),
       "Error! Unknown User\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "100", "62.5", false),
+  EXPECT_EQ(place_order(core, usrId_1, "100", "62.5", false),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "100", "100", true),
+  EXPECT_EQ(place_order(core, usrId_1, "100", "100", true),
       "Your order was succesfully placed.\n");
-  EXPECT_EQ(core.PlaceNewOrder(usrId_1, "100", "65.5", false),
+  EXPECT_EQ(place_order(core, usrId_1, "100", "65.5", false),
       "Your order was succesfully placed.\n");
 
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_1),
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
       "1) " + usrId_1 + " 100 100 BUY\n"
       "2) " + usrId_1 + " 100 62.5 SELL\n"
       "3) " + usrId_1 + " 100 65.5 SELL\n");
 
-  EXPECT_EQ(core.CancelUserQuote(usrId_1, "0"), "Incorrect Quote number.\n");
-  EXPECT_EQ(core.CancelUserQuote(usrId_1, "4"), "Could not find quote 4\n");
-  EXPECT_EQ(core.CancelUserQuote(usrId_1, "1"), "Success!\n");
+  EXPECT_EQ(cancel_user_quote(core, usrId_1, "0"), "Incorrect Quote number.\n");
+  EXPECT_EQ(cancel_user_quote(core, usrId_1, "4"), "Could not find quote 4\n");
+  EXPECT_EQ(cancel_user_quote(core, usrId_1, "1"), "Success!\n");
 
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_1),
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
       "1) " + usrId_1 + " 100 62.5 SELL\n"
       "2) " + usrId_1 + " 100 65.5 SELL\n");
 
-  EXPECT_EQ(core.CancelUserQuote(usrId_1, "2"), "Success!\n");
+  EXPECT_EQ(cancel_user_quote(core, usrId_1, "2"), "Success!\n");
 
-  EXPECT_EQ(core.CancelUserQuote("35", "2"), "Error! Unknown User\n");
+  EXPECT_EQ(cancel_user_quote(core, "35", "2"), "Error! Unknown User\n");
 
-  EXPECT_EQ(core.GetUserActiveQuotes(usrId_1),
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
       "1) " + usrId_1 + " 100 62.5 SELL\n");
 }
+
+TEST_F(CoreTest, GetMarketDepth)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  EXPECT_EQ(market_depth(core, ""), "Market is empty.\n");
+  EXPECT_EQ(market_depth(core, "0"), "Incorrect number of levels.\n");
+
+  place_order(core, usrId_1, "10", "62", true);
+  place_order(core, usrId_2, "5", "62", true);
+  place_order(core, usrId_1, "7", "61", true);
+  place_order(core, usrId_1, "3", "60", true);
+  place_order(core, usrId_2, "4", "64", false);
+  place_order(core, usrId_2, "6", "65", false);
+
+  EXPECT_EQ(market_depth(core, "2"),
+      "SELL 65 6 1\n"
+      "SELL 64 4 1\n"
+      "BUY 62 15 2\n"
+      "BUY 61 7 1\n");
+
+  // Изменение за пределами двух лучших уровней не меняет снимок
+  place_order(core, usrId_2, "1", "59", true);
+  EXPECT_EQ(market_depth(core, "2"),
+      "SELL 65 6 1\n"
+      "SELL 64 4 1\n"
+      "BUY 62 15 2\n"
+      "BUY 61 7 1\n");
+
+  // Сделка на лучшем уровне
+  auto usrId_3 = register_user(core, "User 3");
+  place_order(core, usrId_3, "12", "62", false);
+  EXPECT_EQ(market_depth(core, "2"),
+      "SELL 65 6 1\n"
+      "SELL 64 4 1\n"
+      "BUY 62 3 1\n"
+      "BUY 61 7 1\n");
+
+  EXPECT_EQ(cancel_user_quote(core, usrId_2, "1"), "Success!\n");
+  EXPECT_EQ(market_depth(core, "3"),
+      "SELL 65 6 1\n"
+      "SELL 64 4 1\n"
+      "BUY 61 7 1\n"
+      "BUY 60 3 1\n"
+      "BUY 59 1 1\n");
+}
+
+namespace
+{
+  class ReportListener : public CoreListener
+  {
+  public:
+    void OnExecutions(const std::vector<ExecutionReport>& aReports) override
+    {
+      reports.insert(reports.end(), aReports.begin(), aReports.end());
+    }
+
+    std::vector<ExecutionReport> reports;
+  };
+} // namespace
+
+TEST_F(CoreTest, ExecutionReports)
+{
+  ReportListener listener;
+  core.AddListener(&listener);
+
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  place_order(core, usrId_1, "10", "62", true);
+  ASSERT_EQ(listener.reports.size(), 1u);
+  EXPECT_EQ(listener.reports[0].type, ExecutionReport::Type::New);
+  EXPECT_EQ(listener.reports[0].userId, std::stoull(usrId_1));
+  EXPECT_EQ(listener.reports[0].leaves, 10);
+  const uint64_t restingId = listener.reports[0].orderId;
+
+  // Исполнение приходит обоим участникам сделки
+  listener.reports.clear();
+  place_order(core, usrId_2, "4", "61", false);
+  ASSERT_EQ(listener.reports.size(), 3u);
+  EXPECT_EQ(listener.reports[1].type, ExecutionReport::Type::Fill);
+  EXPECT_EQ(listener.reports[1].orderId, restingId);
+  EXPECT_EQ(listener.reports[1].lastAmount, 4);
+  EXPECT_EQ(listener.reports[1].lastPrice, 62);
+  EXPECT_EQ(listener.reports[1].leaves, 6);
+  EXPECT_EQ(listener.reports[2].type, ExecutionReport::Type::Fill);
+  EXPECT_EQ(listener.reports[2].userId, std::stoull(usrId_2));
+  EXPECT_EQ(listener.reports[2].leaves, 0);
+
+  listener.reports.clear();
+  EXPECT_EQ(cancel_user_quote(core, usrId_1, "1"), "Success!\n");
+  ASSERT_EQ(listener.reports.size(), 1u);
+  EXPECT_EQ(listener.reports[0].type, ExecutionReport::Type::Cancel);
+  EXPECT_EQ(listener.reports[0].orderId, restingId);
+  EXPECT_EQ(listener.reports[0].lastAmount, 6);
+  EXPECT_EQ(listener.reports[0].leaves, 0);
+
+  core.RemoveListener(&listener);
+}
+
+TEST_F(CoreTest, TypedCommands)
+{
+  ReportListener listener;
+  core.AddListener(&listener);
+  uint64_t buyer, seller;
+  ASSERT_EQ(core.RegisterUser("Buyer", buyer), Status::Ok);
+  ASSERT_EQ(core.RegisterUser("Seller", seller), Status::Ok);
+
+  NewOrderCommand buy;
+  buy.userId = buyer;
+  buy.amount = 10;
+  buy.price = 62;
+  buy.isBuy = true;
+  const OrderResult placed = core.Execute(buy);
+  EXPECT_EQ(placed.status, Status::Ok);
+  EXPECT_EQ(placed.filled, 0);
+  EXPECT_EQ(placed.leaves, 10);
+  ASSERT_EQ(listener.reports.size(), 1u);
+  EXPECT_EQ(listener.reports[0].orderId, placed.orderId);
+
+  // Остаток IOC снимается и в leaves не входит
+  NewOrderCommand sell;
+  sell.userId = seller;
+  sell.amount = 15;
+  sell.price = 60;
+  sell.options.type = OrderType::ImmediateOrCancel;
+  const OrderResult ioc = core.Execute(sell);
+  EXPECT_EQ(ioc.status, Status::Ok);
+  EXPECT_EQ(ioc.filled, 10);
+  EXPECT_EQ(ioc.leaves, 0);
+
+  sell.options.type = OrderType::Limit;
+  sell.amount = 5;
+  const OrderResult resting = core.Execute(sell);
+  const OrderResult amended = core.Execute(AmendCommand{seller, resting.orderId, 3, 61});
+  EXPECT_EQ(amended.status, Status::Ok);
+  EXPECT_EQ(amended.leaves, 3);
+  EXPECT_EQ(core.Execute(AmendCommand{buyer, resting.orderId, 3, 61}).status,
+      Status::UnknownOrder);
+
+  // Чужую заявку снять нельзя, свою - можно один раз
+  EXPECT_EQ(core.Execute(CancelCommand{buyer, resting.orderId}).status, Status::UnknownOrder);
+  listener.reports.clear();
+  EXPECT_EQ(core.Execute(CancelCommand{seller, resting.orderId}).status, Status::Ok);
+  ASSERT_EQ(listener.reports.size(), 1u);
+  EXPECT_EQ(listener.reports[0].type, ExecutionReport::Type::Cancel);
+  EXPECT_EQ(listener.reports[0].lastAmount, 3);
+  EXPECT_EQ(core.Execute(CancelCommand{seller, resting.orderId}).status, Status::UnknownOrder);
+
+  buy.userId = 1000;
+  EXPECT_EQ(core.Execute(buy).status, Status::UnknownUser);
+  buy.userId = buyer;
+  buy.amount = 0;
+  EXPECT_EQ(core.Execute(buy).status, Status::InvalidAmount);
+  buy.amount = 1;
+  buy.options.instrument = 5;
+  EXPECT_EQ(core.Execute(buy).status, Status::UnknownInstrument);
+  EXPECT_EQ(user_balance(core, std::to_string(buyer)), "RUB -620\nUSD 10\n");
+
+  core.RemoveListener(&listener);
+}
+
+TEST_F(CoreTest, TypedQueries)
+{
+  uint64_t buyer, seller;
+  ASSERT_EQ(core.RegisterUser("Buyer", buyer), Status::Ok);
+  ASSERT_EQ(core.RegisterUser("Seller", seller), Status::Ok);
+
+  std::string name;
+  EXPECT_EQ(core.GetUserName(seller, name), Status::Ok);
+  EXPECT_EQ(name, "Seller");
+  EXPECT_EQ(core.GetUserName(1000, name), Status::UnknownUser);
+  EXPECT_EQ(name, "Seller");
+
+  EXPECT_EQ(core.Execute(DepositCommand{buyer, static_cast<AssetId>(core.FindAsset("RUB")), 1000}),
+      Status::Ok);
+  EXPECT_EQ(core.Execute(DepositCommand{buyer, 100, 1}), Status::UnknownAsset);
+  std::vector<AssetBalance> balances;
+  ASSERT_EQ(core.GetBalances(buyer, balances), Status::Ok);
+  ASSERT_EQ(balances.size(), 2u);
+  EXPECT_EQ(core.GetAssetName(balances[0].asset), "RUB");
+  EXPECT_EQ(balances[0].amount, 1000);
+  EXPECT_EQ(core.GetAssetName(balances[1].asset), "USD");
+  EXPECT_EQ(balances[1].amount, 0);
+
+  MassQuoteCommand quotes;
+  quotes.userId = seller;
+  quotes.quotes = {{2, 63, false}, {3, 64, false}, {1, 61, true}};
+  std::vector<uint64_t> orderIds;
+  const BatchResult placed = core.Execute(quotes, &orderIds);
+  EXPECT_EQ(placed.status, Status::Ok);
+  EXPECT_EQ(placed.count, 3u);
+  ASSERT_EQ(orderIds.size(), 3u);
+
+  // Продажи от худшей цены к лучшей, затем покупки
+  std::vector<LevelUpdate> levels;
+  ASSERT_EQ(core.GetMarketDepth(0, 10, levels), Status::Ok);
+  ASSERT_EQ(levels.size(), 3u);
+  EXPECT_FALSE(levels[0].isBuy);
+  EXPECT_EQ(levels[0].price, 64);
+  EXPECT_EQ(levels[1].price, 63);
+  EXPECT_TRUE(levels[2].isBuy);
+  EXPECT_EQ(levels[2].total, 1);
+  ASSERT_EQ(core.GetMarketDepth(0, 1, levels), Status::Ok);
+  EXPECT_EQ(levels.size(), 2u);
+  EXPECT_EQ(core.GetMarketDepth(5, 1, levels), Status::UnknownInstrument);
+
+  NewOrderCommand buy;
+  buy.userId = buyer;
+  buy.amount = 2;
+  buy.price = 63;
+  buy.isBuy = true;
+  EXPECT_EQ(core.Execute(buy).filled, 2);
+
+  std::vector<ActiveOrder> orders;
+  ASSERT_EQ(core.GetActiveOrders(seller, orders), Status::Ok);
+  ASSERT_EQ(orders.size(), 2u);
+  EXPECT_EQ(orders[0].instrument, 0u);
+
+  std::vector<Trade> trades;
+  ASSERT_EQ(core.GetUserTrades(buyer, trades), Status::Ok);
+  ASSERT_EQ(trades.size(), 1u);
+  EXPECT_EQ(trades[0].sellerId, seller);
+  EXPECT_EQ(trades[0].price, 63);
+
+  MarketSummary summary;
+  ASSERT_EQ(core.GetMarketStats(0, summary, MarketStats::Minute), Status::Ok);
+  EXPECT_EQ(summary.last, 63);
+  EXPECT_EQ(summary.volume24h, 2);
+  EXPECT_EQ(summary.candles.size(), 1u);
+
+  // Номер в списке активных заявок, как в запросе снятия
+  const OrderResult cancelled = core.Execute(CancelQuoteCommand{seller, 2});
+  EXPECT_EQ(cancelled.status, Status::Ok);
+  EXPECT_EQ(cancelled.orderId, orders[1].order.id);
+  EXPECT_EQ(core.Execute(CancelQuoteCommand{seller, 5}).status, Status::UnknownOrder);
+
+  const BatchResult cleared = core.Execute(MassCancelCommand{seller, OrderFilter{}});
+  EXPECT_EQ(cleared.count, 1u);
+  ASSERT_EQ(core.GetActiveOrders(seller, orders), Status::Ok);
+  EXPECT_TRUE(orders.empty());
+}
+
+TEST_F(CoreTest, OrderTypes)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  place_order(core, usrId_1, "5", "62", false);
+  place_order(core, usrId_1, "5", "63", false);
+
+  OrderOptions fok;
+  fok.type = OrderType::FillOrKill;
+  EXPECT_EQ(place_order(core, usrId_2, "11", "63", true, fok),
+      "Your order was not filled and has been cancelled.\n");
+  // Свои заявки пользователя в ликвидность не входят
+  EXPECT_EQ(place_order(core, usrId_1, "5", "63", true, fok),
+      "Your order was not filled and has been cancelled.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 63 5 1\nSELL 62 5 1\n");
+
+  EXPECT_EQ(place_order(core, usrId_2, "7", "63", true, fok),
+      "Your order was succesfully placed.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 63 3 1\n");
+
+  OrderOptions ioc;
+  ioc.type = OrderType::ImmediateOrCancel;
+  EXPECT_EQ(place_order(core, usrId_2, "5", "63", true, ioc),
+      "Your order was partially filled, the rest has been cancelled.\n");
+  EXPECT_EQ(market_depth(core, ""), "Market is empty.\n");
+
+  place_order(core, usrId_1, "4", "60", true);
+  place_order(core, usrId_1, "4", "55", true);
+
+  OrderOptions market;
+  market.type = OrderType::Market;
+  EXPECT_EQ(place_order(core, usrId_2, "6", "0", false, market),
+      "Your order was succesfully placed.\n");
+  EXPECT_EQ(market_depth(core, ""), "BUY 55 2 1\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB -275\nUSD 4\n");
+}
+
+TEST_F(CoreTest, FillOrKillSkipsOwnVolumeOnLevel)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  auto usrId_3 = register_user(core, "User 3");
+
+  place_order(core, usrId_1, "5", "62", false);
+  place_order(core, usrId_2, "5", "62", false);
+  place_order(core, usrId_1, "4", "63", false);
+  // Заявка первого пользователя на 62 исполнена частично
+  place_order(core, usrId_3, "2", "62", true);
+  EXPECT_EQ(market_depth(core, ""), "SELL 63 4 1\nSELL 62 8 2\n");
+
+  // Из уровней вычитается остаток самого пользователя, а не исходный объем
+  OrderOptions fok;
+  fok.type = OrderType::FillOrKill;
+  EXPECT_EQ(place_order(core, usrId_1, "6", "63", true, fok),
+      "Your order was not filled and has been cancelled.\n");
+  EXPECT_EQ(place_order(core, usrId_1, "5", "63", true, fok),
+      "Your order was succesfully placed.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 63 4 1\nSELL 62 3 1\n");
+
+  // Свои заявки сняты - уровень снова доступен целиком
+  cancel_user_quote(core, usrId_1, "1");
+  cancel_user_quote(core, usrId_1, "1");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "63", true, fok),
+      "Your order was not filled and has been cancelled.\n");
+  place_order(core, usrId_2, "3", "63", false);
+  EXPECT_EQ(place_order(core, usrId_1, "3", "63", true, fok),
+      "Your order was succesfully placed.\n");
+}
+
+TEST_F(CoreTest, ExpireOrders)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  const uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  OrderOptions gtt;
+  gtt.expireMs = now - 1;
+  EXPECT_EQ(place_order(core, usrId_1, "10", "62", true, gtt),
+      "Error. Order expiry time has already passed.\n");
+
+  gtt.expireMs = now + 1000;
+  place_order(core, usrId_1, "10", "62", true, gtt);
+  gtt.expireMs = now + 5000;
+  place_order(core, usrId_1, "5", "61", true, gtt);
+  place_order(core, usrId_1, "7", "60", true, gtt);
+
+  // Заявка, исполненная до срока, из колеса не снимается, но и не срабатывает
+  place_order(core, usrId_2, "10", "62", false);
+  EXPECT_EQ(core.ExpireOrders(now + 1000), 0u);
+
+  place_order(core, usrId_1, "2", "59", true, gtt);
+  EXPECT_EQ(core.ExpireOrders(now + 4999), 0u);
+  EXPECT_EQ(cancel_user_quote(core, usrId_1, "3"), "Success!\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 5 61 BUY\n"
+      "2) " + usrId_1 + " 7 60 BUY\n");
+
+  EXPECT_EQ(core.ExpireOrders(now + 5000), 2u);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+}
+
+TEST_F(CoreTest, ExpireOrdersOfOneInstrument)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  OrderOptions gtt;
+  gtt.instrument = core.AddInstrument("EUR", "RUB");
+  const uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  gtt.expireMs = now + 1000;
+  place_order(core, usrId_1, "10", "70", true, gtt);
+  gtt.instrument = 0;
+  place_order(core, usrId_1, "10", "60", true, gtt);
+
+  EXPECT_EQ(core.ExpireOrders(1, now + 1000), 1u);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 10 60 BUY USD/RUB\n");
+  EXPECT_EQ(core.ExpireOrders(2, now + 1000), 0u);
+  EXPECT_EQ(core.ExpireOrders(0, now + 1000), 1u);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+}
+
+TEST_F(CoreTest, StopOrders)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  auto usrId_3 = register_user(core, "User 3");
+
+  place_order(core, usrId_1, "10", "60", true);
+  place_order(core, usrId_1, "10", "58", true);
+  place_order(core, usrId_1, "10", "55", true);
+
+  // Стоп-продажа по рынку и стоп-лимит на продажу
+  OrderOptions stopMarket;
+  stopMarket.type = OrderType::Market;
+  stopMarket.stopPrice = 59;
+  EXPECT_EQ(place_order(core, usrId_3, "10", "0", false, stopMarket),
+      "Your stop order was succesfully placed.\n");
+  OrderOptions stopLimit;
+  stopLimit.stopPrice = 57;
+  place_order(core, usrId_3, "4", "56", false, stopLimit);
+  EXPECT_EQ(user_active_quotes(core, usrId_3),
+      "1) " + usrId_3 + " 10 0 SELL STOP 59\n"
+      "2) " + usrId_3 + " 4 56 SELL STOP 57\n");
+
+  // Сделка по 60 не доходит до стоп-цен
+  place_order(core, usrId_2, "5", "60", false);
+  EXPECT_EQ(market_depth(core, ""), "BUY 60 5 1\nBUY 58 10 1\nBUY 55 10 1\n");
+
+  // Сделка по 58 запускает стоп по рынку, его сделки по 55 - стоп-лимит,
+  // остаток которого встает в стакан
+  place_order(core, usrId_2, "10", "58", false);
+  EXPECT_EQ(market_depth(core, ""), "SELL 56 4 1\nBUY 55 5 1\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_3), "1) " + usrId_3 + " 4 56 SELL\n");
+  EXPECT_EQ(user_balance(core, usrId_3), "RUB 565\nUSD -10\n");
+
+  // Стоп-заявку можно снять до срабатывания
+  stopLimit.stopPrice = 50;
+  place_order(core, usrId_3, "1", "49", false, stopLimit);
+  EXPECT_EQ(cancel_user_quote(core, usrId_3, "2"), "Success!\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_3), "1) " + usrId_3 + " 4 56 SELL\n");
+}
+
+TEST_F(CoreTest, IcebergOrders)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  auto usrId_3 = register_user(core, "User 3");
+
+  OrderOptions iceberg;
+  iceberg.displayAmount = 3;
+  place_order(core, usrId_1, "10", "62", false, iceberg);
+  place_order(core, usrId_2, "2", "62", false);
+
+  // В стакане видна только верхушка айсберга
+  EXPECT_EQ(market_depth(core, ""), "SELL 62 5 2\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 3 62 SELL HIDDEN 7\n");
+
+  // Верхушка исполнена и пополнена, но встает за заявкой второго пользователя
+  place_order(core, usrId_3, "4", "62", true);
+  EXPECT_EQ(market_depth(core, ""), "SELL 62 4 2\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_2),
+      "1) " + usrId_2 + " 1 62 SELL\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 3 62 SELL HIDDEN 4\n");
+
+  // Скрытый объем учитывается при проверке FOK
+  OrderOptions fok;
+  fok.type = OrderType::FillOrKill;
+  EXPECT_EQ(place_order(core, usrId_3, "9", "62", true, fok),
+      "Your order was not filled and has been cancelled.\n");
+  EXPECT_EQ(place_order(core, usrId_3, "8", "62", true, fok),
+      "Your order was succesfully placed.\n");
+
+  // Одна крупная заявка забирает айсберг целиком за несколько пополнений
+  place_order(core, usrId_1, "10", "62", false, iceberg);
+  place_order(core, usrId_3, "22", "62", true);
+  EXPECT_EQ(market_depth(core, ""), "BUY 62 12 1\n");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB 1240\nUSD -20\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+}
+
+TEST_F(CoreTest, AmendOrder)
+{
+  ReportListener listener;
+  core.AddListener(&listener);
+
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  auto usrId_3 = register_user(core, "User 3");
+
+  place_order(core, usrId_1, "10", "62", false);
+  const std::string orderId = std::to_string(listener.reports.back().orderId);
+  place_order(core, usrId_2, "5", "62", false);
+
+  EXPECT_EQ(amend_order(core, usrId_2, orderId, "5", "62"), "Error! Unknown order\n");
+  EXPECT_EQ(amend_order(core, usrId_1, "100", "5", "62"), "Error! Unknown order\n");
+  EXPECT_EQ(amend_order(core, usrId_1, orderId, "0", "62"), "Error. Incorrect USD amount.\n");
+
+  // Уменьшение объема сохраняет очередь
+  EXPECT_EQ(amend_order(core, usrId_1, orderId, "4", "62"), "Your order was succesfully amended.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 62 9 2\n");
+  EXPECT_EQ(listener.reports.back().type, ExecutionReport::Type::Amend);
+  EXPECT_EQ(listener.reports.back().leaves, 4);
+
+  place_order(core, usrId_3, "3", "62", true);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 1 62 SELL\n");
+
+  // Увеличение объема ставит заявку в конец очереди
+  EXPECT_EQ(amend_order(core, usrId_1, orderId, "6", "62"), "Your order was succesfully amended.\n");
+  place_order(core, usrId_3, "5", "62", true);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 6 62 SELL\n");
+
+  // Новая цена может сразу дать сделку
+  place_order(core, usrId_3, "2", "60", true);
+  EXPECT_EQ(amend_order(core, usrId_1, orderId, "6", "60"), "Your order was succesfully amended.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 60 4 1\n");
+  EXPECT_EQ(listener.reports.back().type, ExecutionReport::Type::Fill);
+  EXPECT_EQ(listener.reports.back().orderId, std::stoull(orderId));
+
+  core.RemoveListener(&listener);
+}
+
+TEST_F(CoreTest, PlaceMassQuote)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  place_order(core, usrId_1, "1", "50", true);
+  place_order(core, usrId_1, "1", "70", false);
+
+  EXPECT_EQ(place_mass_quote(core, usrId_1, true, true,
+      {{10, 60, true}, {10, 59, true}, {0, 64, false}}),
+      "Error. Incorrect USD amount.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 70 1 1\nBUY 50 1 1\n");
+
+  EXPECT_EQ(place_mass_quote(core, usrId_1, true, true,
+      {{10, 60, true}, {10, 59, true}, {5, 64, false}, {5, 65, false}}),
+      "Mass quote accepted: 4 orders placed.\n");
+  EXPECT_EQ(market_depth(core, ""),
+      "SELL 65 5 1\nSELL 64 5 1\nBUY 60 10 1\nBUY 59 10 1\n");
+
+  // Замена только покупок, продажи остаются
+  place_order(core, usrId_2, "4", "60", false);
+  EXPECT_EQ(place_mass_quote(core, usrId_1, true, false, {{8, 61, true}}),
+      "Mass quote accepted: 1 orders placed.\n");
+  EXPECT_EQ(market_depth(core, ""), "SELL 65 5 1\nSELL 64 5 1\nBUY 61 8 1\n");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB -240\nUSD 4\n");
+}
+
+TEST_F(CoreTest, MassCancel)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  place_order(core, usrId_1, "1", "58", true);
+  place_order(core, usrId_1, "1", "59", true);
+  place_order(core, usrId_1, "1", "60", true);
+  place_order(core, usrId_1, "1", "64", false);
+  place_order(core, usrId_1, "1", "65", false);
+  place_order(core, usrId_2, "1", "59", true);
+
+  OrderFilter filter;
+  filter.buys = true;
+  filter.sells = false;
+  filter.minPrice = 59;
+  filter.maxPrice = 60;
+  EXPECT_EQ(mass_cancel(core, usrId_1, filter), "Cancelled 2 orders.\n");
+  EXPECT_EQ(market_depth(core, ""),
+      "SELL 65 1 1\nSELL 64 1 1\nBUY 59 1 1\nBUY 58 1 1\n");
+
+  EXPECT_EQ(mass_cancel(core, usrId_1, OrderFilter{}), "Cancelled 3 orders.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_2), "1) " + usrId_2 + " 1 59 BUY\n");
+}
+
+TEST_F(CoreTest, KillSwitch)
+{
+  auto usrId_1 = register_user(core, "User 1");
+
+  place_order(core, usrId_1, "1", "60", true);
+  OrderOptions stop;
+  stop.stopPrice = 70;
+  place_order(core, usrId_1, "1", "71", true, stop);
+
+  EXPECT_EQ(set_user_blocked(core, usrId_1, true), "Trading is disabled for user " + usrId_1 + ".\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "60", true),
+      "Error! Trading is disabled for this user\n");
+  EXPECT_EQ(place_mass_quote(core, usrId_1, true, true, {{1, 60, true}}),
+      "Error! Trading is disabled for this user\n");
+
+  EXPECT_EQ(set_user_blocked(core, usrId_1, false), "Trading is enabled for user " + usrId_1 + ".\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "60", true), "Your order was succesfully placed.\n");
+}
+
+TEST_F(CoreTest, KillSwitchByInstrument)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  const uint64_t userId = std::stoull(usrId_1);
+  OrderOptions eur;
+  eur.instrument = core.AddInstrument("EUR", "RUB");
+
+  place_order(core, usrId_1, "1", "60", true);
+  place_order(core, usrId_1, "1", "70", true, eur);
+
+  // Снимаются заявки только своего инструмента, а новые отклоняются везде
+  EXPECT_EQ(core.Execute(BlockCommand{userId, true, 1}), Status::Ok);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 1 60 BUY USD/RUB\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "61", true),
+      "Error! Trading is disabled for this user\n");
+
+  EXPECT_EQ(core.Execute(BlockCommand{userId, true, 0}), Status::Ok);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "You have no active quotes.\n");
+  EXPECT_EQ(core.Execute(BlockCommand{userId, false, 2}), Status::UnknownInstrument);
+  EXPECT_EQ(set_user_blocked_reply(core.Execute(BlockCommand{userId, false, 0}), usrId_1, false),
+      "Trading is enabled for user " + usrId_1 + ".\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "70", true, eur), "Your order was succesfully placed.\n");
+}
+
+TEST_F(CoreTest, CancelQuoteInTwoSteps)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  place_order(core, usrId_1, "5", "60", true);
+  place_order(core, usrId_1, "5", "59", true);
+
+  uint64_t orderId = 0;
+  EXPECT_EQ(find_user_quote(core, usrId_1, "0", orderId), "Incorrect Quote number.\n");
+  EXPECT_EQ(find_user_quote(core, usrId_1, "3", orderId), "Could not find quote 3\n");
+  EXPECT_EQ(find_user_quote(core, "100", "1", orderId), "Error! Unknown User\n");
+  EXPECT_EQ(find_user_quote(core, usrId_1, "2", orderId), "");
+
+  // Чужую заявку снять нельзя
+  EXPECT_EQ(cancel_user_order(core, usrId_2, orderId, "2"), "Could not find quote 2\n");
+  EXPECT_EQ(cancel_user_order(core, usrId_1, orderId, "2"), "Success!\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 5 60 BUY\n");
+
+  // Заявку исполнили между поиском и снятием
+  EXPECT_EQ(find_user_quote(core, usrId_1, "1", orderId), "");
+  place_order(core, usrId_2, "5", "60", false);
+  EXPECT_EQ(cancel_user_order(core, usrId_1, orderId, "1"), "Could not find quote 1\n");
+}
+
+TEST_F(CoreTest, CancelOrders)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  std::vector<uint64_t> orderIds(1);
+  place_order(core, usrId_1, "5", "60", true, {}, &orderIds[0]);
+  place_mass_quote(core, usrId_1, false, false, {{5, 59, true}, {5, 64, false}}, &orderIds);
+  place_order(core, usrId_1, "5", "58", true);
+  ASSERT_EQ(orderIds.size(), 3u);
+
+  // Первая заявка исполнена и больше не активна
+  place_order(core, usrId_2, "5", "60", false);
+  core.KeepActiveOrders(orderIds);
+  EXPECT_EQ(orderIds.size(), 2u);
+
+  EXPECT_EQ(core.CancelOrders(orderIds), 2u);
+  EXPECT_EQ(core.CancelOrders(orderIds), 0u);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 5 58 BUY\n");
+
+  // Заявки разных инструментов снимаются одной командой
+  OrderOptions eur;
+  eur.instrument = core.AddInstrument("EUR", "RUB");
+  orderIds.assign(2, 0);
+  place_order(core, usrId_1, "1", "70", true, eur, &orderIds[0]);
+  place_order(core, usrId_1, "1", "57", true, {}, &orderIds[1]);
+  core.KeepActiveOrders(orderIds);
+  EXPECT_EQ(orderIds.size(), 2u);
+  EXPECT_EQ(core.CancelOrders(orderIds), 2u);
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 5 58 BUY USD/RUB\n");
+}
+
+TEST_F(CoreTest, RiskChecks)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  EXPECT_EQ(deposit(core, usrId_1, "EUR", "600"), "Error. Unknown asset.\n");
+  EXPECT_EQ(deposit(core, usrId_1, "RUB", "-1"), "Error. Incorrect deposit amount.\n");
+  EXPECT_EQ(deposit(core, usrId_1, "RUB", "600"), "Your deposit was succesfully credited.\n");
+  EXPECT_EQ(deposit(core, usrId_2, "USD", "10"), "Your deposit was succesfully credited.\n");
+  core.SetRiskChecks(true);
+
+  EXPECT_EQ(place_order(core, usrId_1, "11", "60", true), "Error. Insufficient funds.\n");
+  uint64_t orderId;
+  EXPECT_EQ(place_order(core, usrId_1, "10", "60", true, {}, &orderId),
+      "Your order was succesfully placed.\n");
+  // Все рубли зарезервированы под заявку
+  EXPECT_EQ(place_order(core, usrId_1, "1", "1", true), "Error. Insufficient funds.\n");
+
+  // Исполненная часть снимается с резерва вместе с балансом
+  place_order(core, usrId_2, "4", "60", false);
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB 360\nUSD 4\n");
+  EXPECT_EQ(place_order(core, usrId_2, "7", "70", false), "Error. Insufficient funds.\n");
+
+  // Резерв изменяемой заявки учитывается как свободный
+  EXPECT_EQ(amend_order(core, usrId_1, std::to_string(orderId), "7", "60"),
+      "Error. Insufficient funds.\n");
+  EXPECT_EQ(amend_order(core, usrId_1, std::to_string(orderId), "6", "50"),
+      "Your order was succesfully amended.\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "60", true), "Your order was succesfully placed.\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "1", true), "Error. Insufficient funds.\n");
+
+  // Снятые заявки освобождают резерв
+  EXPECT_EQ(mass_cancel(core, usrId_1, OrderFilter{}), "Cancelled 2 orders.\n");
+  EXPECT_EQ(place_order(core, usrId_1, "6", "60", true), "Your order was succesfully placed.\n");
+
+  OrderOptions market;
+  market.type = OrderType::Market;
+  EXPECT_EQ(place_order(core, usrId_1, "1", "0", true, market),
+      "Error. Market buy orders are not accepted with risk checks, use IOC.\n");
+  // Рыночная стоп-покупка тоже не принимается
+  market.stopPrice = 80;
+  EXPECT_EQ(place_order(core, usrId_1, "1", "0", true, market),
+      "Error. Market buy orders are not accepted with risk checks, use IOC.\n");
+
+  EXPECT_EQ(place_mass_quote(core, usrId_2, false, false, {{6, 70, false}, {1, 71, false}}),
+      "Mass quote accepted: 1 orders placed.\nError. Insufficient funds for 1 quotes.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_2), "1) " + usrId_2 + " 6 70 SELL\n");
+}
+
+TEST_F(CoreTest, MultipleInstruments)
+{
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+  OrderOptions eur;
+  eur.instrument = core.AddInstrument("EUR", "RUB");
+  ASSERT_EQ(eur.instrument, 1u);
+  EXPECT_EQ(core.GetInstrumentIndex("EUR/RUB"), 1);
+  EXPECT_EQ(core.GetInstrumentIndex("EUR/USD"), -1);
+
+  // Номер инструмента - в старших битах номера заявки
+  uint64_t usdId, eurId;
+  place_order(core, usrId_1, "10", "60", true, {}, &usdId);
+  place_order(core, usrId_1, "10", "70", true, eur, &eurId);
+  EXPECT_EQ(Core::GetOrderInstrument(usdId), 0u);
+  EXPECT_EQ(Core::GetOrderInstrument(eurId), 1u);
+
+  // Стаканы раздельные, балансы общие
+  place_order(core, usrId_2, "4", "60", false, eur);
+  EXPECT_EQ(market_depth(core, "", 0), "BUY 60 10 1\n");
+  EXPECT_EQ(market_depth(core, "", 1), "BUY 70 6 1\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB 280\nUSD 0\nEUR -4\n");
+  EXPECT_EQ(user_trades(core, usrId_2), usrId_2 + " SOLD " + usrId_1 + " 4 EUR for 70 RUB\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 10 60 BUY USD/RUB\n2) " + usrId_1 + " 6 70 BUY EUR/RUB\n");
+  EXPECT_EQ(market_stats(core, "", 0), "Last 0\nVolume24h 0\nVWAP24h 0\n");
+  EXPECT_EQ(market_stats(core, "", 1).substr(0, 8), "Last 70\n");
+
+  // Снятие по одному инструменту не трогает другой
+  OrderFilter filter;
+  filter.instrument = 0;
+  EXPECT_EQ(mass_cancel(core, usrId_1, filter), "Cancelled 1 orders.\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 6 70 BUY EUR/RUB\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "1", true, OrderOptions{OrderType::Limit, 0, 0, 0, 5}),
+      "Error! Unknown instrument\n");
+}
+
+TEST_F(CoreTest, ConcurrentInstruments)
+{
+  const size_t eur = core.AddInstrument("EUR", "RUB");
+  auto buyer = register_user(core, "Buyer");
+  auto seller = register_user(core, "Seller");
+
+  // Команды разных инструментов выполняются параллельно и меняют общие балансы
+  const auto trade = [&](size_t aInstrument)
+  {
+    OrderOptions options;
+    options.instrument = aInstrument;
+    for (int i = 0; i < 1000; ++i)
+    {
+      place_order(core, buyer, "1", "10", true, options);
+      place_order(core, seller, "1", "10", false, options);
+    }
+  };
+  std::thread usd(trade, 0);
+  std::thread other(trade, eur);
+  usd.join();
+  other.join();
+
+  EXPECT_EQ(user_balance(core, buyer), "RUB -20000\nUSD 1000\nEUR 1000\n");
+  EXPECT_EQ(user_balance(core, seller), "RUB 20000\nUSD -1000\nEUR -1000\n");
+  EXPECT_EQ(user_active_quotes(core, buyer), "You have no active quotes.\n");
+}
+
+TEST_F(CoreTest, QueriesDuringMatching)
+{
+  auto buyer = register_user(core, "Buyer");
+  auto seller = register_user(core, "Seller");
+
+  std::atomic<bool> done {false};
+  std::thread matching([&]
+  {
+    for (int i = 0; i < 2000; ++i)
+    {
+      place_order(core, seller, "1", "10", false);
+      place_order(core, buyer, "1", "10", true);
+    }
+    done = true;
+  });
+
+  // Запросы не ждут сопоставления и видят балансы только целиком после сделки
+  while (!done)
+  {
+    double rub, usd;
+    ASSERT_EQ(std::sscanf(user_balance(core, buyer).c_str(), "RUB %lf\nUSD %lf", &rub, &usd), 2);
+    EXPECT_EQ(rub, -10 * usd);
+    const std::string quotes = user_active_quotes(core, seller);
+    EXPECT_TRUE(quotes == "You have no active quotes.\n" || quotes == "1) " + seller + " 1 10 SELL\n")
+        << quotes;
+    user_trades(core, buyer);
+  }
+  matching.join();
+
+  EXPECT_EQ(user_balance(core, buyer), "RUB -20000\nUSD 2000\n");
+  EXPECT_EQ(user_active_quotes(core, seller), "You have no active quotes.\n");
+}
+
+TEST_F(CoreTest, ManyActiveQuotes)
+{
+  // Длинный список публикуется блоками; нумерация та же, что и у отмены
+  auto maker = register_user(core, "Maker");
+  const int count = static_cast<int>(Core::kOrderBlock) * 5;
+  for (int i = 0; i < count; ++i)
+  {
+    place_order(core, maker, "1", std::to_string(100 + count - i), false);
+  }
+  std::string quotes = user_active_quotes(core, maker);
+  EXPECT_EQ(std::count(quotes.begin(), quotes.end(), '\n'), count);
+  EXPECT_EQ(quotes.find("1) " + maker + " 1 101 SELL\n"), 0u) << quotes;
+
+  // Снятие заявок из середины списка
+  for (int i = 0; i < count / 2; ++i)
+  {
+    cancel_user_quote(core, maker, std::to_string(count / 4));
+  }
+  place_order(core, maker, "2", "100", false);
+  quotes = user_active_quotes(core, maker);
+  EXPECT_EQ(std::count(quotes.begin(), quotes.end(), '\n'), count - count / 2 + 1);
+  EXPECT_EQ(quotes.find("1) " + maker + " 2 100 SELL\n"), 0u) << quotes;
+
+  std::vector<ActiveOrder> orders;
+  ASSERT_EQ(core.GetActiveOrders(std::stoull(maker), orders), Status::Ok);
+  std::vector<Order> expected;
+  for (const ActiveOrder& order : orders)
+  {
+    expected.push_back(order.order);
+  }
+  EXPECT_TRUE(std::is_sorted(expected.begin(), expected.end(), OrderBook::UserOrderLess));
+}
+
+TEST_F(CoreTest, ManyUserTrades)
+{
+  // Номера сделок пользователя растут вместе с историей; чужие сделки не видны
+  auto buyer = register_user(core, "Buyer");
+  auto seller = register_user(core, "Seller");
+  auto other = register_user(core, "Other");
+  const int count = 100;
+  for (int i = 0; i < count; ++i)
+  {
+    place_order(core, seller, "1", std::to_string(10 + i), false);
+    place_order(core, buyer, "1", std::to_string(10 + i), true);
+    place_order(core, other, "1", "5", false);
+    place_order(core, seller, "1", "5", true);
+  }
+
+  std::vector<Trade> trades;
+  ASSERT_EQ(core.GetUserTrades(std::stoull(buyer), trades), Status::Ok);
+  ASSERT_EQ(trades.size(), static_cast<size_t>(count));
+  for (int i = 0; i < count; ++i)
+  {
+    EXPECT_EQ(trades[i].price, 10 + i);
+  }
+  ASSERT_EQ(core.GetUserTrades(std::stoull(seller), trades), Status::Ok);
+  EXPECT_EQ(trades.size(), static_cast<size_t>(2 * count));
+  ASSERT_EQ(core.GetUserTrades(std::stoull(other), trades), Status::Ok);
+  EXPECT_EQ(trades.size(), static_cast<size_t>(count));
+}
+
+TEST_F(CoreTest, ConcurrentRegistration)
+{
+  // Регистрации идут параллельно со сделками и друг с другом
+  auto buyer = register_user(core, "Buyer");
+  auto seller = register_user(core, "Seller");
+  std::thread matching([&]
+  {
+    for (int i = 0; i < 1000; ++i)
+    {
+      place_order(core, seller, "1", "10", false);
+      place_order(core, buyer, "1", "10", true);
+    }
+  });
+
+  std::vector<std::vector<std::string>> ids(4);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < ids.size(); ++t)
+  {
+    threads.emplace_back([&, t]
+    {
+      for (int i = 0; i < 2000; ++i)
+      {
+        ids[t].push_back(register_user(core, "User " + std::to_string(t)));
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+  matching.join();
+
+  std::set<std::string> unique;
+  for (size_t t = 0; t < ids.size(); ++t)
+  {
+    for (const std::string& id : ids[t])
+    {
+      EXPECT_EQ(user_name(core, id), "User " + std::to_string(t));
+      unique.insert(id);
+    }
+  }
+  EXPECT_EQ(unique.size(), 8000u);
+  EXPECT_EQ(user_name(core, "100000"), "Error! Unknown User\n");
+  EXPECT_EQ(user_balance(core, ids[0][0]), "RUB 0\nUSD 0\n");
+  EXPECT_EQ(user_balance(core, buyer), "RUB -10000\nUSD 1000\n");
+}
+
+TEST_F(CoreTest, BalancesReadWhileTrading)
+{
+  auto buyer = register_user(core, "Buyer");
+  auto seller = register_user(core, "Seller");
+  const uint64_t buyerId = std::stoull(buyer);
+  std::atomic<bool> done {false};
+
+  // Читатель без блокировок всегда видит баланс после целой сделки
+  std::thread reader([&]
+  {
+    std::vector<AssetBalance> balances;
+    while (!done)
+    {
+      ASSERT_EQ(core.GetBalances(buyerId, balances), Status::Ok);
+      EXPECT_EQ(balances[0].amount, -10 * balances[1].amount);
+    }
+  });
+  for (int i = 0; i < 2000; ++i)
+  {
+    place_order(core, seller, "1", "10", false);
+    place_order(core, buyer, "1", "10", true);
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(user_balance(core, buyer), "RUB -20000\nUSD 2000\n");
+  EXPECT_THROW(ChunkedVector<double>(0), std::invalid_argument);
+}
+
+TEST_F(CoreTest, RuntimeAssets)
+{
+  EXPECT_THROW(core.AddInstrument("btc", "USD"), std::invalid_argument);
+  EXPECT_THROW(core.AddInstrument("USD", "USD"), std::invalid_argument);
+
+  // Новые активы регистрируются вместе с инструментом, котируемый - раньше базового
+  const size_t btc = core.AddInstrument("BTC", "USDT");
+  auto buyer = register_user(core, "Buyer");
+  auto seller = register_user(core, "Seller");
+  EXPECT_EQ(user_balance(core, buyer), "RUB 0\nUSD 0\nUSDT 0\nBTC 0\n");
+  EXPECT_EQ(deposit(core, buyer, "USDT", "30000"), "Your deposit was succesfully credited.\n");
+
+  OrderOptions options;
+  options.instrument = btc;
+  place_order(core, seller, "0.5", "20000", false, options);
+  place_order(core, buyer, "0.5", "20000", true, options);
+
+  EXPECT_EQ(user_balance(core, buyer), "RUB 0\nUSD 0\nUSDT 20000\nBTC 0.5\n");
+  EXPECT_EQ(user_balance(core, seller), "RUB 0\nUSD 0\nUSDT 10000\nBTC -0.5\n");
+}
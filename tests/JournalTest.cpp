@@ -0,0 +1,411 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#include "../Core.hpp"
+#include "../Journal.hpp"
+#include "../Protocol.hpp"
+
+class JournalTest : public ::testing::Test
+{
+  protected:
+    const std::string path = "journal_test.bin";
+
+    void SetUp() override
+    {
+      std::remove(path.c_str());
+    }
+
+    void TearDown() override
+    {
+      std::remove(path.c_str());
+    }
+};
+
+TEST_F(JournalTest, AppendAndReplay)
+{
+  {
+    Journal::Options options;
+    options.durability = Durability::AckAfterFsync;
+    Journal journal(path, options);
+
+    JournalCommand reg;
+    reg.type = JournalCommand::Type::Register;
+    reg.userId = 7;
+    reg.name = "User 7";
+    EXPECT_EQ(journal.Append(reg), 1u);
+
+    JournalCommand place;
+    place.type = JournalCommand::Type::PlaceOrder;
+    place.userId = 7;
+    place.amount = 10;
+    place.price = 62.5;
+    place.isBuy = true;
+    place.orderType = OrderType::ImmediateOrCancel;
+    EXPECT_EQ(journal.Append(place), 2u);
+
+    JournalCommand cancel;
+    cancel.type = JournalCommand::Type::Cancel;
+    cancel.userId = 7;
+    cancel.quote = 1;
+    journal.WaitDurable(journal.Append(cancel));
+  }
+
+  std::vector<JournalCommand> commands;
+  EXPECT_EQ(Journal::Replay(path,
+      [&](const JournalCommand& c) { commands.push_back(c); }), 3u);
+
+  ASSERT_EQ(commands.size(), 3u);
+  EXPECT_EQ(commands[0].type, JournalCommand::Type::Register);
+  EXPECT_EQ(commands[0].name, "User 7");
+  EXPECT_EQ(commands[1].type, JournalCommand::Type::PlaceOrder);
+  EXPECT_EQ(commands[1].userId, 7u);
+  EXPECT_EQ(commands[1].amount, 10);
+  EXPECT_EQ(commands[1].price, 62.5);
+  EXPECT_TRUE(commands[1].isBuy);
+  EXPECT_EQ(commands[1].orderType, OrderType::ImmediateOrCancel);
+  EXPECT_EQ(commands[2].type, JournalCommand::Type::Cancel);
+  EXPECT_EQ(commands[2].quote, 1);
+}
+
+TEST_F(JournalTest, TornTailIsDropped)
+{
+  {
+    Journal journal(path, Journal::Options{});
+    JournalCommand reg;
+    reg.name = "User";
+    journal.Append(reg);
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << "garbage";
+  }
+
+  // Хвост отрезается при открытии, нумерация продолжается
+  {
+    Journal journal(path, Journal::Options{});
+    JournalCommand reg;
+    reg.name = "User 2";
+    EXPECT_EQ(journal.Append(reg), 2u);
+  }
+
+  std::vector<std::string> names;
+  EXPECT_EQ(Journal::Replay(path,
+      [&](const JournalCommand& c) { names.push_back(c.name); }), 2u);
+  EXPECT_EQ(names, (std::vector<std::string>{"User", "User 2"}));
+}
+
+TEST_F(JournalTest, DamagedLastRecordIsDropped)
+{
+  {
+    Journal journal(path, Journal::Options{});
+    JournalCommand reg;
+    reg.name = "User";
+    journal.Append(reg);
+    reg.name = "User 2";
+    journal.Append(reg);
+  }
+  {
+    // Последний байт последней записи испорчен
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(-1, std::ios::end);
+    file.put('?');
+  }
+
+  std::vector<std::string> names;
+  {
+    Journal journal(path, Journal::Options{},
+        [&](const JournalCommand& c) { names.push_back(c.name); });
+    EXPECT_EQ(journal.GetLastSeq(), 1u);
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{"User"}));
+}
+
+TEST_F(JournalTest, DamagedMiddleRecordThrows)
+{
+  {
+    Journal journal(path, Journal::Options{});
+    JournalCommand reg;
+    reg.name = "User";
+    journal.Append(reg);
+    reg.name = "User 2";
+    journal.Append(reg);
+  }
+  std::ifstream in(path, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  {
+    // Портим имя в первой записи
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(bytes.find("User"));
+    file.put('?');
+  }
+
+  EXPECT_THROW(Journal(path, Journal::Options{}), std::runtime_error);
+  EXPECT_THROW(Journal::Replay(path, {}), std::runtime_error);
+
+  // Следующие записи не отрезаны
+  std::ifstream after(path, std::ios::binary | std::ios::ate);
+  EXPECT_EQ(static_cast<size_t>(after.tellg()), bytes.size());
+}
+
+TEST_F(JournalTest, UnknownRecordTypeThrows)
+{
+  {
+    Journal journal(path, Journal::Options{});
+    JournalCommand reg;
+    reg.name = "User";
+    journal.Append(reg);
+  }
+
+  // Целая запись с типом, которого эта версия не знает: seq, тип, пользователь
+  std::string body(sizeof(uint64_t) + 1 + sizeof(uint64_t), '\0');
+  body[0] = 2;
+  body[sizeof(uint64_t)] = static_cast<char>(200);
+  uint32_t hash = 2166136261u;
+  for (char c : body)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 16777619u;
+  }
+  const uint32_t size = static_cast<uint32_t>(body.size());
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    out << body;
+  }
+
+  EXPECT_THROW(Journal(path, Journal::Options{}), std::runtime_error);
+}
+
+TEST_F(JournalTest, CoreStateSurvivesRestart)
+{
+  std::string usrId_1, usrId_2;
+  {
+    Core core;
+    core.OpenJournal(path, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+    usrId_2 = register_user(core, "User 2");
+    place_order(core, usrId_1, "10", "62", true);
+    place_order(core, usrId_1, "5", "61", true);
+    place_order(core, usrId_2, "4", "60", false);
+    cancel_user_quote(core, usrId_1, "2");
+  }
+
+  Core core;
+  core.OpenJournal(path, Journal::Options{});
+  EXPECT_EQ(user_name(core, usrId_2), "User 2");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB -248\nUSD 4\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB 248\nUSD -4\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 6 62 BUY\n");
+  EXPECT_EQ(user_trades(core, usrId_2),
+      usrId_2 + " SOLD " + usrId_1 + " 4 USD for 62 RUB\n");
+
+  // Новые команды дописываются после восстановленных
+  EXPECT_EQ(register_user(core, "User 3"), "2");
+}
+
+TEST_F(JournalTest, ExpiredOrdersStayExpiredAfterRestart)
+{
+  const uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+
+  std::string usrId_1;
+  {
+    Core core;
+    core.OpenJournal(path, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+
+    OrderOptions gtt;
+    gtt.expireMs = now + 60000;
+    place_order(core, usrId_1, "10", "62", true, gtt);
+    gtt.expireMs = now + 120000;
+    place_order(core, usrId_1, "5", "61", true, gtt);
+    place_order(core, usrId_1, "3", "60", true);
+
+    EXPECT_EQ(core.ExpireOrders(now + 60000), 1u);
+  }
+
+  // Вторая заявка еще жива: журнал снимает только то, что было снято до остановки
+  Core core;
+  core.OpenJournal(path, Journal::Options{});
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 5 61 BUY\n"
+      "2) " + usrId_1 + " 3 60 BUY\n");
+
+  EXPECT_EQ(core.ExpireOrders(now + 120000), 1u);
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 3 60 BUY\n");
+}
+
+TEST_F(JournalTest, EventsWaitForFsync)
+{
+  // Получатель проверяет, что к моменту рассылки команда уже лежит в файле
+  struct DurableListener : CoreListener
+  {
+    std::string path;
+    std::vector<uint64_t> journaled;
+
+    void OnExecutions(const std::vector<ExecutionReport>&) override
+    {
+      journaled.push_back(Journal::Replay(path, {}));
+    }
+  };
+
+  Core core;
+  Journal::Options options;
+  options.durability = Durability::AckAfterFsync;
+  options.groupDelay = std::chrono::milliseconds(20);
+  core.OpenJournal(path, options);
+  DurableListener listener;
+  listener.path = path;
+  core.AddListener(&listener);
+
+  uint64_t buyer, seller;
+  ASSERT_EQ(core.RegisterUser("Buyer", buyer), Status::Ok);
+  ASSERT_EQ(core.RegisterUser("Seller", seller), Status::Ok);
+  NewOrderCommand order;
+  order.userId = buyer;
+  order.amount = 1;
+  order.price = 60;
+  order.isBuy = true;
+  core.Execute(order);
+  order.userId = seller;
+  order.isBuy = false;
+  core.Execute(order);
+  core.Execute(MassCancelCommand{buyer, OrderFilter{}});
+
+  // Регистрации - команды 1 и 2, заявки - 3 и 4
+  EXPECT_EQ(listener.journaled, (std::vector<uint64_t>{3, 4}));
+  core.RemoveListener(&listener);
+}
+
+TEST_F(JournalTest, BlockByInstrumentIsReplayed)
+{
+  std::string usrId_1;
+  {
+    Core core;
+    core.AddInstrument("EUR", "RUB");
+    core.OpenJournal(path, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+    OrderOptions eur;
+    eur.instrument = 1;
+    place_order(core, usrId_1, "1", "60", true);
+    place_order(core, usrId_1, "1", "70", true, eur);
+    core.Execute(BlockCommand{std::stoull(usrId_1), true, 1});
+  }
+
+  Core core;
+  core.AddInstrument("EUR", "RUB");
+  core.OpenJournal(path, Journal::Options{});
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 1 60 BUY USD/RUB\n");
+  EXPECT_EQ(place_order(core, usrId_1, "1", "61", true),
+      "Error! Trading is disabled for this user\n");
+}
+
+TEST_F(JournalTest, MassQuoteIsReplayed)
+{
+  std::string usrId_1;
+  {
+    Core core;
+    core.OpenJournal(path, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+    place_mass_quote(core, usrId_1, true, true, {{10, 60, true}, {5, 64, false}});
+    place_mass_quote(core, usrId_1, false, true, {{3, 63, false}});
+  }
+
+  Core core;
+  core.OpenJournal(path, Journal::Options{});
+  EXPECT_EQ(market_depth(core, ""), "SELL 63 3 1\nBUY 60 10 1\n");
+}
+
+TEST_F(JournalTest, ReplayCommandsWithoutJournal)
+{
+  std::string usrId_1, usrId_2;
+  {
+    Core core;
+    core.OpenJournal(path, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+    usrId_2 = register_user(core, "User 2");
+    place_order(core, usrId_1, "10", "62", true);
+    place_order(core, usrId_2, "4", "60", false);
+  }
+
+  // Записанный поток прогоняется через ядро без открытия журнала на запись
+  Core core;
+  uint64_t trades = 0;
+  struct Counter : CoreListener
+  {
+    uint64_t& count;
+    explicit Counter(uint64_t& aCount) : count{aCount} {}
+    void OnMarketData(const std::vector<LevelUpdate>&, const std::vector<Trade>& aTrades) override
+    {
+      count += aTrades.size();
+    }
+  } counter {trades};
+  core.AddListener(&counter);
+  EXPECT_EQ(Journal::Replay(path, [&](const JournalCommand& aCommand)
+  {
+    core.ReplayCommand(aCommand);
+  }), 4u);
+  core.RemoveListener(&counter);
+
+  EXPECT_EQ(trades, 1u);
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB -248\nUSD 4\n");
+  EXPECT_EQ(user_active_quotes(core, usrId_1), "1) " + usrId_1 + " 6 62 BUY\n");
+  EXPECT_EQ(Journal::Replay(path, [](const JournalCommand&) {}), 4u);
+}
+
+TEST_F(JournalTest, CommandsOfUnknownUserAreSkipped)
+{
+  {
+    Journal journal(path, Journal::Options{});
+    // Номер далеко за выделенными записями пользователей
+    const uint64_t unknown = 100000;
+    JournalCommand place;
+    place.type = JournalCommand::Type::PlaceOrder;
+    place.userId = unknown;
+    place.amount = 10;
+    place.price = 62;
+    place.isBuy = true;
+    journal.Append(place);
+
+    JournalCommand amend;
+    amend.type = JournalCommand::Type::Amend;
+    amend.userId = unknown;
+    amend.orderId = 1;
+    amend.amount = 5;
+    amend.price = 62;
+    journal.Append(amend);
+
+    JournalCommand cancel;
+    cancel.type = JournalCommand::Type::Cancel;
+    cancel.userId = unknown;
+    cancel.quote = 1;
+    journal.Append(cancel);
+
+    JournalCommand deposit;
+    deposit.type = JournalCommand::Type::Deposit;
+    deposit.userId = unknown;
+    deposit.asset = 0;
+    deposit.amount = 100;
+    journal.Append(deposit);
+
+    JournalCommand reg;
+    reg.type = JournalCommand::Type::Register;
+    reg.userId = 0;
+    reg.name = "User 0";
+    journal.Append(reg);
+  }
+
+  Core core;
+  core.OpenJournal(path, Journal::Options{});
+  EXPECT_EQ(user_balance(core, "100000"), "Error! Unknown User\n");
+  EXPECT_EQ(user_active_quotes(core, "0"), "You have no active quotes.\n");
+  // Номера пользователей продолжаются после повторенной регистрации
+  EXPECT_EQ(register_user(core, "User 1"), "1");
+}
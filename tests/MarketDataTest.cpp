@@ -0,0 +1,217 @@
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "../Core.hpp"
+#include "../MarketData.hpp"
+#include "../Protocol.hpp"
+
+namespace
+{
+  // Подписчик, который запоминает отправленные сообщения и сливает обновления
+  // так же, как сессия сервера; queued - сколько сообщений якобы ждет отправки
+  struct Subscriber : market_data_subscriber
+  {
+    std::vector<std::shared_ptr<const std::string>> buffers;
+    std::vector<nlohmann::json> messages;
+    market_data_conflator conflator;
+    size_t queued = 0;
+
+    void deliver(const std::shared_ptr<const std::string>& message)
+    {
+      buffers.push_back(message);
+      messages.push_back(nlohmann::json::parse(*message));
+    }
+
+    void deliver_snapshot(const std::shared_ptr<const std::string>& message,
+        uint64_t seq) override
+    {
+      conflator.on_snapshot(seq);
+      deliver(message);
+    }
+
+    void deliver_market_data(const std::shared_ptr<const std::string>& message,
+        const std::vector<LevelUpdate>& levels, const std::vector<Trade>& trades,
+        uint64_t seq) override
+    {
+      if (conflator.offer(levels, trades, seq, queued))
+      {
+        deliver(message);
+      }
+    }
+  };
+}
+
+class MarketDataTest : public ::testing::Test
+{
+  protected:
+    Core core;
+    std::string buyer;
+    std::string seller;
+
+    void SetUp() override
+    {
+      buyer = register_user(core, "Buyer");
+      seller = register_user(core, "Seller");
+    }
+};
+
+TEST_F(MarketDataTest, SnapshotThenUpdates)
+{
+  place_order(core, buyer, "10", "62", true);
+
+  market_data_channel channel(core);
+  core.AddListener(&channel);
+  auto subscriber = std::make_shared<Subscriber>();
+  channel.subscribe(subscriber);
+
+  ASSERT_EQ(subscriber->messages.size(), 1u);
+  const nlohmann::json& snapshot = subscriber->messages[0];
+  EXPECT_EQ(snapshot["Type"], "Snapshot");
+  EXPECT_EQ(snapshot["Seq"], 0u);
+  ASSERT_EQ(snapshot["Levels"].size(), 1u);
+  EXPECT_EQ(snapshot["Levels"][0]["Side"], "BUY");
+  EXPECT_EQ(snapshot["Levels"][0]["Price"], 62);
+  EXPECT_EQ(snapshot["Levels"][0]["Amount"], 10);
+
+  place_order(core, seller, "4", "62", false);
+  core.RemoveListener(&channel);
+
+  ASSERT_EQ(subscriber->messages.size(), 2u);
+  const nlohmann::json& update = subscriber->messages[1];
+  EXPECT_EQ(update["Type"], "Update");
+  EXPECT_EQ(update["Seq"], 1u);
+  ASSERT_EQ(update["Levels"].size(), 1u);
+  EXPECT_EQ(update["Levels"][0]["Amount"], 6);
+  ASSERT_EQ(update["Trades"].size(), 1u);
+  EXPECT_EQ(update["Trades"][0]["Amount"], 4);
+}
+
+TEST_F(MarketDataTest, SequenceIsMonotonic)
+{
+  market_data_channel channel(core);
+  core.AddListener(&channel);
+  auto subscriber = std::make_shared<Subscriber>();
+  channel.subscribe(subscriber);
+
+  place_order(core, buyer, "10", "60", true);
+  place_order(core, buyer, "10", "61", true);
+  place_order(core, seller, "5", "61", false);
+  cancel_user_quote(core, buyer, "1");
+  core.RemoveListener(&channel);
+
+  ASSERT_EQ(subscriber->messages.size(), 5u);
+  for (size_t i = 1; i < subscriber->messages.size(); ++i)
+  {
+    EXPECT_EQ(subscriber->messages[i]["Type"], "Update");
+    EXPECT_EQ(subscriber->messages[i]["Seq"], i);
+  }
+}
+
+TEST_F(MarketDataTest, UpdateIsSharedBySubscribers)
+{
+  market_data_channel channel(core);
+  core.AddListener(&channel);
+  auto first = std::make_shared<Subscriber>();
+  auto second = std::make_shared<Subscriber>();
+  channel.subscribe(first);
+  channel.subscribe(second);
+
+  place_order(core, buyer, "10", "60", true);
+  channel.unsubscribe(second);
+  place_order(core, buyer, "10", "61", true);
+  core.RemoveListener(&channel);
+
+  // Одно обновление сериализуется один раз
+  ASSERT_EQ(first->buffers.size(), 3u);
+  ASSERT_EQ(second->buffers.size(), 2u);
+  EXPECT_EQ(first->buffers[1], second->buffers[1]);
+}
+
+TEST_F(MarketDataTest, UpdatesInsideSnapshotAreDropped)
+{
+  // Рассылка ждет своего потока, как в сервере
+  std::vector<std::function<void()>> posted;
+  market_data_channel channel(core, [&](const std::function<void()>& fn)
+  {
+    posted.push_back(fn);
+  });
+  core.AddListener(&channel);
+
+  place_order(core, buyer, "10", "60", true);
+  auto subscriber = std::make_shared<Subscriber>();
+  channel.subscribe(subscriber);
+  place_order(core, buyer, "5", "61", true);
+
+  for (const auto& fn : posted)
+  {
+    fn();
+  }
+  core.RemoveListener(&channel);
+
+  // Снимок уже содержит первую заявку, поэтому приходит только обновление второй
+  ASSERT_EQ(subscriber->messages.size(), 2u);
+  EXPECT_EQ(subscriber->messages[0]["Seq"], 1u);
+  EXPECT_EQ(subscriber->messages[0]["Levels"].size(), 1u);
+  EXPECT_EQ(subscriber->messages[1]["Seq"], 2u);
+  EXPECT_EQ(subscriber->messages[1]["Levels"][0]["Price"], 61);
+}
+
+TEST_F(MarketDataTest, SlowConsumerIsConflated)
+{
+  market_data_channel channel(core);
+  core.AddListener(&channel);
+  auto subscriber = std::make_shared<Subscriber>();
+  channel.subscribe(subscriber);
+
+  // Пока очередь не заполнена, обновления уходят как есть
+  subscriber->queued = market_data_conflator::max_queued - 1;
+  place_order(core, buyer, "10", "60", true);
+  EXPECT_EQ(subscriber->messages.size(), 2u);
+
+  // Очередь заполнена: по каждому уровню остается последнее состояние
+  subscriber->queued = market_data_conflator::max_queued;
+  place_order(core, buyer, "10", "60", true);
+  place_order(core, buyer, "5", "61", true);
+  // Пока есть слитое, новые обновления тоже сливаются, чтобы не обогнать его
+  subscriber->queued = 0;
+  place_order(core, seller, "25", "60", false);
+  core.RemoveListener(&channel);
+  EXPECT_EQ(subscriber->messages.size(), 2u);
+
+  const auto message = subscriber->conflator.take(core);
+  ASSERT_NE(message, nullptr);
+  EXPECT_TRUE(subscriber->conflator.empty());
+  EXPECT_EQ(subscriber->conflator.take(core), nullptr);
+
+  const nlohmann::json update = nlohmann::json::parse(*message);
+  EXPECT_EQ(update["Type"], "Update");
+  EXPECT_EQ(update["Seq"], 4u);
+  EXPECT_TRUE(update["Conflated"].get<bool>());
+  ASSERT_EQ(update["Levels"].size(), 2u);
+  EXPECT_EQ(update["Levels"][0]["Price"], 60);
+  EXPECT_EQ(update["Levels"][0]["Amount"], 0);
+  EXPECT_EQ(update["Levels"][1]["Price"], 61);
+  EXPECT_EQ(update["Levels"][1]["Amount"], 0);
+  EXPECT_EQ(update["Trades"].size(), 3u);
+}
+
+TEST_F(MarketDataTest, ConflatedTradesAreBounded)
+{
+  market_data_conflator conflator;
+  const size_t count = market_data_conflator::max_trades + 10;
+  for (size_t i = 0; i < count; ++i)
+  {
+    Trade trade {};
+    trade.price = 60;
+    trade.amount = static_cast<double>(i);
+    EXPECT_FALSE(conflator.offer({}, {trade}, i + 1, market_data_conflator::max_queued));
+  }
+
+  const nlohmann::json update = nlohmann::json::parse(*conflator.take(core));
+  ASSERT_EQ(update["Trades"].size(), static_cast<size_t>(market_data_conflator::max_trades));
+  EXPECT_EQ(update["Trades"][0]["Amount"], 10);
+  EXPECT_EQ(update["Seq"], count);
+}
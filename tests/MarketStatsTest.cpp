@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include "../Core.hpp"
+#include "../MarketStats.hpp"
+#include "../Protocol.hpp"
+
+namespace
+{
+  constexpr int64_t kSecond = 1000000000;
+  constexpr int64_t kMinute = 60 * kSecond;
+  constexpr int64_t kHour = 60 * kMinute;
+  // Произвольная точка отсчета, кратная часу
+  constexpr int64_t kStart = 500000 * kHour;
+}
+
+TEST(MarketStatsTest, Candles)
+{
+  MarketStats stats;
+  stats.OnTrade(62, 10, kStart);
+  stats.OnTrade(65, 5, kStart + kSecond / 2);
+  stats.OnTrade(61, 1, kStart + kSecond / 2);
+  stats.OnTrade(63, 2, kStart + 3 * kSecond);
+
+  EXPECT_EQ(stats.GetLastPrice(), 63);
+
+  const auto seconds = stats.GetCandles(MarketStats::Second);
+  ASSERT_EQ(seconds.size(), 2u);
+  EXPECT_EQ(seconds[0].startNs, kStart);
+  EXPECT_EQ(seconds[0].open, 62);
+  EXPECT_EQ(seconds[0].high, 65);
+  EXPECT_EQ(seconds[0].low, 61);
+  EXPECT_EQ(seconds[0].close, 61);
+  EXPECT_EQ(seconds[0].volume, 16);
+  EXPECT_EQ(seconds[1].startNs, kStart + 3 * kSecond);
+
+  const auto hours = stats.GetCandles(MarketStats::Hour);
+  ASSERT_EQ(hours.size(), 1u);
+  EXPECT_EQ(hours[0].open, 62);
+  EXPECT_EQ(hours[0].close, 63);
+  EXPECT_EQ(hours[0].volume, 18);
+}
+
+TEST(MarketStatsTest, CandleRingKeepsLatest)
+{
+  MarketStats stats;
+  for (int i = 0; i < 100; ++i)
+  {
+    stats.OnTrade(60 + i, 1, kStart + i * kSecond);
+  }
+
+  const auto seconds = stats.GetCandles(MarketStats::Second);
+  ASSERT_EQ(seconds.size(), 60u);
+  EXPECT_EQ(seconds.front().open, 100);
+  EXPECT_EQ(seconds.back().open, 159);
+}
+
+TEST(MarketStatsTest, RollingDayVolumeAndVwap)
+{
+  MarketStats stats;
+  stats.OnTrade(60, 10, kStart);
+  stats.OnTrade(70, 30, kStart + 12 * kHour);
+
+  EXPECT_DOUBLE_EQ(stats.GetVolume24h(kStart + 12 * kHour), 40);
+  EXPECT_DOUBLE_EQ(stats.GetVwap24h(kStart + 12 * kHour), 67.5);
+
+  // Первая сделка выходит из окна через сутки
+  EXPECT_DOUBLE_EQ(stats.GetVolume24h(kStart + 24 * kHour), 30);
+  EXPECT_DOUBLE_EQ(stats.GetVwap24h(kStart + 24 * kHour), 70);
+
+  EXPECT_DOUBLE_EQ(stats.GetVolume24h(kStart + 100 * kHour), 0);
+  EXPECT_DOUBLE_EQ(stats.GetVwap24h(kStart + 100 * kHour), 0);
+}
+
+TEST(MarketStatsTest, CoreReportsStats)
+{
+  Core core;
+  auto usrId_1 = register_user(core, "User 1");
+  auto usrId_2 = register_user(core, "User 2");
+
+  EXPECT_EQ(market_stats(core, ""), "Last 0\nVolume24h 0\nVWAP24h 0\n");
+
+  place_order(core, usrId_1, "10", "60", true);
+  place_order(core, usrId_1, "30", "70", true);
+  place_order(core, usrId_2, "40", "50", false);
+
+  EXPECT_EQ(market_stats(core, ""), "Last 60\nVolume24h 40\nVWAP24h 67.5\n");
+
+  const std::string withCandles = market_stats(core, "1m");
+  EXPECT_NE(withCandles.find(" 70 70 60 60 40\n"), std::string::npos);
+}
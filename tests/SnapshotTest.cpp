@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../Core.hpp"
+#include "../Protocol.hpp"
+
+namespace
+{
+  // Проверять ли кучу в дочерних процессах снимков (SnapshotChildDoesNotAllocate)
+  bool gCheckSnapshotHeap = false;
+  // Куча запрещена: мы в дочернем процессе снимка
+  bool gHeapForbidden = false;
+  constexpr int kHeapUsedExitCode = 42;
+}
+
+// Дочерний процесс снимка, обратившийся к куче, завершается с ошибкой,
+// и снимок не считается записанным
+void* operator new(std::size_t aSize)
+{
+  if (gHeapForbidden)
+  {
+    ::_exit(kHeapUsedExitCode);
+  }
+  if (void* memory = std::malloc(aSize ? aSize : 1))
+  {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* aMemory) noexcept
+{
+  if (gHeapForbidden)
+  {
+    ::_exit(kHeapUsedExitCode);
+  }
+  std::free(aMemory);
+}
+
+void operator delete(void* aMemory, std::size_t) noexcept
+{
+  operator delete(aMemory);
+}
+
+class SnapshotTest : public ::testing::Test
+{
+  protected:
+    const std::string snapshotPath = "snapshot_test.bin";
+    const std::string journalPath = "snapshot_test_journal.bin";
+    const std::string tradesPath = "snapshot_test_trades";
+
+    void SetUp() override
+    {
+      TearDown();
+    }
+
+    void TearDown() override
+    {
+      std::remove(snapshotPath.c_str());
+      std::remove((snapshotPath + ".tmp").c_str());
+      std::remove(journalPath.c_str());
+      std::remove((tradesPath + ".000000").c_str());
+    }
+};
+
+TEST_F(SnapshotTest, MissingSnapshot)
+{
+  Core core;
+  EXPECT_FALSE(core.LoadSnapshot(snapshotPath));
+  EXPECT_FALSE(core.WaitSnapshot());
+}
+
+TEST_F(SnapshotTest, RecoverFromSnapshotAndJournalTail)
+{
+  std::string usrId_1, usrId_2, usrId_3;
+  {
+    Core core;
+    core.OpenTradeStore(tradesPath);
+    core.OpenJournal(journalPath, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+    usrId_2 = register_user(core, "User 2");
+    place_order(core, usrId_1, "10", "62", true);
+    place_order(core, usrId_1, "10", "62", true);
+    place_order(core, usrId_2, "4", "61", false);
+    OrderOptions stop;
+    stop.stopPrice = 70;
+    place_order(core, usrId_1, "1", "71", true, stop);
+
+    ASSERT_TRUE(core.TakeSnapshot(snapshotPath));
+    ASSERT_TRUE(core.WaitSnapshot());
+
+    // Хвост журнала после снимка
+    usrId_3 = register_user(core, "User 3");
+    place_order(core, usrId_3, "8", "60", false);
+  }
+
+  Core core;
+  core.OpenTradeStore(tradesPath);
+  ASSERT_TRUE(core.LoadSnapshot(snapshotPath));
+  core.OpenJournal(journalPath, Journal::Options{});
+
+  EXPECT_EQ(user_name(core, usrId_3), "User 3");
+  EXPECT_EQ(user_balance(core, usrId_1), "RUB -744\nUSD 12\n");
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB 248\nUSD -4\n");
+  EXPECT_EQ(user_balance(core, usrId_3), "RUB 496\nUSD -8\n");
+
+  // Первая заявка исполнена раньше второй - приоритет сохранен в снимке
+  EXPECT_EQ(user_active_quotes(core, usrId_1),
+      "1) " + usrId_1 + " 8 62 BUY\n"
+      "2) " + usrId_1 + " 1 71 BUY STOP 70\n");
+  EXPECT_EQ(user_trades(core, usrId_1),
+      usrId_2 + " SOLD " + usrId_1 + " 4 USD for 62 RUB\n" +
+      usrId_3 + " SOLD " + usrId_1 + " 6 USD for 62 RUB\n" +
+      usrId_3 + " SOLD " + usrId_1 + " 2 USD for 62 RUB\n");
+}
+
+TEST_F(SnapshotTest, InstrumentsSurviveRestart)
+{
+  std::string usrId_1, usrId_2;
+  OrderOptions eur;
+  {
+    Core core;
+    eur.instrument = core.AddInstrument("EUR", "RUB");
+    core.OpenTradeStore(tradesPath);
+    core.OpenJournal(journalPath, Journal::Options{});
+    usrId_1 = register_user(core, "User 1");
+    usrId_2 = register_user(core, "User 2");
+    place_order(core, usrId_1, "10", "70", true, eur);
+    place_order(core, usrId_1, "10", "60", true);
+
+    ASSERT_TRUE(core.TakeSnapshot(snapshotPath));
+    ASSERT_TRUE(core.WaitSnapshot());
+
+    // Номера заявок хвоста журнала выдаются заново по инструментам
+    place_order(core, usrId_2, "3", "70", false, eur);
+    place_mass_quote(core, usrId_2, false, false, {{2, 71, false}}, nullptr, eur.instrument);
+  }
+
+  // Снимок другого набора инструментов не загружается
+  {
+    Core core;
+    core.OpenTradeStore(tradesPath);
+    EXPECT_FALSE(core.LoadSnapshot(snapshotPath));
+  }
+
+  Core core;
+  core.AddInstrument("EUR", "RUB");
+  core.OpenTradeStore(tradesPath);
+  ASSERT_TRUE(core.LoadSnapshot(snapshotPath));
+  core.OpenJournal(journalPath, Journal::Options{});
+
+  EXPECT_EQ(user_balance(core, usrId_2), "RUB 210\nUSD 0\nEUR -3\n");
+  EXPECT_EQ(market_depth(core, "", eur.instrument), "SELL 71 2 1\nBUY 70 7 1\n");
+  EXPECT_EQ(market_depth(core, "", 0), "BUY 60 10 1\n");
+
+  uint64_t orderId;
+  place_order(core, usrId_1, "1", "50", true, eur, &orderId);
+  EXPECT_EQ(orderId, (uint64_t{1} << 48) + 4);
+}
+
+TEST_F(SnapshotTest, SnapshotChildDoesNotAllocate)
+{
+  // После fork куча может остаться заблокированной другим потоком
+  static const int registered = pthread_atfork(nullptr, nullptr, []
+  {
+    gHeapForbidden = gCheckSnapshotHeap;
+  });
+  ASSERT_EQ(registered, 0);
+
+  Core core;
+  core.AddInstrument("EUR", "RUB");
+  core.OpenTradeStore(tradesPath);
+  const std::string buyer = register_user(core, "Buyer");
+  const std::string seller = register_user(core, "Seller");
+  place_order(core, buyer, "10", "62", true);
+  place_order(core, seller, "4", "61", false);
+  OrderOptions stop;
+  stop.stopPrice = 70;
+  place_order(core, buyer, "1", "71", true, stop);
+
+  gCheckSnapshotHeap = true;
+  const bool started = core.TakeSnapshot(snapshotPath);
+  gCheckSnapshotHeap = false;
+  ASSERT_TRUE(started);
+  EXPECT_TRUE(core.WaitSnapshot());
+}
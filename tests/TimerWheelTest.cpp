@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <set>
+
+#include "../TimerWheel.hpp"
+
+TEST(TimerWheelTest, FiresInDeadlineOrder)
+{
+  TimerWheel wheel(1000);
+  wheel.Schedule(1005, 1);
+  wheel.Schedule(1000 + 70 * 64, 2);
+  wheel.Schedule(999, 3);
+  wheel.Schedule(1064, 4);
+  EXPECT_EQ(wheel.Size(), 4u);
+
+  std::vector<uint64_t> fired;
+  const auto onExpire = [&](uint64_t aId) { fired.push_back(aId); };
+
+  wheel.Advance(1004, onExpire);
+  EXPECT_EQ(fired, std::vector<uint64_t>({3}));
+
+  wheel.Advance(1064, onExpire);
+  EXPECT_EQ(fired, std::vector<uint64_t>({3, 1, 4}));
+
+  wheel.Advance(1000 + 70 * 64 - 1, onExpire);
+  EXPECT_EQ(fired.size(), 3u);
+  wheel.Advance(1000 + 70 * 64, onExpire);
+  EXPECT_EQ(fired, std::vector<uint64_t>({3, 1, 4, 2}));
+  EXPECT_EQ(wheel.Size(), 0u);
+}
+
+TEST(TimerWheelTest, MatchesSortedDeadlines)
+{
+  const uint64_t start = 1700000000000;
+  TimerWheel wheel(start);
+
+  std::mt19937_64 random(42);
+  std::multimap<uint64_t, uint64_t> expected;
+  for (uint64_t id = 0; id < 5000; ++id)
+  {
+    // От миллисекунд до нескольких лет вперед
+    const uint64_t deadline = start + ((random() % (uint64_t(1) << 40)) >> (random() % 40));
+    wheel.Schedule(deadline, id);
+    expected.emplace(deadline, id);
+  }
+
+  uint64_t now = start;
+  while (!expected.empty())
+  {
+    now += 1 + ((random() % (uint64_t(1) << 34)) >> (random() % 34));
+    std::vector<uint64_t> fired;
+    wheel.Advance(now, [&](uint64_t aId) { fired.push_back(aId); });
+
+    std::set<uint64_t> due;
+    while (!expected.empty() && expected.begin()->first <= now)
+    {
+      due.insert(expected.begin()->second);
+      expected.erase(expected.begin());
+    }
+    ASSERT_EQ(std::set<uint64_t>(fired.begin(), fired.end()), due);
+    ASSERT_EQ(wheel.GetNow(), now);
+  }
+  EXPECT_EQ(wheel.Size(), 0u);
+}
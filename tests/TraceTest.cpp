@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "../Trace.hpp"
+
+#ifdef ECN_TRACE
+
+TEST(TraceTest, DumpContainsEventsOfAllThreads)
+{
+  {
+    TRACE_SCOPE(PlaceNewOrder);
+    TRACE_INSTANT(Accept);
+  }
+
+  std::thread worker([] { TRACE_SCOPE(MatchOrder); });
+  worker.join();
+
+  const std::string path = "trace_test.json";
+  ASSERT_TRUE(Trace::Dump(path));
+
+  std::ifstream in(path);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  const std::string json = ss.str();
+
+  EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0u);
+  EXPECT_NE(json.find("\"name\":\"PlaceNewOrder\",\"ph\":\"B\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"PlaceNewOrder\",\"ph\":\"E\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"Accept\",\"ph\":\"i\""), std::string::npos);
+  EXPECT_NE(json.find("\"name\":\"MatchOrder\",\"ph\":\"B\""), std::string::npos);
+
+  std::remove(path.c_str());
+}
+
+#else
+
+TEST(TraceTest, DisabledDumpFails)
+{
+  TRACE_INSTANT(Accept);
+  EXPECT_FALSE(Trace::Dump("trace_test.json"));
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "../TradeStore.hpp"
+
+class TradeStoreTest : public ::testing::Test
+{
+  protected:
+    const std::string path = "trade_store_test";
+
+    void TearDown() override
+    {
+      for (int i = 0; i < 1000; ++i)
+      {
+        char suffix[16];
+        std::snprintf(suffix, sizeof(suffix), ".%06d", i);
+        std::remove((path + suffix).c_str());
+      }
+    }
+};
+
+TEST_F(TradeStoreTest, AnonymousStoreGrowsBySegments)
+{
+  TradeStore store("", 2);
+  for (uint64_t i = 0; i < 5; ++i)
+  {
+    store.Append(Trade{i, i + 1, 10.0 + i, 60.5, 0, 0});
+  }
+
+  const Trade& first = store[0];
+  ASSERT_EQ(store.Size(), 5u);
+  EXPECT_EQ(store[4].buyerId, 4u);
+  EXPECT_EQ(store[4].amount, 14);
+  // Рост хранилища не перемещает старые записи
+  EXPECT_EQ(&first, &store[0]);
+}
+
+TEST_F(TradeStoreTest, HistorySurvivesReopen)
+{
+  {
+    TradeStore store(path, 2);
+    for (uint64_t i = 0; i < 5; ++i)
+    {
+      store.Append(Trade{i, i + 1, 1.0, 62.0, 0, i % 2});
+    }
+  }
+  {
+    TradeStore store(path, 2);
+    ASSERT_EQ(store.Size(), 5u);
+    EXPECT_EQ(store[3].sellerId, 4u);
+    EXPECT_EQ(store[3].instrument, 1u);
+
+    store.Truncate(3);
+    store.Append(Trade{7, 8, 2.0, 63.0, 0, 0});
+  }
+
+  TradeStore store(path, 2);
+  ASSERT_EQ(store.Size(), 4u);
+  EXPECT_EQ(store[3].buyerId, 7u);
+  EXPECT_EQ(store[3].price, 63);
+}
+
+TEST_F(TradeStoreTest, ReadWhileAppending)
+{
+  // Читатель без блокировки видит только дописанные сделки, в том числе
+  // из сегментов, подключенных во время чтения
+  TradeStore store(path, 16);
+  constexpr uint64_t count = 10000;
+  std::atomic<bool> done {false};
+  std::thread reader([&]
+  {
+    while (!done)
+    {
+      const size_t size = store.Size();
+      if (size > 0)
+      {
+        EXPECT_EQ(store[size - 1].buyerId, size - 1);
+      }
+    }
+  });
+  for (uint64_t i = 0; i < count; ++i)
+  {
+    store.Append(Trade{i, i + 1, 1.0, 62.0, 0, 0});
+  }
+  done = true;
+  reader.join();
+
+  EXPECT_EQ(store.Size(), count);
+  EXPECT_TRUE(store.Sync(count));
+}